@@ -54,7 +54,9 @@ if "--static-link" in sys.argv:
 
 portaudio_path = os.environ.get("PORTAUDIO_PATH", "./portaudio-v19")
 
-pyaudio_module_sources = ['src/_portaudiomodule.c']
+pyaudio_module_sources = ['src/_portaudiomodule.c', 'src/_portaudioutil.c',
+                          'src/_dsp.c', 'src/_recorder.c',
+                          'src/_mixer.c', 'src/_resample.c']
 
 include_dirs = []
 external_libraries = []
@@ -0,0 +1,1150 @@
+/**
+ * PyAudio : Python Bindings for PortAudio.
+ *
+ * PyAudio : Signal processing
+ *
+ * Copyright (c) 2006-2008 Hubert Pham
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "_dsp.h"
+#include "_portaudioutil.h"
+
+/* paInt24 samples are packed in native byte order */
+#if defined(__BIG_ENDIAN__) || \
+  (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define INT24_HI 0
+#define INT24_MID 1
+#define INT24_LO 2
+#else
+#define INT24_LO 0
+#define INT24_MID 1
+#define INT24_HI 2
+#endif
+
+/* SSE2 is part of every x86-64 CPU (and of 32-bit builds that ask for
+   it); AVX2 is chosen at run time, where the compiler can target it
+   for single functions */
+#if defined(__SSE2__) || defined(_M_X64) || \
+  (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DSP_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(DSP_SSE2) && defined(__GNUC__) && \
+  (defined(__x86_64__) || defined(__i386__))
+#define DSP_AVX2
+#define DSP_TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+
+
+/*************************************************************
+ * Vectorized Conversion Kernels
+ *************************************************************/
+
+/* Each kernel converts as many samples as fill whole vectors and
+ * returns how many, leaving the rest to the scalar loops below, whose
+ * results they match exactly (integers are scaled and truncated the
+ * same way, and int32 output goes through double precision as well).
+ * Packed paInt24 has no kernel: its 3-byte samples do not map onto
+ * SSE2 lanes. */
+
+#ifdef DSP_AVX2
+
+/* -1 until checked, then whether the CPU supports AVX2 */
+static volatile int _hasAvx2 = -1;
+
+static int
+_dsp_has_avx2(void)
+{
+  /* the check is idempotent, so racing callers are harmless */
+  if (_hasAvx2 < 0) {
+    __builtin_cpu_init();
+    _hasAvx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+  }
+  return _hasAvx2;
+}
+
+DSP_TARGET_AVX2 static unsigned long
+_int32_to_float_avx2(float *dst, const int *src, unsigned long samples)
+{
+  const __m256 scale = _mm256_set1_ps(1.0f / 2147483648.0f);
+  unsigned long i;
+
+  for (i = 0; i + 8 <= samples; i += 8) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) (src + i));
+    _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+  }
+  return i;
+}
+
+DSP_TARGET_AVX2 static unsigned long
+_int16_to_float_avx2(float *dst, const short *src, unsigned long samples)
+{
+  const __m256 scale = _mm256_set1_ps(1.0f / 32768.0f);
+  unsigned long i;
+
+  for (i = 0; i + 8 <= samples; i += 8) {
+    __m256i v = _mm256_cvtepi16_epi32(
+      _mm_loadu_si128((const __m128i *) (src + i)));
+    _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+  }
+  return i;
+}
+
+DSP_TARGET_AVX2 static unsigned long
+_float_to_int32_avx2(int *dst, const float *src, unsigned long samples)
+{
+  const __m256 lo = _mm256_set1_ps(-1.0f);
+  const __m256 hi = _mm256_set1_ps(1.0f);
+  const __m256d scale = _mm256_set1_pd(2147483647.0);
+  unsigned long i;
+
+  for (i = 0; i + 8 <= samples; i += 8) {
+    __m256 v = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(src + i), lo),
+                             hi);
+    __m128i a = _mm256_cvttpd_epi32(
+      _mm256_mul_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(v)), scale));
+    __m128i b = _mm256_cvttpd_epi32(
+      _mm256_mul_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(v, 1)), scale));
+    _mm_storeu_si128((__m128i *) (dst + i), a);
+    _mm_storeu_si128((__m128i *) (dst + i + 4), b);
+  }
+  return i;
+}
+
+DSP_TARGET_AVX2 static unsigned long
+_float_to_int16_avx2(short *dst, const float *src, unsigned long samples)
+{
+  const __m256 lo = _mm256_set1_ps(-1.0f);
+  const __m256 hi = _mm256_set1_ps(1.0f);
+  const __m256 scale = _mm256_set1_ps(32767.0f);
+  unsigned long i;
+
+  for (i = 0; i + 16 <= samples; i += 16) {
+    __m256 a = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(src + i), lo),
+                             hi);
+    __m256 b = _mm256_min_ps(
+      _mm256_max_ps(_mm256_loadu_ps(src + i + 8), lo), hi);
+    __m256i packed = _mm256_packs_epi32(
+      _mm256_cvttps_epi32(_mm256_mul_ps(a, scale)),
+      _mm256_cvttps_epi32(_mm256_mul_ps(b, scale)));
+    /* packs works within 128-bit lanes; put the quarters in order */
+    _mm256_storeu_si256((__m256i *) (dst + i),
+                        _mm256_permute4x64_epi64(packed, 0xD8));
+  }
+  return i;
+}
+
+#endif
+
+#ifdef DSP_SSE2
+
+static unsigned long
+_int32_to_float_sse2(float *dst, const int *src, unsigned long samples)
+{
+  const __m128 scale = _mm_set1_ps(1.0f / 2147483648.0f);
+  unsigned long i;
+
+  for (i = 0; i + 4 <= samples; i += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i *) (src + i));
+    _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+  }
+  return i;
+}
+
+static unsigned long
+_int16_to_float_sse2(float *dst, const short *src, unsigned long samples)
+{
+  const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+  unsigned long i;
+
+  for (i = 0; i + 8 <= samples; i += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *) (src + i));
+    /* sign-extend by placing each sample in the top half of a lane */
+    __m128i a = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+    __m128i b = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+    _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(a), scale));
+    _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(b), scale));
+  }
+  return i;
+}
+
+/* paInt8 and paUInt8: bias is 0 or 128, flip turns unsigned into
+   signed samples */
+static unsigned long
+_int8_to_float_sse2(float *dst, const unsigned char *src,
+                    unsigned long samples, int flip)
+{
+  const __m128 scale = _mm_set1_ps(1.0f / 128.0f);
+  const __m128i sign = _mm_set1_epi8(flip ? (char) 0x80 : 0);
+  unsigned long i;
+  int j;
+
+  for (i = 0; i + 16 <= samples; i += 16) {
+    __m128i v = _mm_xor_si128(
+      _mm_loadu_si128((const __m128i *) (src + i)), sign);
+    __m128i words[2];
+
+    words[0] = _mm_unpacklo_epi8(v, v);
+    words[1] = _mm_unpackhi_epi8(v, v);
+    for (j = 0; j < 2; j++) {
+      __m128i a = _mm_srai_epi32(_mm_unpacklo_epi16(words[j], words[j]),
+                                 24);
+      __m128i b = _mm_srai_epi32(_mm_unpackhi_epi16(words[j], words[j]),
+                                 24);
+      _mm_storeu_ps(dst + i + 8 * j, _mm_mul_ps(_mm_cvtepi32_ps(a), scale));
+      _mm_storeu_ps(dst + i + 8 * j + 4,
+                    _mm_mul_ps(_mm_cvtepi32_ps(b), scale));
+    }
+  }
+  return i;
+}
+
+static unsigned long
+_float_to_int32_sse2(int *dst, const float *src, unsigned long samples)
+{
+  const __m128 lo = _mm_set1_ps(-1.0f);
+  const __m128 hi = _mm_set1_ps(1.0f);
+  const __m128d scale = _mm_set1_pd(2147483647.0);
+  unsigned long i;
+
+  for (i = 0; i + 4 <= samples; i += 4) {
+    __m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i), lo), hi);
+    __m128i a = _mm_cvttpd_epi32(_mm_mul_pd(_mm_cvtps_pd(v), scale));
+    __m128i b = _mm_cvttpd_epi32(
+      _mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(v, v)), scale));
+    _mm_storeu_si128((__m128i *) (dst + i), _mm_unpacklo_epi64(a, b));
+  }
+  return i;
+}
+
+/* count vectors of clipped and scaled samples, truncated to int32 */
+static void
+_float_to_scaled_sse2(__m128i *out, const float *src, int count,
+                      float factor)
+{
+  const __m128 lo = _mm_set1_ps(-1.0f);
+  const __m128 hi = _mm_set1_ps(1.0f);
+  const __m128 scale = _mm_set1_ps(factor);
+  int j;
+
+  for (j = 0; j < count; j++) {
+    __m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + 4 * j), lo), hi);
+    out[j] = _mm_cvttps_epi32(_mm_mul_ps(v, scale));
+  }
+}
+
+static unsigned long
+_float_to_int16_sse2(short *dst, const float *src, unsigned long samples)
+{
+  __m128i v[2];
+  unsigned long i;
+
+  for (i = 0; i + 8 <= samples; i += 8) {
+    _float_to_scaled_sse2(v, src + i, 2, 32767.0f);
+    _mm_storeu_si128((__m128i *) (dst + i), _mm_packs_epi32(v[0], v[1]));
+  }
+  return i;
+}
+
+static unsigned long
+_float_to_int8_sse2(unsigned char *dst, const float *src,
+                    unsigned long samples, int flip)
+{
+  const __m128i sign = _mm_set1_epi8(flip ? (char) 0x80 : 0);
+  __m128i v[4];
+  unsigned long i;
+
+  for (i = 0; i + 16 <= samples; i += 16) {
+    __m128i packed;
+
+    _float_to_scaled_sse2(v, src + i, 4, 127.0f);
+    packed = _mm_packs_epi16(_mm_packs_epi32(v[0], v[1]),
+                             _mm_packs_epi32(v[2], v[3]));
+    _mm_storeu_si128((__m128i *) (dst + i), _mm_xor_si128(packed, sign));
+  }
+  return i;
+}
+
+#endif
+
+/* dispatch: the number of samples converted by the best kernel
+   available, 0 if none */
+
+static unsigned long
+_int32_to_float_simd(float *dst, const int *src, unsigned long samples)
+{
+#ifdef DSP_AVX2
+  if (_dsp_has_avx2())
+    return _int32_to_float_avx2(dst, src, samples);
+#endif
+#ifdef DSP_SSE2
+  return _int32_to_float_sse2(dst, src, samples);
+#else
+  return 0;
+#endif
+}
+
+static unsigned long
+_int16_to_float_simd(float *dst, const short *src, unsigned long samples)
+{
+#ifdef DSP_AVX2
+  if (_dsp_has_avx2())
+    return _int16_to_float_avx2(dst, src, samples);
+#endif
+#ifdef DSP_SSE2
+  return _int16_to_float_sse2(dst, src, samples);
+#else
+  return 0;
+#endif
+}
+
+static unsigned long
+_int8_to_float_simd(float *dst, const unsigned char *src,
+                    unsigned long samples, int flip)
+{
+#ifdef DSP_SSE2
+  return _int8_to_float_sse2(dst, src, samples, flip);
+#else
+  return 0;
+#endif
+}
+
+static unsigned long
+_float_to_int32_simd(int *dst, const float *src, unsigned long samples)
+{
+#ifdef DSP_AVX2
+  if (_dsp_has_avx2())
+    return _float_to_int32_avx2(dst, src, samples);
+#endif
+#ifdef DSP_SSE2
+  return _float_to_int32_sse2(dst, src, samples);
+#else
+  return 0;
+#endif
+}
+
+static unsigned long
+_float_to_int16_simd(short *dst, const float *src, unsigned long samples)
+{
+#ifdef DSP_AVX2
+  if (_dsp_has_avx2())
+    return _float_to_int16_avx2(dst, src, samples);
+#endif
+#ifdef DSP_SSE2
+  return _float_to_int16_sse2(dst, src, samples);
+#else
+  return 0;
+#endif
+}
+
+static unsigned long
+_float_to_int8_simd(unsigned char *dst, const float *src,
+                    unsigned long samples, int flip)
+{
+#ifdef DSP_SSE2
+  return _float_to_int8_sse2(dst, src, samples, flip);
+#else
+  return 0;
+#endif
+}
+
+
+/*************************************************************
+ * Sample Format Conversion
+ *************************************************************/
+
+void
+_dsp_to_float(float *dst, const void *src, PaSampleFormat format,
+	      unsigned long samples)
+{
+  unsigned long i;
+
+  switch (format) {
+  case paFloat32:
+    memcpy(dst, src, samples * sizeof(float));
+    break;
+
+  case paInt32: {
+    const int *s = (const int *) src;
+    for (i = _int32_to_float_simd(dst, s, samples); i < samples; i++)
+      dst[i] = (float) (s[i] * (1.0 / 2147483648.0));
+    break;
+  }
+
+  case paInt24: {
+    const unsigned char *s = (const unsigned char *) src;
+    for (i = 0; i < samples; i++, s += 3) {
+      int v = (int) (((unsigned int) s[INT24_HI] << 24) |
+		     ((unsigned int) s[INT24_MID] << 16) |
+		     ((unsigned int) s[INT24_LO] << 8));
+      dst[i] = (float) (v * (1.0 / 2147483648.0));
+    }
+    break;
+  }
+
+  case paInt16: {
+    const short *s = (const short *) src;
+    for (i = _int16_to_float_simd(dst, s, samples); i < samples; i++)
+      dst[i] = s[i] * (1.0f / 32768.0f);
+    break;
+  }
+
+  case paInt8: {
+    const signed char *s = (const signed char *) src;
+    i = _int8_to_float_simd(dst, (const unsigned char *) src, samples, 0);
+    for (; i < samples; i++)
+      dst[i] = s[i] * (1.0f / 128.0f);
+    break;
+  }
+
+  case paUInt8: {
+    const unsigned char *s = (const unsigned char *) src;
+    for (i = _int8_to_float_simd(dst, s, samples, 1); i < samples; i++)
+      dst[i] = ((int) s[i] - 128) * (1.0f / 128.0f);
+    break;
+  }
+  }
+}
+
+/* NaN gives -1.0, as with the SIMD loops' max-then-min clamp */
+static float
+_clip(float v)
+{
+  if (!(v >= -1.0f))
+    return -1.0f;
+  if (v > 1.0f)
+    return 1.0f;
+  return v;
+}
+
+void
+_dsp_from_float(void *dst, const float *src, PaSampleFormat format,
+		unsigned long samples)
+{
+  unsigned long i;
+
+  switch (format) {
+  case paFloat32:
+    memcpy(dst, src, samples * sizeof(float));
+    break;
+
+  case paInt32: {
+    int *d = (int *) dst;
+    for (i = _float_to_int32_simd(d, src, samples); i < samples; i++)
+      d[i] = (int) (_clip(src[i]) * 2147483647.0);
+    break;
+  }
+
+  case paInt24: {
+    unsigned char *d = (unsigned char *) dst;
+    for (i = 0; i < samples; i++, d += 3) {
+      int v = (int) (_clip(src[i]) * 8388607.0f);
+      d[INT24_LO] = (unsigned char) v;
+      d[INT24_MID] = (unsigned char) (v >> 8);
+      d[INT24_HI] = (unsigned char) (v >> 16);
+    }
+    break;
+  }
+
+  case paInt16: {
+    short *d = (short *) dst;
+    for (i = _float_to_int16_simd(d, src, samples); i < samples; i++)
+      d[i] = (short) (_clip(src[i]) * 32767.0f);
+    break;
+  }
+
+  case paInt8: {
+    signed char *d = (signed char *) dst;
+    i = _float_to_int8_simd((unsigned char *) dst, src, samples, 0);
+    for (; i < samples; i++)
+      d[i] = (signed char) (_clip(src[i]) * 127.0f);
+    break;
+  }
+
+  case paUInt8: {
+    unsigned char *d = (unsigned char *) dst;
+    for (i = _float_to_int8_simd(d, src, samples, 1); i < samples; i++)
+      d[i] = (unsigned char) (128 + (int) (_clip(src[i]) * 127.0f));
+    break;
+  }
+  }
+}
+
+
+/* converts through a small float buffer, so that any pair of formats
+   works without allocating */
+#define DSP_CONVERT_CHUNK 1024
+
+void
+_dsp_convert(void *dst, PaSampleFormat dstFormat, const void *src,
+	     PaSampleFormat srcFormat, unsigned long samples)
+{
+  float chunk[DSP_CONVERT_CHUNK];
+  const char *s = (const char *) src;
+  char *d = (char *) dst;
+  unsigned long srcSize, dstSize, n;
+
+  if (srcFormat == dstFormat) {
+    memcpy(dst, src, samples * _dsp_sample_size(srcFormat));
+    return;
+  }
+
+  if (srcFormat == paFloat32) {
+    _dsp_from_float(dst, (const float *) src, dstFormat, samples);
+    return;
+  }
+
+  if (dstFormat == paFloat32) {
+    _dsp_to_float((float *) dst, src, srcFormat, samples);
+    return;
+  }
+
+  srcSize = _dsp_sample_size(srcFormat);
+  dstSize = _dsp_sample_size(dstFormat);
+  while (samples > 0) {
+    n = samples < DSP_CONVERT_CHUNK ? samples : DSP_CONVERT_CHUNK;
+    _dsp_to_float(chunk, s, srcFormat, n);
+    _dsp_from_float(d, chunk, dstFormat, n);
+    s += n * srcSize;
+    d += n * dstSize;
+    samples -= n;
+  }
+}
+
+unsigned long
+_dsp_sample_size(PaSampleFormat format)
+{
+  switch (format) {
+  case paFloat32:
+  case paInt32:
+    return 4;
+  case paInt24:
+    return 3;
+  case paInt16:
+    return 2;
+  case paInt8:
+  case paUInt8:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+
+/*************************************************************
+ * Accumulation
+ *************************************************************/
+
+/* acc += gain * src over whole vectors; returns how many samples */
+
+#ifdef DSP_AVX2
+DSP_TARGET_AVX2 static unsigned long
+_accumulate_avx2(float *acc, const float *src, float gain,
+                 unsigned long samples)
+{
+  const __m256 g = _mm256_set1_ps(gain);
+  unsigned long i;
+
+  for (i = 0; i + 8 <= samples; i += 8)
+    _mm256_storeu_ps(acc + i,
+                     _mm256_add_ps(_mm256_loadu_ps(acc + i),
+                                   _mm256_mul_ps(_mm256_loadu_ps(src + i),
+                                                 g)));
+  return i;
+}
+#endif
+
+#ifdef DSP_SSE2
+static unsigned long
+_accumulate_sse2(float *acc, const float *src, float gain,
+                 unsigned long samples)
+{
+  const __m128 g = _mm_set1_ps(gain);
+  unsigned long i;
+
+  for (i = 0; i + 4 <= samples; i += 4)
+    _mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i),
+                                      _mm_mul_ps(_mm_loadu_ps(src + i), g)));
+  return i;
+}
+#endif
+
+static unsigned long
+_accumulate_simd(float *acc, const float *src, float gain,
+                 unsigned long samples)
+{
+#ifdef DSP_AVX2
+  if (_dsp_has_avx2())
+    return _accumulate_avx2(acc, src, gain, samples);
+#endif
+#ifdef DSP_SSE2
+  return _accumulate_sse2(acc, src, gain, samples);
+#else
+  return 0;
+#endif
+}
+
+void
+_dsp_accumulate(float *acc, const float *src, unsigned long frames,
+		int channels, float gain, float endGain)
+{
+  unsigned long samples = frames * channels;
+  unsigned long i, f;
+  float step;
+  int c;
+
+  if (gain == endGain) {
+    for (i = _accumulate_simd(acc, src, gain, samples); i < samples; i++)
+      acc[i] += src[i] * gain;
+    return;
+  }
+
+  step = (endGain - gain) / frames;
+  for (f = 0; f < frames; f++, acc += channels, src += channels) {
+    gain += step;
+    for (c = 0; c < channels; c++)
+      acc[c] += src[c] * gain;
+  }
+}
+
+
+/*************************************************************
+ * Dot Product
+ *************************************************************/
+
+/* partial sums over whole vectors, added up at the end, so results
+   may differ from the scalar loop in the last bits */
+
+#ifdef DSP_AVX2
+DSP_TARGET_AVX2 static float
+_dot_avx2(const float *a, const float *b, unsigned long n,
+          unsigned long *done)
+{
+  __m256 sum = _mm256_setzero_ps();
+  __m128 half;
+  unsigned long i;
+
+  for (i = 0; i + 8 <= n; i += 8)
+    sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(a + i),
+                                           _mm256_loadu_ps(b + i)));
+
+  half = _mm_add_ps(_mm256_castps256_ps128(sum),
+                    _mm256_extractf128_ps(sum, 1));
+  half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+  half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+  *done = i;
+  return _mm_cvtss_f32(half);
+}
+#endif
+
+#ifdef DSP_SSE2
+static float
+_dot_sse2(const float *a, const float *b, unsigned long n,
+          unsigned long *done)
+{
+  __m128 sum = _mm_setzero_ps();
+  unsigned long i;
+
+  for (i = 0; i + 4 <= n; i += 4)
+    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(a + i),
+                                     _mm_loadu_ps(b + i)));
+
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+  *done = i;
+  return _mm_cvtss_f32(sum);
+}
+#endif
+
+static float
+_dot_simd(const float *a, const float *b, unsigned long n,
+          unsigned long *done)
+{
+#ifdef DSP_AVX2
+  if (_dsp_has_avx2())
+    return _dot_avx2(a, b, n, done);
+#endif
+#ifdef DSP_SSE2
+  return _dot_sse2(a, b, n, done);
+#else
+  *done = 0;
+  return 0.0f;
+#endif
+}
+
+float
+_dsp_dot(const float *a, const float *b, unsigned long n)
+{
+  unsigned long i;
+  float sum = _dot_simd(a, b, n, &i);
+
+  for (; i < n; i++)
+    sum += a[i] * b[i];
+  return sum;
+}
+
+
+/*************************************************************
+ * Level Meter
+ *************************************************************/
+
+/* frames converted to float at a time */
+#define DSP_METER_CHUNK 1024
+
+static int
+_dsp_levels_alloc(_pyAudio_DspLevels *levels, int channels)
+{
+  levels->peak = (float *) calloc(channels, sizeof(float));
+  levels->sumSquares = (double *) calloc(channels, sizeof(double));
+  levels->clips = (unsigned long *) calloc(channels, sizeof(unsigned long));
+  levels->frames = 0;
+
+  return (levels->peak && levels->sumSquares && levels->clips) ? 0 : -1;
+}
+
+static void
+_dsp_levels_free(_pyAudio_DspLevels *levels)
+{
+  free(levels->peak);
+  free(levels->sumSquares);
+  free(levels->clips);
+}
+
+static void
+_dsp_levels_copy(_pyAudio_DspLevels *dst, const _pyAudio_DspLevels *src,
+		 int channels)
+{
+  memcpy(dst->peak, src->peak, channels * sizeof(float));
+  memcpy(dst->sumSquares, src->sumSquares, channels * sizeof(double));
+  memcpy(dst->clips, src->clips, channels * sizeof(unsigned long));
+  dst->frames = src->frames;
+}
+
+static void
+_dsp_levels_clear(_pyAudio_DspLevels *levels, int channels)
+{
+  memset(levels->peak, 0, channels * sizeof(float));
+  memset(levels->sumSquares, 0, channels * sizeof(double));
+  memset(levels->clips, 0, channels * sizeof(unsigned long));
+  levels->frames = 0;
+}
+
+_pyAudio_DspMeter *
+_dsp_meter_new(int channels, PaSampleFormat format)
+{
+  _pyAudio_DspMeter *meter;
+  int i;
+
+  meter = (_pyAudio_DspMeter *) calloc(1, sizeof(_pyAudio_DspMeter));
+  if (meter == NULL)
+    return NULL;
+
+  meter->channels = channels;
+  meter->format = format;
+
+  /* the largest integer sample, which does not quite reach 1.0 */
+  switch (format) {
+  case paInt24:
+    meter->clipLevel = 8388607.0f / 8388608.0f;
+    break;
+  case paInt16:
+    meter->clipLevel = 32767.0f / 32768.0f;
+    break;
+  case paInt8:
+  case paUInt8:
+    meter->clipLevel = 127.0f / 128.0f;
+    break;
+  default:
+    /* int32 samples that close to full scale round to 1.0 */
+    meter->clipLevel = 1.0f;
+    break;
+  }
+
+  meter->work = (float *) malloc(DSP_METER_CHUNK * channels * sizeof(float));
+  if (meter->work == NULL)
+    goto error;
+
+  for (i = 0; i < 2; i++) {
+    if (_dsp_levels_alloc(&meter->banks[i], channels) < 0)
+      goto error;
+  }
+  if (_dsp_levels_alloc(&meter->snapshot, channels) < 0)
+    goto error;
+
+  return meter;
+
+ error:
+  _dsp_meter_free(meter);
+  return NULL;
+}
+
+void
+_dsp_meter_free(_pyAudio_DspMeter *meter)
+{
+  _dsp_levels_free(&meter->banks[0]);
+  _dsp_levels_free(&meter->banks[1]);
+  _dsp_levels_free(&meter->snapshot);
+  free(meter->work);
+  free(meter);
+}
+
+/* meters n samples of a single channel, step floats apart */
+static void
+_dsp_meter_channel(_pyAudio_DspMeter *meter, _pyAudio_DspLevels *levels,
+		   int channel, const float *samples, unsigned long n,
+		   int step)
+{
+  float peak = levels->peak[channel];
+  float clipLevel = meter->clipLevel;
+  double sum = 0;
+  unsigned long clips = 0;
+  unsigned long i;
+
+  for (i = 0; i < n; i++) {
+    float v = samples[i * step];
+    float a = v < 0 ? -v : v;
+
+    if (a > peak)
+      peak = a;
+    if (a >= clipLevel)
+      clips++;
+    sum += (double) v * v;
+  }
+
+  levels->peak[channel] = peak;
+  levels->sumSquares[channel] += sum;
+  levels->clips[channel] += clips;
+}
+
+void
+_dsp_meter_write(_pyAudio_DspMeter *meter, const void *input,
+		 int planar, unsigned long frames)
+{
+  _pyAudio_DspLevels *levels;
+  unsigned long sampleSize = _dsp_sample_size(meter->format);
+  int channels = meter->channels;
+  unsigned long done, n;
+  int c;
+
+  /* the bank is read only after busy turns odd; see _dsp_meter_read */
+  PA_ATOMIC_ADD(&meter->busy, 1);
+  levels = &meter->banks[PA_ATOMIC_ADD(&meter->bank, 0) & 1];
+
+  if (planar) {
+    const void *const *buffers = (const void *const *) input;
+
+    for (c = 0; c < channels; c++) {
+      for (done = 0; done < frames; done += n) {
+	n = frames - done;
+	if (n > DSP_METER_CHUNK)
+	  n = DSP_METER_CHUNK;
+	_dsp_to_float(meter->work,
+		      (const char *) buffers[c] + done * sampleSize,
+		      meter->format, n);
+	_dsp_meter_channel(meter, levels, c, meter->work, n, 1);
+      }
+    }
+  } else {
+    for (done = 0; done < frames; done += n) {
+      n = frames - done;
+      if (n > DSP_METER_CHUNK)
+	n = DSP_METER_CHUNK;
+      _dsp_to_float(meter->work,
+		    (const char *) input + done * channels * sampleSize,
+		    meter->format, n * channels);
+      for (c = 0; c < channels; c++)
+	_dsp_meter_channel(meter, levels, c, meter->work + c, n, channels);
+    }
+  }
+
+  levels->frames += frames;
+  PA_ATOMIC_ADD(&meter->busy, 1);
+}
+
+const _pyAudio_DspLevels *
+_dsp_meter_read(_pyAudio_DspMeter *meter, int reset)
+{
+  unsigned long bank, busy;
+
+  if (reset) {
+    /* from now on, the callback meters into the other bank; wait
+       until it is done with this one, if it is metering right now */
+    bank = PA_ATOMIC_LOAD(&meter->bank) & 1;
+    PA_ATOMIC_EXCHANGE(&meter->bank, bank ^ 1);
+    while (PA_ATOMIC_ADD(&meter->busy, 0) & 1)
+      ;
+
+    _dsp_levels_copy(&meter->snapshot, &meter->banks[bank],
+		     meter->channels);
+    _dsp_levels_clear(&meter->banks[bank], meter->channels);
+    return &meter->snapshot;
+  }
+
+  /* copy the current bank, again if the callback metered meanwhile */
+  do {
+    busy = PA_ATOMIC_ADD(&meter->busy, 0);
+    if (busy & 1)
+      continue;
+    bank = PA_ATOMIC_ADD(&meter->bank, 0) & 1;
+    _dsp_levels_copy(&meter->snapshot, &meter->banks[bank],
+		     meter->channels);
+  } while (busy & 1 || PA_ATOMIC_ADD(&meter->busy, 0) != busy);
+
+  return &meter->snapshot;
+}
+
+
+/*************************************************************
+ * Processing Graph
+ *************************************************************/
+
+_pyAudio_DspGraph *
+_dsp_graph_new(int channels, PaSampleFormat format,
+	       unsigned long maxFrames)
+{
+  _pyAudio_DspGraph *graph;
+
+  graph = (_pyAudio_DspGraph *) calloc(1, sizeof(_pyAudio_DspGraph));
+  if (graph == NULL)
+    return NULL;
+
+  graph->inChannels = channels;
+  graph->inFormat = format;
+  graph->outChannels = channels;
+  graph->outFormat = format;
+  graph->maxFrames = maxFrames;
+  return graph;
+}
+
+void
+_dsp_graph_free(_pyAudio_DspGraph *graph)
+{
+  int i;
+
+  for (i = 0; i < graph->nodeCount; i++) {
+    free(graph->nodes[i].gains);
+    free(graph->nodes[i].map);
+    free(graph->nodes[i].matrix);
+  }
+
+  free(graph->nodes);
+  free(graph->work[0]);
+  free(graph->work[1]);
+  free(graph->output);
+  free(graph);
+}
+
+/* appends a node taking the graph's current channels; returns NULL on
+   failure to allocate */
+static _pyAudio_DspNode *
+_dsp_graph_add_node(_pyAudio_DspGraph *graph, int type, int outChannels)
+{
+  _pyAudio_DspNode *nodes;
+  _pyAudio_DspNode *node;
+
+  nodes = (_pyAudio_DspNode *)
+    realloc(graph->nodes, (graph->nodeCount + 1) * sizeof(_pyAudio_DspNode));
+  if (nodes == NULL)
+    return NULL;
+
+  graph->nodes = nodes;
+  node = &nodes[graph->nodeCount++];
+  memset(node, 0, sizeof(_pyAudio_DspNode));
+  node->type = type;
+  node->inChannels = graph->outChannels;
+  node->outChannels = outChannels;
+
+  graph->outChannels = outChannels;
+  return node;
+}
+
+int
+_dsp_graph_add_gain(_pyAudio_DspGraph *graph, const float *gains)
+{
+  int channels = graph->outChannels;
+  _pyAudio_DspNode *node;
+
+  node = _dsp_graph_add_node(graph, DSP_NODE_GAIN, channels);
+  if (node == NULL ||
+      (node->gains = (float *) malloc(channels * sizeof(float))) == NULL)
+    return -1;
+
+  memcpy(node->gains, gains, channels * sizeof(float));
+  return 0;
+}
+
+int
+_dsp_graph_add_channel_map(_pyAudio_DspGraph *graph, const int *map,
+			   int outChannels)
+{
+  _pyAudio_DspNode *node;
+
+  node = _dsp_graph_add_node(graph, DSP_NODE_CHANNEL_MAP, outChannels);
+  if (node == NULL ||
+      (node->map = (int *) malloc(outChannels * sizeof(int))) == NULL)
+    return -1;
+
+  memcpy(node->map, map, outChannels * sizeof(int));
+  return 0;
+}
+
+int
+_dsp_graph_add_mix(_pyAudio_DspGraph *graph, const float *matrix,
+		   int outChannels)
+{
+  size_t size = (size_t) outChannels * graph->outChannels * sizeof(float);
+  _pyAudio_DspNode *node;
+
+  node = _dsp_graph_add_node(graph, DSP_NODE_MIX, outChannels);
+  if (node == NULL || (node->matrix = (float *) malloc(size)) == NULL)
+    return -1;
+
+  memcpy(node->matrix, matrix, size);
+  return 0;
+}
+
+void
+_dsp_graph_set_format(_pyAudio_DspGraph *graph, PaSampleFormat format)
+{
+  graph->outFormat = format;
+}
+
+int
+_dsp_graph_finish(_pyAudio_DspGraph *graph)
+{
+  int maxChannels = graph->inChannels;
+  int i;
+
+  for (i = 0; i < graph->nodeCount; i++) {
+    if (graph->nodes[i].outChannels > maxChannels)
+      maxChannels = graph->nodes[i].outChannels;
+  }
+
+  for (i = 0; i < 2; i++) {
+    graph->work[i] = (float *)
+      malloc(graph->maxFrames * maxChannels * sizeof(float));
+    if (graph->work[i] == NULL)
+      return -1;
+  }
+
+  graph->output = (char *)
+    malloc(graph->maxFrames * graph->outChannels *
+	   Pa_GetSampleSize(graph->outFormat));
+  if (graph->output == NULL)
+    return -1;
+
+  return 0;
+}
+
+static void
+_dsp_gain(const _pyAudio_DspNode *node, float *buffer, unsigned long frames)
+{
+  int channels = node->inChannels;
+  unsigned long f;
+  int c;
+
+  for (f = 0; f < frames; f++, buffer += channels) {
+    for (c = 0; c < channels; c++)
+      buffer[c] *= node->gains[c];
+  }
+}
+
+static void
+_dsp_channel_map(const _pyAudio_DspNode *node, float *dst,
+		 const float *src, unsigned long frames)
+{
+  unsigned long f;
+  int c;
+
+  for (f = 0; f < frames; f++) {
+    for (c = 0; c < node->outChannels; c++)
+      *dst++ = (node->map[c] < 0) ? 0.0f : src[node->map[c]];
+    src += node->inChannels;
+  }
+}
+
+static void
+_dsp_mix(const _pyAudio_DspNode *node, float *dst, const float *src,
+	 unsigned long frames)
+{
+  unsigned long f;
+  int o, i;
+
+  for (f = 0; f < frames; f++) {
+    const float *row = node->matrix;
+
+    for (o = 0; o < node->outChannels; o++) {
+      float sum = 0.0f;
+      for (i = 0; i < node->inChannels; i++)
+	sum += row[i] * src[i];
+      *dst++ = sum;
+      row += node->inChannels;
+    }
+    src += node->inChannels;
+  }
+}
+
+void *
+_dsp_graph_process(_pyAudio_DspGraph *graph, const void *input,
+		   void *output, unsigned long frames)
+{
+  float *current = graph->work[0];
+  float *next = graph->work[1];
+  float *swap;
+  int i;
+
+  _dsp_to_float(current, input, graph->inFormat,
+		frames * graph->inChannels);
+
+  for (i = 0; i < graph->nodeCount; i++) {
+    const _pyAudio_DspNode *node = &graph->nodes[i];
+
+    switch (node->type) {
+    case DSP_NODE_GAIN:
+      _dsp_gain(node, current, frames);
+      continue;
+    case DSP_NODE_CHANNEL_MAP:
+      _dsp_channel_map(node, next, current, frames);
+      break;
+    case DSP_NODE_MIX:
+      _dsp_mix(node, next, current, frames);
+      break;
+    }
+
+    swap = current;
+    current = next;
+    next = swap;
+  }
+
+  if (output == NULL)
+    output = graph->output;
+
+  _dsp_from_float(output, current, graph->outFormat,
+		  frames * graph->outChannels);
+  return output;
+}
@@ -0,0 +1,202 @@
+/**
+ * PyAudio : Python Bindings for PortAudio.
+ *
+ * PyAudio : Signal processing
+ *
+ * Sample format conversion and a small processing graph (gain,
+ * channel map, mix) that runs inside the PortAudio callback. Nothing
+ * here touches the Python interpreter, takes a lock or allocates
+ * memory once a graph is set up.
+ *
+ * Copyright (c) 2006-2008 Hubert Pham
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __PADSP_H__
+#define __PADSP_H__
+
+#include "portaudio.h"
+
+/* sample format conversion
+ *
+ * Floating point samples are in [-1.0, 1.0); integer output is
+ * clipped to its range, and NaN converts as -1.0. Formats are any of paFloat32, paInt32,
+ * paInt24, paInt16, paInt8 and paUInt8, interleaved. Conversions of
+ * all but paInt24 use SSE2 or AVX2 where available, chosen at run
+ * time, with the same results as the plain C loops. */
+
+void
+_dsp_to_float(float *dst, const void *src, PaSampleFormat format,
+	      unsigned long samples);
+
+void
+_dsp_from_float(void *dst, const float *src, PaSampleFormat format,
+		unsigned long samples);
+
+/* between any two of the formats above */
+void
+_dsp_convert(void *dst, PaSampleFormat dstFormat, const void *src,
+	     PaSampleFormat srcFormat, unsigned long samples);
+
+/* bytes per sample, or 0 if the format is not one of the above */
+unsigned long
+_dsp_sample_size(PaSampleFormat format);
+
+/* accumulation
+ *
+ * Adds frames interleaved float32 frames of src, times a gain that
+ * goes linearly from gain to endGain over the frames, to acc. A
+ * constant gain uses SSE2 or AVX2 where available. */
+
+void
+_dsp_accumulate(float *acc, const float *src, unsigned long frames,
+		int channels, float gain, float endGain);
+
+/* sum of a[i] * b[i] over n floats, using SSE2 or AVX2 where
+   available */
+float
+_dsp_dot(const float *a, const float *b, unsigned long n);
+
+/* level meter
+ *
+ * Running per-channel peak, sum of squares and count of clipped
+ * samples of a stream's input, fed from the PortAudio callback. The
+ * levels are kept in two banks: the callback meters into one, and a
+ * reader that resets the levels switches it to the other, so no
+ * input goes unmetered. Only one thread may call _dsp_meter_write
+ * and only one (other) thread may call _dsp_meter_read at any time. */
+
+typedef struct {
+  float *peak;
+  double *sumSquares;
+  unsigned long *clips;
+  unsigned long frames;
+} _pyAudio_DspLevels;
+
+typedef struct {
+  int channels;
+  PaSampleFormat format;
+  /* magnitude from which a sample counts as clipped */
+  float clipLevel;
+  _pyAudio_DspLevels banks[2];
+  _pyAudio_DspLevels snapshot;
+  /* bank the callback meters into */
+  volatile unsigned long bank;
+  /* odd while the callback meters */
+  volatile unsigned long busy;
+  float *work;
+} _pyAudio_DspMeter;
+
+/* returns NULL on failure to allocate */
+_pyAudio_DspMeter *
+_dsp_meter_new(int channels, PaSampleFormat format);
+
+void
+_dsp_meter_free(_pyAudio_DspMeter *meter);
+
+/* meters frames frames of input: interleaved, or an array of one
+   buffer per channel if planar */
+void
+_dsp_meter_write(_pyAudio_DspMeter *meter, const void *input,
+		 int planar, unsigned long frames);
+
+/* The levels since the meter was created or last reset. With reset,
+   they start over. The result stays valid until the next call. */
+const _pyAudio_DspLevels *
+_dsp_meter_read(_pyAudio_DspMeter *meter, int reset);
+
+/* processing graph
+ *
+ * A chain of nodes applied to interleaved float32 frames. The input
+ * is converted from the stream's format, and the result to the
+ * graph's output format. Build with _dsp_graph_new and the
+ * _dsp_graph_add_* functions, then call _dsp_graph_finish before
+ * processing. */
+
+#define DSP_NODE_GAIN 0
+#define DSP_NODE_CHANNEL_MAP 1
+#define DSP_NODE_MIX 2
+
+typedef struct {
+  int type;
+  int inChannels;
+  int outChannels;
+  /* GAIN: one gain per channel */
+  float *gains;
+  /* CHANNEL_MAP: input channel per output channel, -1 for silence */
+  int *map;
+  /* MIX: outChannels rows of inChannels coefficients */
+  float *matrix;
+} _pyAudio_DspNode;
+
+typedef struct {
+  int nodeCount;
+  _pyAudio_DspNode *nodes;
+
+  int inChannels;
+  PaSampleFormat inFormat;
+  int outChannels;
+  PaSampleFormat outFormat;
+
+  unsigned long maxFrames;
+  float *work[2];
+  char *output;
+} _pyAudio_DspGraph;
+
+/* returns NULL on failure to allocate */
+_pyAudio_DspGraph *
+_dsp_graph_new(int channels, PaSampleFormat format,
+	       unsigned long maxFrames);
+
+void
+_dsp_graph_free(_pyAudio_DspGraph *graph);
+
+/* The node functions copy their arguments, which must match the
+   graph's current channel count, and return -1 on failure to
+   allocate. */
+
+int
+_dsp_graph_add_gain(_pyAudio_DspGraph *graph, const float *gains);
+
+int
+_dsp_graph_add_channel_map(_pyAudio_DspGraph *graph, const int *map,
+			   int outChannels);
+
+int
+_dsp_graph_add_mix(_pyAudio_DspGraph *graph, const float *matrix,
+		   int outChannels);
+
+/* the format of the graph's result; defaults to the input format */
+void
+_dsp_graph_set_format(_pyAudio_DspGraph *graph, PaSampleFormat format);
+
+int
+_dsp_graph_finish(_pyAudio_DspGraph *graph);
+
+/* Runs the graph on frames (at most maxFrames) frames of input.
+   Writes the result to output, or to an internal buffer if output is
+   NULL; returns where the result is. */
+void *
+_dsp_graph_process(_pyAudio_DspGraph *graph, const void *input,
+		   void *output, unsigned long frames);
+
+#endif
@@ -0,0 +1,279 @@
+/**
+ * PyAudio : Python Bindings for PortAudio.
+ *
+ * PyAudio : Software mixer
+ *
+ * Mixes any number of voices into one output stream from the
+ * PortAudio callback. Each voice owns a lock-free queue of float32
+ * frames and a gain; its owner queues audio and changes the gain
+ * while the callback sums whatever the queues hold. Nothing here
+ * touches the Python interpreter.
+ *
+ * Copyright (c) 2006-2008 Hubert Pham
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "_mixer.h"
+#include "_dsp.h"
+
+/* frames mixed (and converted for queueing) at a time */
+#define MIXER_CHUNK_FRAMES 256
+
+
+/*************************************************************
+ * Gain
+ *************************************************************/
+
+/* the gain is exchanged as the bits of a float, so that it can be
+   stored and loaded atomically */
+
+static unsigned long
+_gain_to_bits(float gain)
+{
+  unsigned int bits;
+
+  memcpy(&bits, &gain, sizeof(bits));
+  return bits;
+}
+
+static float
+_gain_from_bits(unsigned long bits)
+{
+  unsigned int b = (unsigned int) bits;
+  float gain;
+
+  memcpy(&gain, &b, sizeof(gain));
+  return gain;
+}
+
+
+/*************************************************************
+ * Mixer
+ *************************************************************/
+
+_pyAudio_Mixer *
+_mixer_new(int channels, PaSampleFormat format, int maxVoices)
+{
+  _pyAudio_Mixer *mixer;
+  size_t chunk = (size_t) MIXER_CHUNK_FRAMES * channels;
+
+  mixer = (_pyAudio_Mixer *) calloc(1, sizeof(_pyAudio_Mixer));
+  if (mixer == NULL)
+    return NULL;
+
+  mixer->channels = channels;
+  mixer->format = format;
+  mixer->frameSize = _dsp_sample_size(format) * channels;
+  mixer->maxVoices = maxVoices;
+
+  mixer->voices = (_pyAudio_MixerVoice *)
+    calloc(maxVoices, sizeof(_pyAudio_MixerVoice));
+  mixer->mix = (float *) malloc(chunk * sizeof(float));
+  mixer->scratch = (float *) malloc(chunk * sizeof(float));
+  mixer->staging = (float *) malloc(chunk * sizeof(float));
+
+  if (mixer->voices == NULL || mixer->mix == NULL ||
+      mixer->scratch == NULL || mixer->staging == NULL) {
+    _mixer_free(mixer);
+    return NULL;
+  }
+
+  return mixer;
+}
+
+void
+_mixer_free(_pyAudio_Mixer *mixer)
+{
+  int i;
+
+  if (mixer->voices) {
+    for (i = 0; i < mixer->maxVoices; i++)
+      _ringbuffer_free(&mixer->voices[i].queue);
+  }
+
+  free(mixer->voices);
+  free(mixer->mix);
+  free(mixer->scratch);
+  free(mixer->staging);
+  free(mixer);
+}
+
+int
+_mixer_add_voice(_pyAudio_Mixer *mixer, unsigned long queueFrames,
+		 float gain)
+{
+  _pyAudio_MixerVoice *voice;
+  int slot = -1;
+  int i;
+
+  for (i = 0; i < mixer->maxVoices; i++) {
+    voice = &mixer->voices[i];
+
+    if (PA_ATOMIC_LOAD(&voice->state) == MIXER_VOICE_RETIRED) {
+      _ringbuffer_free(&voice->queue);
+      voice->state = MIXER_VOICE_FREE;
+    }
+
+    if (slot < 0 && voice->state == MIXER_VOICE_FREE)
+      slot = i;
+  }
+
+  if (slot < 0) {
+    errno = ENOSPC;
+    return -1;
+  }
+
+  voice = &mixer->voices[slot];
+  if (_ringbuffer_init(&voice->queue, mixer->channels * sizeof(float),
+		       queueFrames) != 0) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  voice->gain = _gain_to_bits(gain);
+  voice->appliedGain = gain;
+  voice->generation++;
+
+  /* publishes the queue to the callback */
+  PA_ATOMIC_STORE(&voice->state, MIXER_VOICE_PLAYING);
+  if ((unsigned long) slot >= mixer->voiceCount)
+    PA_ATOMIC_STORE(&mixer->voiceCount, slot + 1);
+
+  return slot;
+}
+
+unsigned long
+_mixer_voice_state(_pyAudio_Mixer *mixer, int slot,
+		   unsigned long generation)
+{
+  if (slot < 0 || slot >= mixer->maxVoices ||
+      mixer->voices[slot].generation != generation)
+    return MIXER_VOICE_FREE;
+
+  return PA_ATOMIC_LOAD(&mixer->voices[slot].state);
+}
+
+unsigned long
+_mixer_write_voice(_pyAudio_Mixer *mixer, int slot, const void *data,
+		   unsigned long frames)
+{
+  _pyAudio_MixerVoice *voice = &mixer->voices[slot];
+  const char *src = (const char *) data;
+  unsigned long done = 0;
+  unsigned long n;
+
+  while (done < frames) {
+    n = _ringbuffer_write_available(&voice->queue);
+    if (n == 0)
+      break;
+
+    if (n > frames - done)
+      n = frames - done;
+    if (n > MIXER_CHUNK_FRAMES)
+      n = MIXER_CHUNK_FRAMES;
+
+    _dsp_to_float(mixer->staging, src + done * mixer->frameSize,
+		  mixer->format, n * mixer->channels);
+    done += _ringbuffer_write(&voice->queue, mixer->staging, n);
+  }
+
+  return done;
+}
+
+unsigned long
+_mixer_voice_queued(_pyAudio_Mixer *mixer, int slot)
+{
+  return _ringbuffer_read_available(&mixer->voices[slot].queue);
+}
+
+void
+_mixer_set_gain(_pyAudio_Mixer *mixer, int slot, float gain)
+{
+  PA_ATOMIC_STORE(&mixer->voices[slot].gain, _gain_to_bits(gain));
+}
+
+void
+_mixer_remove_voice(_pyAudio_Mixer *mixer, int slot, int drain)
+{
+  _pyAudio_MixerVoice *voice = &mixer->voices[slot];
+
+  /* the callback may retire a DRAINING voice in the meantime */
+  if (drain)
+    PA_ATOMIC_CAS(&voice->state, MIXER_VOICE_PLAYING, MIXER_VOICE_DRAINING);
+  else if (!PA_ATOMIC_CAS(&voice->state, MIXER_VOICE_PLAYING,
+			  MIXER_VOICE_STOPPING))
+    PA_ATOMIC_CAS(&voice->state, MIXER_VOICE_DRAINING, MIXER_VOICE_STOPPING);
+}
+
+void
+_mixer_process(_pyAudio_Mixer *mixer, void *output, unsigned long frames)
+{
+  unsigned long count = PA_ATOMIC_LOAD(&mixer->voiceCount);
+  int channels = mixer->channels;
+  unsigned long done = 0;
+  unsigned long n, got, i;
+  unsigned long state;
+  float gain;
+
+  while (done < frames) {
+    n = frames - done;
+    if (n > MIXER_CHUNK_FRAMES)
+      n = MIXER_CHUNK_FRAMES;
+
+    memset(mixer->mix, 0, n * channels * sizeof(float));
+
+    for (i = 0; i < count; i++) {
+      _pyAudio_MixerVoice *voice = &mixer->voices[i];
+
+      state = PA_ATOMIC_LOAD(&voice->state);
+      if (state == MIXER_VOICE_STOPPING) {
+	PA_ATOMIC_CAS(&voice->state, MIXER_VOICE_STOPPING,
+		      MIXER_VOICE_RETIRED);
+	continue;
+      }
+
+      if (state != MIXER_VOICE_PLAYING && state != MIXER_VOICE_DRAINING)
+	continue;
+
+      got = _ringbuffer_read(&voice->queue, mixer->scratch, n);
+      gain = _gain_from_bits(PA_ATOMIC_LOAD(&voice->gain));
+      if (got > 0)
+	_dsp_accumulate(mixer->mix, mixer->scratch, got, channels,
+			voice->appliedGain, gain);
+      voice->appliedGain = gain;
+
+      /* the owner may have stopped it meanwhile, which is just as
+	 final */
+      if (got < n && state == MIXER_VOICE_DRAINING)
+	PA_ATOMIC_CAS(&voice->state, MIXER_VOICE_DRAINING,
+		      MIXER_VOICE_RETIRED);
+    }
+
+    _dsp_from_float((char *) output + done * mixer->frameSize, mixer->mix,
+		    mixer->format, n * channels);
+    done += n;
+  }
+}
@@ -0,0 +1,131 @@
+/**
+ * PyAudio : Python Bindings for PortAudio.
+ *
+ * PyAudio : Software mixer
+ *
+ * Mixes any number of voices into one output stream from the
+ * PortAudio callback. Each voice owns a lock-free queue of float32
+ * frames and a gain; its owner queues audio and changes the gain
+ * while the callback sums whatever the queues hold. Nothing here
+ * touches the Python interpreter.
+ *
+ * Copyright (c) 2006-2008 Hubert Pham
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __PAMIXER_H__
+#define __PAMIXER_H__
+
+#include "portaudio.h"
+#include "_portaudioutil.h"
+
+/* voice states
+ *
+ * The owner moves a voice from FREE to PLAYING, and from PLAYING to
+ * DRAINING or STOPPING; the callback moves it on to RETIRED, after
+ * which it no longer touches the voice, and the owner frees it. */
+#define MIXER_VOICE_FREE 0
+#define MIXER_VOICE_PLAYING 1
+#define MIXER_VOICE_DRAINING 2   /* plays what is queued, then retires */
+#define MIXER_VOICE_STOPPING 3   /* retires in the next period */
+#define MIXER_VOICE_RETIRED 4
+
+typedef struct {
+  volatile unsigned long state;
+  /* the bits of the float gain set by the owner */
+  volatile unsigned long gain;
+  /* the gain the callback reached in its last period, from which it
+     ramps to a new one */
+  float appliedGain;
+  /* interleaved float32 frames */
+  _pyAudio_RingBuffer queue;
+  /* counts the voices that used the slot; the owner's */
+  unsigned long generation;
+} _pyAudio_MixerVoice;
+
+typedef struct {
+  int channels;
+  PaSampleFormat format;
+  unsigned long frameSize;
+
+  int maxVoices;
+  _pyAudio_MixerVoice *voices;
+  /* slots from here on have never been used; only grows */
+  volatile unsigned long voiceCount;
+
+  /* the callback's */
+  float *mix;
+  float *scratch;
+  /* the owner's, for converting queued frames */
+  float *staging;
+} _pyAudio_Mixer;
+
+/* Mixes into channels channels of format, which must be one that
+   _dsp_sample_size knows. Returns NULL on failure to allocate. */
+_pyAudio_Mixer *
+_mixer_new(int channels, PaSampleFormat format, int maxVoices);
+
+/* The callback must no longer run. */
+void
+_mixer_free(_pyAudio_Mixer *mixer);
+
+/* The functions below, other than _mixer_process, are the owner's:
+   only one thread may call them at a time. */
+
+/* Starts a voice with a queue of at least queueFrames frames and frees
+   the voices that the callback has retired. Returns its slot, or -1
+   with errno set to ENOSPC if all slots are taken or ENOMEM. */
+int
+_mixer_add_voice(_pyAudio_Mixer *mixer, unsigned long queueFrames,
+		 float gain);
+
+/* The state of the voice that slot held in the given generation:
+   FREE if it has been freed, or if there is no such voice. */
+unsigned long
+_mixer_voice_state(_pyAudio_Mixer *mixer, int slot,
+		   unsigned long generation);
+
+/* Queues up to frames frames in the mixer's format for a PLAYING
+   voice; returns the number of frames queued. */
+unsigned long
+_mixer_write_voice(_pyAudio_Mixer *mixer, int slot, const void *data,
+		   unsigned long frames);
+
+unsigned long
+_mixer_voice_queued(_pyAudio_Mixer *mixer, int slot);
+
+/* takes effect gradually, over the next period */
+void
+_mixer_set_gain(_pyAudio_Mixer *mixer, int slot, float gain);
+
+/* Ends a PLAYING voice after it has played what is queued (drain), or
+   in the next period. A DRAINING voice can still be stopped. */
+void
+_mixer_remove_voice(_pyAudio_Mixer *mixer, int slot, int drain);
+
+/* Mixes frames frames of the voices into output; called from the
+   PortAudio callback. Voices whose queues run dry contribute
+   silence. */
+void
+_mixer_process(_pyAudio_Mixer *mixer, void *output, unsigned long frames);
+
+#endif
@@ -26,16 +26,39 @@
  * SOFTWARE.
  */
 
+#define PY_SSIZE_T_CLEAN
+#include <math.h>
 #include <stdio.h>
 #include "Python.h"
 #include "portaudio.h"
 #include "_portaudiomodule.h"
+#include "_portaudioutil.h"
+#include "_dsp.h"
+#include "_recorder.h"
+#include "_mixer.h"
+#include "_resample.h"
 
 #ifdef MACOSX
 #include "pa_mac_core.h"
 #endif
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
 #define DEFAULT_FRAMES_PER_BUFFER 1024
+#define DEFAULT_RING_BUFFER_PERIODS 4
+
+/* wrapper objects are only made by this module, never from Python;
+   before 3.10, paExec clears tp_new instead */
+#if PY_VERSION_HEX >= 0x030A0000
+#define PA_TPFLAGS_WRAPPER \
+  (Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION)
+#else
+#define PA_TPFLAGS_WRAPPER Py_TPFLAGS_DEFAULT
+#endif
 /* #define VERBOSE */
 
 
@@ -45,9 +68,11 @@
  *
  * I. Exportable PortAudio Method Definitions
  * II. Python Object Wrappers
+ *     - Module State
  *     - PaDeviceInfo
  *     - PaHostInfo
  *     - PaStream
+ *     - SampleBuffer
  * III. PortAudio Method Implementations
  *     - Initialization/Termination
  *     - HostAPI
@@ -55,6 +80,8 @@
  *     - Stream Open/Close
  *     - Stream Start/Stop/Info
  *     - Stream Read/Write
+ *     - Mixer Voices
+ *     - Sample Format Conversion
  * IV. Python Module Init
  *     - PaHostApiTypeId enum constants
  *
@@ -116,6 +143,8 @@ static PyMethodDef paMethods[] = {
   {"close", pa_close, METH_VARARGS, "close port audio stream"},
   {"get_sample_size", pa_get_sample_size, METH_VARARGS,
    "get sample size of a format in bytes"},
+  {"convert", pa_convert, METH_VARARGS,
+   "convert samples from one format to another"},
   {"is_format_supported", (PyCFunction) pa_is_format_supported,
    METH_VARARGS | METH_KEYWORDS,
    "returns whether specified format is supported"},
@@ -132,10 +161,28 @@ static PyMethodDef paMethods[] = {
    "returns stream time"},
   {"get_stream_cpu_load", pa_get_stream_cpu_load, METH_VARARGS,
    "returns stream CPU load -- always 0 for blocking mode"},
+  {"get_stream_callback_stats", pa_get_stream_callback_stats, METH_VARARGS,
+   "returns stream callback timing statistics"},
+  {"reset_stream_callback_stats", pa_reset_stream_callback_stats,
+   METH_VARARGS, "resets stream callback timing statistics"},
+  {"get_stream_xrun_counts", pa_get_stream_xrun_counts, METH_VARARGS,
+   "returns stream underflow/overflow counts"},
+  {"seek_stream_playback", pa_seek_stream_playback, METH_VARARGS,
+   "sets the playback position of a file playback stream"},
+  {"get_stream_playback_position", pa_get_stream_playback_position,
+   METH_VARARGS, "returns the playback position of a file playback stream"},
+  {"get_stream_recorder_stats", pa_get_stream_recorder_stats, METH_VARARGS,
+   "returns the progress of a stream's native recorder"},
 
   /* stream read/write */
   {"write_stream", pa_write_stream, METH_VARARGS, "write to stream"},
+  {"write_stream_many", pa_write_stream_many, METH_VARARGS,
+   "write a sequence of buffers to stream"},
   {"read_stream", pa_read_stream, METH_VARARGS, "read from stream"},
+  {"read_stream_array", pa_read_stream_array, METH_VARARGS,
+   "read samples from stream as a SampleBuffer"},
+  {"read_stream_into", pa_read_stream_into, METH_VARARGS,
+   "read from stream into a writable buffer"},
 
   {"get_stream_write_available",
    pa_get_stream_write_available, METH_VARARGS,
@@ -145,6 +192,46 @@ static PyMethodDef paMethods[] = {
    pa_get_stream_read_available, METH_VARARGS,
    "get buffer available for reading"},
 
+  {"get_stream_ring_buffer_stats",
+   pa_get_stream_ring_buffer_stats, METH_VARARGS,
+   "get ring buffer fill levels and overflow/underflow counts"},
+
+  {"get_stream_notify_fd",
+   pa_get_stream_notify_fd, METH_VARARGS,
+   "get the descriptor that a notify stream signals"},
+
+  {"clear_stream_notify",
+   pa_clear_stream_notify, METH_VARARGS,
+   "clear the descriptor that a notify stream signals"},
+
+  {"get_stream_levels",
+   pa_get_stream_levels, METH_VARARGS,
+   "get per-channel input levels of a metering stream"},
+
+  {"set_stream_notify_watermarks",
+   pa_set_stream_notify_watermarks, METH_VARARGS,
+   "signal a notify stream only once enough frames can be read or written"},
+
+  /* mixer voices */
+  {"add_stream_voice", pa_add_stream_voice, METH_VARARGS,
+   "start a voice of a mixer stream"},
+
+  {"write_stream_voice", pa_write_stream_voice, METH_VARARGS,
+   "queue frames for a voice of a mixer stream"},
+
+  {"set_stream_voice_gain", pa_set_stream_voice_gain, METH_VARARGS,
+   "set the gain of a voice of a mixer stream"},
+
+  {"remove_stream_voice", pa_remove_stream_voice, METH_VARARGS,
+   "end a voice of a mixer stream"},
+
+  {"get_stream_voice_info", pa_get_stream_voice_info, METH_VARARGS,
+   "get whether a voice of a mixer stream plays, and what it has queued"},
+
+  /* callback worker */
+  {"run_stream_callback_worker", pa_run_stream_callback_worker, METH_VARARGS,
+   "run the callback of a callback_thread stream until it is closed"},
+
   {NULL, NULL, 0, NULL}
 };
 
@@ -155,6 +242,52 @@ static PyMethodDef paMethods[] = {
  *
  ************************************************************/
 
+/*************************************************************
+ * Module State
+ *************************************************************/
+
+/* Each interpreter that imports the module gets its own module
+   object, and with it its own copy of the types below. */
+
+typedef struct {
+  PyTypeObject *deviceInfoType;
+  PyTypeObject *hostApiInfoType;
+  PyTypeObject *streamType;
+  PyTypeObject *sampleBufferType;
+#ifdef MACOSX
+  PyTypeObject *macCoreStreamInfoType;
+#endif
+} _pyAudio_ModuleState;
+
+static _pyAudio_ModuleState *
+_get_state(PyObject *module)
+{
+  return (_pyAudio_ModuleState *) PyModule_GetState(module);
+}
+
+/* PortAudio lock
+ *
+ * Within an interpreter the GIL serializes calls into PortAudio, but
+ * interpreters with a GIL of their own run in parallel. Calls that
+ * change PortAudio's global state (initialization, opening and closing
+ * streams, probing devices) take this process-wide lock as well. It
+ * must only be taken with the GIL released: Pa_CloseStream waits for
+ * a callback that may itself be waiting for the GIL. */
+
+static _pyAudio_Mutex _portaudioLock = PA_MUTEX_INITIALIZER;
+
+static void
+_lock_portaudio(void)
+{
+  _mutex_lock(&_portaudioLock);
+}
+
+static void
+_unlock_portaudio(void)
+{
+  _mutex_unlock(&_portaudioLock);
+}
+
 
 /*************************************************************
  * PaDeviceInfo Type : Python object wrapper for PaDeviceInfo
@@ -389,62 +522,39 @@ static PyGetSetDef _pyAudio_paDeviceInfo_getseters[] = {
 static void
 _pyAudio_paDeviceInfo_dealloc(_pyAudio_paDeviceInfo* self)
 {
+  PyTypeObject *type = Py_TYPE(self);
+
   /* reset the pointer */
   self->devInfo = NULL;
 
-  /* free the object */
-  Py_TYPE(self)->tp_free((PyObject*) self);
-}
-
-static PyTypeObject _pyAudio_paDeviceInfoType = {
-    PyVarObject_HEAD_INIT(NULL, 0)
-    "_portaudio.paDeviceInfo", /*tp_name*/
-    sizeof(_pyAudio_paDeviceInfo),   /*tp_basicsize*/
-    0,                         /*tp_itemsize*/
-    (destructor) _pyAudio_paDeviceInfo_dealloc, /*tp_dealloc*/
-    0,                         /*tp_print*/
-    0,                         /*tp_getattr*/
-    0,                         /*tp_setattr*/
-    0,                         /*tp_compare*/
-    0,                         /*tp_repr*/
-    0,                         /*tp_as_number*/
-    0,                         /*tp_as_sequence*/
-    0,                         /*tp_as_mapping*/
-    0,                         /*tp_hash */
-    0,                         /*tp_call*/
-    0,                         /*tp_str*/
-    0,                         /*tp_getattro*/
-    0,                         /*tp_setattro*/
-    0,                         /*tp_as_buffer*/
-    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
-    "Port Audio Device Info",       /* tp_doc */
-    0,  /* tp_traverse */
-    0,  /* tp_clear */
-    0,  /* tp_richcompare */
-    0,  /* tp_weaklistoffset */
-    0,  /* tp_iter */
-    0,  /* tp_iternext */
-    0,  /* tp_methods */
-    0,  /* tp_members */
-    _pyAudio_paDeviceInfo_getseters, /* tp_getset */
-    0,  /* tp_base */
-    0,  /* tp_dict */
-    0,  /* tp_descr_get */
-    0,  /* tp_descr_set */
-    0,  /* tp_dictoffset */
-    0,  /* tp_init */
-    0,  /* tp_alloc */
-    0,  /* tp_new */
+  /* free the object, and the reference it holds to its heap type */
+  type->tp_free((PyObject*) self);
+  Py_DECREF(type);
+}
+
+static PyType_Slot _pyAudio_paDeviceInfo_slots[] = {
+  {Py_tp_dealloc, (void *) _pyAudio_paDeviceInfo_dealloc},
+  {Py_tp_doc, (void *) "Port Audio Device Info"},
+  {Py_tp_getset, _pyAudio_paDeviceInfo_getseters},
+  {0, NULL}
+};
+
+static PyType_Spec _pyAudio_paDeviceInfoSpec = {
+  "_portaudio.paDeviceInfo",
+  sizeof(_pyAudio_paDeviceInfo),
+  0,
+  PA_TPFLAGS_WRAPPER,
+  _pyAudio_paDeviceInfo_slots
 };
 
 static _pyAudio_paDeviceInfo *
-_create_paDeviceInfo_object(void)
+_create_paDeviceInfo_object(PyObject *module)
 {
   _pyAudio_paDeviceInfo *obj;
 
   /* don't allow subclassing? */
-  obj = (_pyAudio_paDeviceInfo *) PyObject_New(_pyAudio_paDeviceInfo,
-					       &_pyAudio_paDeviceInfoType);
+  obj = (_pyAudio_paDeviceInfo *)
+    PyObject_New(_pyAudio_paDeviceInfo, _get_state(module)->deviceInfoType);
 
   /* obj = (_pyAudio_Stream*)
      _pyAudio_StreamType.tp_alloc(&_pyAudio_StreamType, 0); */
@@ -563,11 +673,14 @@ _pyAudio_paHostApiInfo_antiset(_pyAudio_paDeviceInfo *self,
 static void
 _pyAudio_paHostApiInfo_dealloc(_pyAudio_paHostApiInfo* self)
 {
+  PyTypeObject *type = Py_TYPE(self);
+
   /* reset the pointer */
   self->apiInfo = NULL;
 
-  /* free the object */
-  Py_TYPE(self)->tp_free((PyObject*) self);
+  /* free the object, and the reference it holds to its heap type */
+  type->tp_free((PyObject*) self);
+  Py_DECREF(type);
 }
 
 static PyGetSetDef _pyAudio_paHostApiInfo_getseters[] = {
@@ -610,55 +723,29 @@ static PyGetSetDef _pyAudio_paHostApiInfo_getseters[] = {
   {NULL}
 };
 
-static PyTypeObject _pyAudio_paHostApiInfoType = {
-    PyVarObject_HEAD_INIT(NULL, 0)
-    "_portaudio.paHostApiInfo", /*tp_name*/
-    sizeof(_pyAudio_paHostApiInfo),   /*tp_basicsize*/
-    0,                         /*tp_itemsize*/
-    (destructor) _pyAudio_paHostApiInfo_dealloc, /*tp_dealloc*/
-    0,                         /*tp_print*/
-    0,                         /*tp_getattr*/
-    0,                         /*tp_setattr*/
-    0,                         /*tp_compare*/
-    0,                         /*tp_repr*/
-    0,                         /*tp_as_number*/
-    0,                         /*tp_as_sequence*/
-    0,                         /*tp_as_mapping*/
-    0,                         /*tp_hash */
-    0,                         /*tp_call*/
-    0,                         /*tp_str*/
-    0,                         /*tp_getattro*/
-    0,                         /*tp_setattro*/
-    0,                         /*tp_as_buffer*/
-    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
-    "Port Audio HostApi Info",       /* tp_doc */
-    0,  /* tp_traverse */
-    0,  /* tp_clear */
-    0,  /* tp_richcompare */
-    0,  /* tp_weaklistoffset */
-    0,  /* tp_iter */
-    0,  /* tp_iternext */
-    0,  /* tp_methods */
-    0,  /* tp_members */
-    _pyAudio_paHostApiInfo_getseters, /* tp_getset */
-    0,  /* tp_base */
-    0,  /* tp_dict */
-    0,  /* tp_descr_get */
-    0,  /* tp_descr_set */
-    0,  /* tp_dictoffset */
-    0,  /* tp_init */
-    0,  /* tp_alloc */
-    0,  /* tp_new */
+static PyType_Slot _pyAudio_paHostApiInfo_slots[] = {
+  {Py_tp_dealloc, (void *) _pyAudio_paHostApiInfo_dealloc},
+  {Py_tp_doc, (void *) "Port Audio HostApi Info"},
+  {Py_tp_getset, _pyAudio_paHostApiInfo_getseters},
+  {0, NULL}
+};
+
+static PyType_Spec _pyAudio_paHostApiInfoSpec = {
+  "_portaudio.paHostApiInfo",
+  sizeof(_pyAudio_paHostApiInfo),
+  0,
+  PA_TPFLAGS_WRAPPER,
+  _pyAudio_paHostApiInfo_slots
 };
 
 static _pyAudio_paHostApiInfo *
-_create_paHostApiInfo_object(void)
+_create_paHostApiInfo_object(PyObject *module)
 {
   _pyAudio_paHostApiInfo *obj;
 
   /* don't allow subclassing? */
-  obj = (_pyAudio_paHostApiInfo *) PyObject_New(_pyAudio_paHostApiInfo,
-						&_pyAudio_paHostApiInfoType);
+  obj = (_pyAudio_paHostApiInfo *)
+    PyObject_New(_pyAudio_paHostApiInfo, _get_state(module)->hostApiInfoType);
   return obj;
 }
 
@@ -700,8 +787,11 @@ _pyAudio_MacOSX_hostApiSpecificStreamInfo_cleanup(_pyAudio_Mac_HASSI *self)
 static void
 _pyAudio_MacOSX_hostApiSpecificStreamInfo_dealloc(_pyAudio_Mac_HASSI *self)
 {
+  PyTypeObject *type = Py_TYPE(self);
+
   _pyAudio_MacOSX_hostApiSpecificStreamInfo_cleanup(self);
-  Py_TYPE(self)->tp_free((PyObject *) self);
+  type->tp_free((PyObject *) self);
+  Py_DECREF(type);
 }
 
 static int
@@ -852,50 +942,496 @@ static PyGetSetDef _pyAudio_MacOSX_hostApiSpecificStreamInfo_getseters[] = {
   {NULL}
 };
 
-static PyTypeObject _pyAudio_MacOSX_hostApiSpecificStreamInfoType = {
-    PyVarObject_HEAD_INIT(NULL, 0)
-    "_portaudio.PaMacCoreStreamInfo", /*tp_name*/
-    sizeof(_pyAudio_MacOSX_hostApiSpecificStreamInfo),   /*tp_basicsize*/
-    0,                         /*tp_itemsize*/
-    /*tp_dealloc*/
-    (destructor) _pyAudio_MacOSX_hostApiSpecificStreamInfo_dealloc,
-    0,                         /*tp_print*/
-    0,                         /*tp_getattr*/
-    0,                         /*tp_setattr*/
-    0,                         /*tp_compare*/
-    0,                         /*tp_repr*/
-    0,                         /*tp_as_number*/
-    0,                         /*tp_as_sequence*/
-    0,                         /*tp_as_mapping*/
-    0,                         /*tp_hash */
-    0,                         /*tp_call*/
-    0,                         /*tp_str*/
-    0,                         /*tp_getattro*/
-    0,                         /*tp_setattro*/
-    0,                         /*tp_as_buffer*/
-    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
-    "Mac OS X Specific HostAPI configuration",       /* tp_doc */
-    0,  /* tp_traverse */
-    0,  /* tp_clear */
-    0,  /* tp_richcompare */
-    0,  /* tp_weaklistoffset */
-    0,  /* tp_iter */
-    0,  /* tp_iternext */
-    0,  /* tp_methods */
-    0,  /* tp_members */
-    _pyAudio_MacOSX_hostApiSpecificStreamInfo_getseters,  /* tp_getset */
-    0,  /* tp_base */
-    0,  /* tp_dict */
-    0,  /* tp_descr_get */
-    0,  /* tp_descr_set */
-    0,  /* tp_dictoffset */
-    (int (*)(PyObject*, PyObject*, PyObject*))_pyAudio_MacOSX_hostApiSpecificStreamInfo_init,  /* tp_init */
-    0,  /* tp_alloc */
-    0,  /* tp_new */
+static PyType_Slot _pyAudio_MacOSX_hostApiSpecificStreamInfo_slots[] = {
+  {Py_tp_dealloc,
+   (void *) _pyAudio_MacOSX_hostApiSpecificStreamInfo_dealloc},
+  {Py_tp_doc, (void *) "Mac OS X Specific HostAPI configuration"},
+  {Py_tp_getset, _pyAudio_MacOSX_hostApiSpecificStreamInfo_getseters},
+  {Py_tp_init, (void *) _pyAudio_MacOSX_hostApiSpecificStreamInfo_init},
+  {Py_tp_new, (void *) PyType_GenericNew},
+  {0, NULL}
+};
+
+static PyType_Spec _pyAudio_MacOSX_hostApiSpecificStreamInfoSpec = {
+  "_portaudio.PaMacCoreStreamInfo",
+  sizeof(_pyAudio_MacOSX_hostApiSpecificStreamInfo),
+  0,
+  Py_TPFLAGS_DEFAULT,
+  _pyAudio_MacOSX_hostApiSpecificStreamInfo_slots
 };
 #endif
 
 
+/*************************************************************
+ * Stream Callback Context
+ *************************************************************/
+
+/* Callback timing statistics
+ *
+ * Histograms of how long each phase of a callback took. Bucket 0
+ * counts durations below 1 us and bucket i > 0 those in
+ * [2^(i-1), 2^i) us; the last bucket is open-ended. Only updated and
+ * read with the GIL held. */
+
+#define CALLBACK_STATS_BUCKETS 20
+
+/* phases */
+#define CALLBACK_PHASE_GIL_WAIT 0   /* entry until the GIL is held */
+#define CALLBACK_PHASE_CALLBACK 1   /* the Python callback itself */
+#define CALLBACK_PHASE_TOTAL 2      /* entry until return */
+#define CALLBACK_PHASES 3
+
+typedef struct {
+  unsigned long histogram[CALLBACK_STATS_BUCKETS];
+  unsigned long long totalNs;
+  unsigned long long maxNs;
+} _pyAudio_CallbackPhaseStats;
+
+typedef struct {
+  unsigned long callbacks;
+  /* callbacks that took longer than their buffer's duration */
+  unsigned long deadlineMisses;
+  _pyAudio_CallbackPhaseStats phases[CALLBACK_PHASES];
+} _pyAudio_CallbackStats;
+
+/* xrun counters, indexed by the bit of the corresponding
+   PaStreamCallbackFlags flag (paInputUnderflow ... paPrimingOutput) */
+#define XRUN_KINDS 5
+
+/* Per-stream state handed to the PortAudio callback as userData.
+ *
+ * Built once by pa_open so that the trampoline below never has to
+ * parse a userData tuple or rebuild constant arguments: the frame
+ * count object and the time_info dictionary are cached and reused
+ * for as long as the Python callback does not hold on to them.
+ * Blocking streams have one too, for their xrun counters. */
+
+typedef struct {
+  PyObject *callback;
+  /* the interpreter that opened the stream, NULL for the main one */
+  PyInterpreterState *interp;
+  unsigned long bytesPerFrame;
+  /* non_interleaved: buffers are arrays of one pointer per channel,
+     each to bytesPerFrame / channels bytes per frame */
+  int nonInterleaved;
+  int channels;
+  /* of the callback's input, if a processing graph changes it */
+  unsigned long inputBytesPerFrame;
+
+  /* processing graph run on the input before the callback, if any */
+  _pyAudio_DspGraph *graph;
+
+  /* pass input as a memoryview over PortAudio's buffer (no copy) */
+  int zeroCopyInput;
+  /* let the callback write into a memoryview over PortAudio's output
+     buffer instead of returning the output data */
+  int zeroCopyOutput;
+  PyObject *releaseName;
+
+  /* cached callback arguments */
+  unsigned long frameCountValue;
+  PyObject *frameCount;
+  PyObject *timeInfo;
+  PyObject *inputBufferAdcTimeKey;
+  PyObject *currentTimeKey;
+  PyObject *outputBufferDacTimeKey;
+
+  /* ring-buffered modes: the PortAudio callback only moves audio
+     through these rings and never takes the GIL. With a callback
+     (callback_thread), a Python worker thread runs it one period
+     ahead; without one, read() and write() copy to and from the
+     rings directly. */
+  int ringBuffered;
+  /* whether the semaphores below exist (ring-buffered and mixer
+     streams) */
+  int signals;
+  PaStream *stream;
+  unsigned long framesPerBuffer;
+  double sampleRate;
+  PaTime inputLatency;
+  PaTime outputLatency;
+  _pyAudio_RingBuffer inputRing;
+  _pyAudio_RingBuffer outputRing;
+  char *workerInput;
+  char *workerOutput;
+  _pyAudio_Semaphore inputSignal;
+  _pyAudio_Semaphore outputSignal;
+  _pyAudio_Semaphore workerExited;
+  long workerThread;
+  volatile unsigned long workerState;
+  volatile unsigned long callbackResult;
+  volatile unsigned long pendingFlags;
+
+  /* device_rate: the ring callback resamples between the device's
+     rate and the stream's, at which the rings hold frames */
+  _pyAudio_Resampler *inputResampler;
+  _pyAudio_Resampler *outputResampler;
+  char *resampleBuffer;
+
+  /* periods in which the input ring was full or the output ring ran
+     dry */
+  volatile unsigned long inputOverflows;
+  volatile unsigned long outputUnderflows;
+  unsigned long reportedInputOverflows;
+  unsigned long reportedOutputUnderflows;
+
+  /* read()/write() calls blocked on a ring with the GIL released */
+  int ringWaiters;
+
+  /* notify: for event loops to wait on instead of read() and
+     write(), signalled in periods of the ring callback after which
+     the input ring holds at least notifyReadFrames frames or the
+     output ring has room for at least notifyWriteFrames, and cleared
+     by read() and write() once neither holds, so that it stays
+     readable exactly while either does. Both watermarks start at
+     notifyPeriodFrames, in the directions the stream has. */
+  int notify;
+  _pyAudio_Notifier notifier;
+  unsigned long notifyPeriodFrames;
+  volatile unsigned long notifyReadFrames;
+  volatile unsigned long notifyWriteFrames;
+
+  /* batch_periods: the callback gets batchFrames frames at a time,
+     once every so many PortAudio periods. batchFill frames of the
+     current batch have been collected from (and played out of) the
+     buffers below. */
+  unsigned long batchFrames;
+  unsigned long batchFill;
+  char *batchInput;
+  char *batchOutput;
+  PaStreamCallbackTimeInfo batchTimeInfo;
+  PaStreamCallbackFlags batchFlags;
+  int batchResult;
+
+  /* file playback: plays fileFrames frames from fileData, a region of
+     the mapped file, starting from filePosition */
+  _pyAudio_MappedFile file;
+  const char *fileData;
+  unsigned long fileFrames;
+  volatile unsigned long filePosition;
+  int fileLoop;
+
+  /* record_file: input is also queued for a native writer thread */
+  _pyAudio_Recorder *recorder;
+
+  /* metering: input levels, kept up to date by the callback */
+  _pyAudio_DspMeter *meter;
+
+  /* mixer_voices: the output is mixed from the mixer's voices, whose
+     writers wait on outputSignal for room in their queues */
+  _pyAudio_Mixer *mixer;
+
+  _pyAudio_CallbackStats stats;
+
+  /* status flags reported by PortAudio, counted lock-free from any
+     thread */
+  volatile unsigned long xrunCounts[XRUN_KINDS];
+} _pyAudio_StreamCallbackContext;
+
+static void
+_count_xruns(_pyAudio_StreamCallbackContext *context,
+             PaStreamCallbackFlags flags)
+{
+  int i;
+
+  for (i = 0; i < XRUN_KINDS; i++) {
+    if (flags & (1UL << i))
+      PA_ATOMIC_ADD(&context->xrunCounts[i], 1);
+  }
+}
+
+/* workerState */
+#define WORKER_IDLE 0
+#define WORKER_RUNNING 1
+#define WORKER_STOP 2
+#define WORKER_ORPHANED 3
+
+static void
+_destroy_callback_context(_pyAudio_StreamCallbackContext *context)
+{
+  if (context->ringBuffered) {
+    _ringbuffer_free(&context->inputRing);
+    _ringbuffer_free(&context->outputRing);
+    free(context->workerInput);
+    free(context->workerOutput);
+  }
+
+  if (context->inputResampler)
+    _resampler_free(context->inputResampler);
+  if (context->outputResampler)
+    _resampler_free(context->outputResampler);
+  free(context->resampleBuffer);
+
+  if (context->signals) {
+    _semaphore_destroy(&context->inputSignal);
+    _semaphore_destroy(&context->outputSignal);
+    _semaphore_destroy(&context->workerExited);
+  }
+
+  free(context->batchInput);
+  free(context->batchOutput);
+  if (context->graph)
+    _dsp_graph_free(context->graph);
+  if (context->file.data)
+    _mappedfile_close(&context->file);
+  if (context->recorder)
+    _recorder_free(context->recorder);
+  if (context->meter)
+    _dsp_meter_free(context->meter);
+  if (context->mixer)
+    _mixer_free(context->mixer);
+  if (context->notify)
+    _notifier_close(&context->notifier);
+
+  Py_XDECREF(context->callback);
+  Py_XDECREF(context->frameCount);
+  Py_XDECREF(context->timeInfo);
+  Py_XDECREF(context->inputBufferAdcTimeKey);
+  Py_XDECREF(context->currentTimeKey);
+  Py_XDECREF(context->outputBufferDacTimeKey);
+  Py_XDECREF(context->releaseName);
+  free(context);
+}
+
+static _pyAudio_StreamCallbackContext *
+_create_callback_context(PyObject *callback, unsigned long bytesPerFrame,
+                         int zeroCopyInput, int zeroCopyOutput)
+{
+  _pyAudio_StreamCallbackContext *context;
+
+  context = (_pyAudio_StreamCallbackContext *)
+    calloc(1, sizeof(_pyAudio_StreamCallbackContext));
+
+  if (context == NULL) {
+    PyErr_NoMemory();
+    return NULL;
+  }
+
+  Py_XINCREF(callback);
+  context->callback = callback;
+  context->bytesPerFrame = bytesPerFrame;
+
+  context->interp = PyInterpreterState_Get();
+  if (context->interp == PyInterpreterState_Main())
+    context->interp = NULL;
+  context->inputBytesPerFrame = bytesPerFrame;
+  context->zeroCopyInput = zeroCopyInput;
+  context->zeroCopyOutput = zeroCopyOutput;
+
+  context->inputBufferAdcTimeKey =
+    PyUnicode_InternFromString("inputBufferAdcTime");
+  context->currentTimeKey = PyUnicode_InternFromString("currentTime");
+  context->outputBufferDacTimeKey =
+    PyUnicode_InternFromString("outputBufferDacTime");
+
+  context->releaseName = PyUnicode_InternFromString("release");
+
+  if (!context->inputBufferAdcTimeKey || !context->currentTimeKey ||
+      !context->outputBufferDacTimeKey || !context->releaseName) {
+    _destroy_callback_context(context);
+    return NULL;
+  }
+
+  return context;
+}
+
+/* Creates the semaphores that the callback posts to and that
+ * read()/write() and the worker wait on. */
+static int
+_init_callback_context_signals(_pyAudio_StreamCallbackContext *context)
+{
+  if (_semaphore_init(&context->inputSignal) != 0) {
+    PyErr_SetString(PyExc_OSError, "Could not create semaphore");
+    return -1;
+  }
+
+  if (_semaphore_init(&context->outputSignal) != 0) {
+    _semaphore_destroy(&context->inputSignal);
+    PyErr_SetString(PyExc_OSError, "Could not create semaphore");
+    return -1;
+  }
+
+  if (_semaphore_init(&context->workerExited) != 0) {
+    _semaphore_destroy(&context->inputSignal);
+    _semaphore_destroy(&context->outputSignal);
+    PyErr_SetString(PyExc_OSError, "Could not create semaphore");
+    return -1;
+  }
+
+  /* from here on, _destroy_callback_context cleans up */
+  context->signals = 1;
+  return 0;
+}
+
+/* Switches the context to a ring-buffered mode. With a callback, a
+ * duplex stream's output ring is primed with silence so that the
+ * worker can run one ring's worth of periods ahead of the device. */
+static int
+_init_callback_context_rings(_pyAudio_StreamCallbackContext *context,
+                             int input, int output,
+                             unsigned long framesPerBuffer,
+                             unsigned long ringFrames)
+{
+  unsigned long periodBytes = framesPerBuffer * context->bytesPerFrame;
+
+  if (_init_callback_context_signals(context) < 0)
+    return -1;
+
+  context->ringBuffered = 1;
+  context->framesPerBuffer = framesPerBuffer;
+  context->callbackResult = paContinue;
+
+  if (input) {
+    if (_ringbuffer_init(&context->inputRing, context->bytesPerFrame,
+                         ringFrames) != 0 ||
+        (context->callback &&
+         (context->workerInput = (char *) malloc(periodBytes)) == NULL)) {
+      PyErr_NoMemory();
+      return -1;
+    }
+  }
+
+  if (output) {
+    if (_ringbuffer_init(&context->outputRing, context->bytesPerFrame,
+                         ringFrames) != 0 ||
+        (context->callback &&
+         (context->workerOutput = (char *) malloc(periodBytes)) == NULL)) {
+      PyErr_NoMemory();
+      return -1;
+    }
+
+    if (input && context->callback)
+      _ringbuffer_write(&context->outputRing, NULL,
+                        context->outputRing.size - framesPerBuffer);
+  }
+
+  return 0;
+}
+
+/* frames of device audio that the ring callback resamples at a time */
+#define RESAMPLE_PERIOD_FRAMES 256
+
+/* Sets up device_rate for a ring-buffered context: resamplers from
+ * the device's rate to the stream's rate for input, and back for
+ * output. */
+static int
+_init_callback_context_resample(_pyAudio_StreamCallbackContext *context,
+                                int input, int output,
+                                PaSampleFormat format, int rate,
+                                int deviceRate, int quality)
+{
+  unsigned long frames = 0;
+
+  if (input) {
+    context->inputResampler = _resampler_new(context->channels, format,
+                                             deviceRate, rate, quality);
+    if (context->inputResampler == NULL)
+      goto error;
+    frames = _resampler_max_output_frames(context->inputResampler,
+                                          RESAMPLE_PERIOD_FRAMES);
+  }
+
+  if (output) {
+    context->outputResampler = _resampler_new(context->channels, format,
+                                              rate, deviceRate, quality);
+    if (context->outputResampler == NULL)
+      goto error;
+    if (_resampler_max_input_frames(context->outputResampler,
+                                    RESAMPLE_PERIOD_FRAMES) > frames)
+      frames = _resampler_max_input_frames(context->outputResampler,
+                                           RESAMPLE_PERIOD_FRAMES);
+  }
+
+  context->resampleBuffer = (char *) malloc(frames * context->bytesPerFrame);
+  if (context->resampleBuffer == NULL) {
+    PyErr_NoMemory();
+    return -1;
+  }
+
+  return 0;
+
+error:
+  if (errno == ENOMEM)
+    PyErr_NoMemory();
+  else
+    PyErr_SetString(PyExc_ValueError,
+                    "Cannot resample between rate and device_rate");
+  return -1;
+}
+
+/* Sets up mixer_voices: a mixer of up to maxVoices voices in the
+ * stream's channels and format. */
+static int
+_init_callback_context_mixer(_pyAudio_StreamCallbackContext *context,
+                             PaSampleFormat format, int maxVoices)
+{
+  if (_init_callback_context_signals(context) < 0)
+    return -1;
+
+  context->mixer = _mixer_new(context->channels, format, maxVoices);
+  if (context->mixer == NULL) {
+    PyErr_NoMemory();
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Sets up batch_periods for a stream without callback_thread. The
+ * output batch starts out silent: the first batch plays while the
+ * callback has not yet been called. */
+static int
+_init_callback_context_batch(_pyAudio_StreamCallbackContext *context,
+                             int input, int output,
+                             unsigned long batchFrames)
+{
+  context->batchFrames = batchFrames;
+  context->batchResult = paContinue;
+
+  if (input &&
+      (context->batchInput = (char *)
+       malloc(batchFrames * context->bytesPerFrame)) == NULL) {
+    PyErr_NoMemory();
+    return -1;
+  }
+
+  if (output &&
+      (context->batchOutput = (char *)
+       calloc(batchFrames, context->bytesPerFrame)) == NULL) {
+    PyErr_NoMemory();
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Stops a callback_thread worker, if one is running. Must be called
+ * with the GIL held and returns with it held; returns 0 if the context
+ * can be destroyed, or 1 if the caller is the worker itself, in which
+ * case the worker destroys the context when it exits. */
+static int
+_stop_callback_worker(_pyAudio_StreamCallbackContext *context)
+{
+  if (!context->ringBuffered ||
+      PA_ATOMIC_LOAD(&context->workerState) == WORKER_IDLE)
+    return 0;
+
+  if (context->workerThread == (long) PyThread_get_thread_ident()) {
+    PA_ATOMIC_STORE(&context->workerState, WORKER_ORPHANED);
+    return 1;
+  }
+
+  PA_ATOMIC_STORE(&context->workerState, WORKER_STOP);
+  _semaphore_post(&context->inputSignal);
+  _semaphore_post(&context->outputSignal);
+
+  Py_BEGIN_ALLOW_THREADS
+  _semaphore_wait(&context->workerExited, -1);
+  Py_END_ALLOW_THREADS
+
+  return 0;
+}
+
 /*************************************************************
  * Stream Wrapper Python Object
  *************************************************************/
@@ -909,6 +1445,10 @@ typedef struct {
   /* include PaStreamInfo too! */
   PaStreamInfo *streamInfo;
 
+  /* callback state, and the xrun counters of blocking streams: set
+     for every open stream, NULL only before open and after close */
+  _pyAudio_StreamCallbackContext *callbackContext;
+
   int is_open;
 } _pyAudio_Stream;
 
@@ -920,9 +1460,45 @@ _is_open(_pyAudio_Stream *obj) {
 static void
 _cleanup_Stream_object(_pyAudio_Stream *streamObject)
 {
-  if (streamObject->stream != NULL) {
-    Pa_CloseStream(streamObject->stream);
+  PaStream *stream = streamObject->stream;
+
+  if (stream != NULL) {
     streamObject->stream = NULL;
+    streamObject->is_open = 0;
+
+    /* the stream callback may be waiting on the GIL */
+    Py_BEGIN_ALLOW_THREADS
+    _lock_portaudio();
+    Pa_CloseStream(stream);
+    _unlock_portaudio();
+    Py_END_ALLOW_THREADS
+  }
+
+  /* safe to free now that the callback can no longer run */
+  if (streamObject->callbackContext != NULL) {
+    _pyAudio_StreamCallbackContext *context = streamObject->callbackContext;
+    streamObject->callbackContext = NULL;
+
+    /* wake up read()/write() calls blocked on the rings; the last one
+       to notice that the stream is closed posts workerExited */
+    if (context->ringWaiters > 0) {
+      _semaphore_post(&context->inputSignal);
+      _semaphore_post(&context->outputSignal);
+
+      Py_BEGIN_ALLOW_THREADS
+      _semaphore_wait(&context->workerExited, -1);
+      Py_END_ALLOW_THREADS
+    }
+
+    /* let the writer finish the file without holding up others */
+    if (context->recorder) {
+      Py_BEGIN_ALLOW_THREADS
+      _recorder_stop(context->recorder);
+      Py_END_ALLOW_THREADS
+    }
+
+    if (_stop_callback_worker(context) == 0)
+      _destroy_callback_context(context);
   }
 
   if (streamObject->streamInfo)
@@ -945,11 +1521,14 @@ _cleanup_Stream_object(_pyAudio_Stream *streamObject)
 static void
 _pyAudio_Stream_dealloc(_pyAudio_Stream* self)
 {
+  PyTypeObject *type = Py_TYPE(self);
+
   /* deallocate memory if necessary */
   _cleanup_Stream_object(self);
 
-  /* free the object */
-  Py_TYPE(self)->tp_free((PyObject*) self);
+  /* free the object, and the reference it holds to its heap type */
+  type->tp_free((PyObject*) self);
+  Py_DECREF(type);
 }
 
 
@@ -1052,6 +1631,27 @@ _pyAudio_Stream_get_sampleRate(_pyAudio_Stream *self,
   return PyFloat_FromDouble(self->streamInfo->sampleRate);
 }
 
+/* the delay that device_rate adds to the input and output latency */
+static PyObject *
+_pyAudio_Stream_get_resampleLatency(_pyAudio_Stream *self,
+				    void *closure)
+{
+  _pyAudio_Resampler *rs;
+
+  /* sanity check */
+  if (!_is_open(self)) {
+    PyErr_SetObject(PyExc_IOError,
+		    Py_BuildValue("(s,i)",
+				  "Stream closed",
+				  paBadStreamPtr));
+    return NULL;
+  }
+
+  rs = closure ? self->callbackContext->outputResampler :
+    self->callbackContext->inputResampler;
+  return PyFloat_FromDouble(rs ? _resampler_latency(rs) : 0.0);
+}
+
 static int
 _pyAudio_Stream_antiset(_pyAudio_Stream *self,
 			PyObject *value,
@@ -1088,101 +1688,288 @@ static PyGetSetDef _pyAudio_Stream_getseters[] = {
    "sample rate",
    NULL},
 
+  {"inputResampleLatency",
+   (getter) _pyAudio_Stream_get_resampleLatency,
+   (setter) _pyAudio_Stream_antiset,
+   "input latency added by resampling",
+   NULL},
+
+  {"outputResampleLatency",
+   (getter) _pyAudio_Stream_get_resampleLatency,
+   (setter) _pyAudio_Stream_antiset,
+   "output latency added by resampling",
+   (void *) 1},
+
   {NULL}
 };
 
-static PyTypeObject _pyAudio_StreamType = {
-    PyVarObject_HEAD_INIT(NULL, 0)
-    "_portaudio.Stream",       /*tp_name*/
-    sizeof(_pyAudio_Stream),         /*tp_basicsize*/
-    0,                         /*tp_itemsize*/
-    (destructor) _pyAudio_Stream_dealloc, /*tp_dealloc*/
-    0,                         /*tp_print*/
-    0,                         /*tp_getattr*/
-    0,                         /*tp_setattr*/
-    0,                         /*tp_compare*/
-    0,                         /*tp_repr*/
-    0,                         /*tp_as_number*/
-    0,                         /*tp_as_sequence*/
-    0,                         /*tp_as_mapping*/
-    0,                         /*tp_hash */
-    0,                         /*tp_call*/
-    0,                         /*tp_str*/
-    0,                         /*tp_getattro*/
-    0,                         /*tp_setattro*/
-    0,                         /*tp_as_buffer*/
-    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
-    "Port Audio Stream",       /* tp_doc */
-    0,  /* tp_traverse */
-    0,  /* tp_clear */
-    0,  /* tp_richcompare */
-    0,  /* tp_weaklistoffset */
-    0,  /* tp_iter */
-    0,  /* tp_iternext */
-    0,  /* tp_methods */
-    0,  /* tp_members */
-    _pyAudio_Stream_getseters, /* tp_getset */
-    0,  /* tp_base */
-    0,  /* tp_dict */
-    0,  /* tp_descr_get */
-    0,  /* tp_descr_set */
-    0,  /* tp_dictoffset */
-    0,  /* tp_init */
-    0,  /* tp_alloc */
-    0,  /* tp_new */
+static PyType_Slot _pyAudio_Stream_slots[] = {
+  {Py_tp_dealloc, (void *) _pyAudio_Stream_dealloc},
+  {Py_tp_doc, (void *) "Port Audio Stream"},
+  {Py_tp_getset, _pyAudio_Stream_getseters},
+  {0, NULL}
+};
+
+static PyType_Spec _pyAudio_StreamSpec = {
+  "_portaudio.Stream",
+  sizeof(_pyAudio_Stream),
+  0,
+  PA_TPFLAGS_WRAPPER,
+  _pyAudio_Stream_slots
 };
 
 static _pyAudio_Stream *
-_create_Stream_object(void)
+_create_Stream_object(PyObject *module)
 {
   _pyAudio_Stream *obj;
 
   /* don't allow subclassing? */
-  obj = (_pyAudio_Stream *) PyObject_New(_pyAudio_Stream,
-					 &_pyAudio_StreamType);
+  obj = (_pyAudio_Stream *)
+    PyObject_New(_pyAudio_Stream, _get_state(module)->streamType);
+  if (obj != NULL) {
+    obj->stream = NULL;
+    obj->inputParameters = NULL;
+    obj->outputParameters = NULL;
+    obj->streamInfo = NULL;
+    obj->callbackContext = NULL;
+    obj->is_open = 0;
+  }
+
   return obj;
 }
 
-
-/************************************************************
- *
- * III. PortAudio Method Implementations
- *
- ************************************************************/
-
 /*************************************************************
- * Version Info
+ * Sample Buffer Python Object
  *************************************************************/
 
-static PyObject *
-pa_get_version(PyObject *self, PyObject *args)
+/* Frames read by read_array(), exported through the buffer protocol
+ * as a 2-D (frames, channels) array of the stream's sample type, so
+ * that numpy.asarray(), memoryview and the like see the right shape
+ * and format without a copy. The samples of a non_interleaved stream
+ * are stored channel after channel, and exported with Fortran
+ * (column-major) strides. */
+
+typedef struct {
+  PyObject_HEAD
+  char *data;
+  const char *format;
+  Py_ssize_t itemsize;
+  Py_ssize_t shape[2];
+  Py_ssize_t strides[2];
+} _pyAudio_SampleBuffer;
+
+/* the struct module format character of a PortAudio sample format,
+   or NULL if there is none */
+static const char *
+_sample_format_code(PaSampleFormat format)
 {
-  if (!PyArg_ParseTuple(args, ""))
+  switch (format & ~paNonInterleaved) {
+  case paFloat32:
+    return "f";
+  case paInt32:
+    return "i";
+  case paInt16:
+    return "h";
+  case paInt8:
+    return "b";
+  case paUInt8:
+    return "B";
+  default:
     return NULL;
-
-  return PyLong_FromLong(Pa_GetVersion());
+  }
 }
 
-static PyObject *
-pa_get_version_text(PyObject *self, PyObject *args)
+static void
+_pyAudio_SampleBuffer_dealloc(_pyAudio_SampleBuffer *self)
 {
-  if (!PyArg_ParseTuple(args, ""))
-    return NULL;
+  PyTypeObject *type = Py_TYPE(self);
 
-  return PyUnicode_FromString(Pa_GetVersionText());
+  PyMem_Free(self->data);
+  type->tp_free((PyObject *) self);
+  Py_DECREF(type);
 }
 
-/*************************************************************
- * Initialization/Termination
- *************************************************************/
-
-static PyObject *
-pa_initialize(PyObject *self, PyObject *args)
+static int
+_pyAudio_SampleBuffer_getbuffer(_pyAudio_SampleBuffer *self,
+				Py_buffer *view, int flags)
 {
-  int err;
-  err = Pa_Initialize();
-  if (err != paNoError) {
+  /* the stride of a dimension of length 0 or 1 does not matter */
+  int empty = self->shape[0] == 0 || self->shape[1] == 0;
+  int cContiguous = empty ||
+    ((self->shape[1] == 1 || self->strides[1] == self->itemsize) &&
+     (self->shape[0] == 1 ||
+      self->strides[0] == self->shape[1] * self->itemsize));
+  int fContiguous = empty ||
+    ((self->shape[0] == 1 || self->strides[0] == self->itemsize) &&
+     (self->shape[1] == 1 ||
+      self->strides[1] == self->shape[0] * self->itemsize));
+
+  if ((!(flags & PyBUF_STRIDES) && !cContiguous) ||
+      ((flags & PyBUF_C_CONTIGUOUS) == PyBUF_C_CONTIGUOUS &&
+       !cContiguous) ||
+      ((flags & PyBUF_F_CONTIGUOUS) == PyBUF_F_CONTIGUOUS &&
+       !fContiguous)) {
+    PyErr_SetString(PyExc_BufferError,
+		    "SampleBuffer does not have the requested layout");
+    view->obj = NULL;
+    return -1;
+  }
+
+  view->obj = (PyObject *) self;
+  Py_INCREF(self);
+  view->buf = self->data;
+  view->len = self->shape[0] * self->shape[1] * self->itemsize;
+  view->readonly = 0;
+  view->itemsize = self->itemsize;
+  view->format = (flags & PyBUF_FORMAT) ? (char *) self->format : NULL;
+  view->suboffsets = NULL;
+  view->internal = NULL;
+
+  if (flags & PyBUF_ND) {
+    view->ndim = 2;
+    view->shape = self->shape;
+    view->strides = (flags & PyBUF_STRIDES) ? self->strides : NULL;
+  } else {
+    /* a plain run of bytes */
+    view->ndim = 1;
+    view->shape = NULL;
+    view->strides = NULL;
+  }
+
+  return 0;
+}
+
+static PyObject *
+_pyAudio_SampleBuffer_get_frames(_pyAudio_SampleBuffer *self,
+				 void *closure)
+{
+  return PyLong_FromSsize_t(self->shape[0]);
+}
+
+static PyObject *
+_pyAudio_SampleBuffer_get_channels(_pyAudio_SampleBuffer *self,
+				   void *closure)
+{
+  return PyLong_FromSsize_t(self->shape[1]);
+}
+
+static PyGetSetDef _pyAudio_SampleBuffer_getseters[] = {
+  {"frames",
+   (getter) _pyAudio_SampleBuffer_get_frames,
+   NULL,
+   "number of frames",
+   NULL},
+
+  {"channels",
+   (getter) _pyAudio_SampleBuffer_get_channels,
+   NULL,
+   "number of channels",
+   NULL},
+
+  {NULL}
+};
+
+static PyType_Slot _pyAudio_SampleBuffer_slots[] = {
+  {Py_tp_dealloc, (void *) _pyAudio_SampleBuffer_dealloc},
+  {Py_tp_doc, (void *) "Frames read from a stream, as a 2-D buffer"},
+  {Py_tp_getset, _pyAudio_SampleBuffer_getseters},
+  {Py_bf_getbuffer, (void *) _pyAudio_SampleBuffer_getbuffer},
+  {0, NULL}
+};
+
+static PyType_Spec _pyAudio_SampleBufferSpec = {
+  "_portaudio.SampleBuffer",
+  sizeof(_pyAudio_SampleBuffer),
+  0,
+  PA_TPFLAGS_WRAPPER,
+  _pyAudio_SampleBuffer_slots
+};
+
+/* a buffer for frames frames of channels samples of the given format,
+   stored channel after channel if planar */
+static _pyAudio_SampleBuffer *
+_create_SampleBuffer_object(PyObject *module, PaSampleFormat format,
+			    int channels, Py_ssize_t frames, int planar)
+{
+  _pyAudio_SampleBuffer *obj;
+  Py_ssize_t itemsize = Pa_GetSampleSize(format);
+
+  obj = (_pyAudio_SampleBuffer *)
+    PyObject_New(_pyAudio_SampleBuffer,
+		 _get_state(module)->sampleBufferType);
+  if (obj == NULL)
+    return NULL;
+
+  obj->data = NULL;
+  if (frames > PY_SSIZE_T_MAX / (channels * itemsize) ||
+      (obj->data = PyMem_Malloc(frames * channels * itemsize)) == NULL) {
+    Py_DECREF(obj);
+    PyErr_NoMemory();
+    return NULL;
+  }
+
+  obj->format = _sample_format_code(format);
+  obj->itemsize = itemsize;
+  obj->shape[0] = frames;
+  obj->shape[1] = channels;
+  if (planar) {
+    obj->strides[0] = itemsize;
+    obj->strides[1] = frames * itemsize;
+  } else {
+    obj->strides[0] = channels * itemsize;
+    obj->strides[1] = itemsize;
+  }
+
+  return obj;
+}
+
+
+/************************************************************
+ *
+ * III. PortAudio Method Implementations
+ *
+ ************************************************************/
+
+/*************************************************************
+ * Version Info
+ *************************************************************/
+
+static PyObject *
+pa_get_version(PyObject *self, PyObject *args)
+{
+  if (!PyArg_ParseTuple(args, ""))
+    return NULL;
+
+  return PyLong_FromLong(Pa_GetVersion());
+}
+
+static PyObject *
+pa_get_version_text(PyObject *self, PyObject *args)
+{
+  if (!PyArg_ParseTuple(args, ""))
+    return NULL;
+
+  return PyUnicode_FromString(Pa_GetVersionText());
+}
+
+/*************************************************************
+ * Initialization/Termination
+ *************************************************************/
+
+static PyObject *
+pa_initialize(PyObject *self, PyObject *args)
+{
+  int err;
+
+  Py_BEGIN_ALLOW_THREADS
+  _lock_portaudio();
+  err = Pa_Initialize();
+  if (err != paNoError)
     Pa_Terminate();
+  _unlock_portaudio();
+  Py_END_ALLOW_THREADS
+
+  if (err != paNoError) {
 #ifdef VERBOSE
     fprintf(stderr, "An error occured while using the portaudio stream\n");
     fprintf(stderr, "Error number: %d\n", err);
@@ -1201,7 +1988,12 @@ pa_initialize(PyObject *self, PyObject *args)
 static PyObject *
 pa_terminate(PyObject *self, PyObject *args)
 {
+  Py_BEGIN_ALLOW_THREADS
+  _lock_portaudio();
   Pa_Terminate();
+  _unlock_portaudio();
+  Py_END_ALLOW_THREADS
+
   Py_INCREF(Py_None);
   return Py_None;
 }
@@ -1341,7 +2133,7 @@ pa_get_host_api_info(PyObject *self, PyObject *args)
     return NULL;
   }
 
-  py_info = _create_paHostApiInfo_object();
+  py_info = _create_paHostApiInfo_object(self);
   py_info->apiInfo = _info;
 
   return (PyObject *) py_info;
@@ -1454,7 +2246,7 @@ pa_get_device_info(PyObject *self, PyObject *args)
     return NULL;
   }
 
-  py_info = _create_paDeviceInfo_object();
+  py_info = _create_paDeviceInfo_object(self);
   py_info->devInfo = _info;
   return (PyObject *) py_info;
 }
@@ -1463,530 +2255,3718 @@ pa_get_device_info(PyObject *self, PyObject *args)
  * Stream Open / Close / Supported
  *************************************************************/
 
-int
-_stream_callback_cfunction(const void *input, void *output, unsigned long frameCount,
-                           const PaStreamCallbackTimeInfo *timeInfo,
-                           PaStreamCallbackFlags statusFlags, void *userData)
-{
-  PyGILState_STATE _state = PyGILState_Ensure();
-
-#ifdef VERBOSE
-  if (statusFlags != 0) {
-    printf("Status flag set: ");
-    if (statusFlags & paInputUnderflow) {
-      printf("input underflow!\n");
-    }
-    if (statusFlags & paInputOverflow) {
-      printf("input overflow!\n");
-    }
-    if (statusFlags & paInputUnderflow) {
-      printf("output underflow!\n");
-    }
-    if (statusFlags & paInputUnderflow) {
-      printf("output overflow!\n");
-    }
-    if (statusFlags & paInputUnderflow) {
-      printf("priming output!\n");
-    }
-  }
+/* Callback thread state
+ *
+ * PyGILState_Ensure() creates a Python thread state whenever it runs
+ * on a thread that has none, and the matching PyGILState_Release()
+ * destroys it again. On a PortAudio thread that happens on every
+ * single callback, and it dominates the cost of the trampoline.
+ * Instead, the first callback on a thread "pins" the thread state with
+ * an extra PyGILState_Ensure() which is only released when the thread
+ * exits.
+ *
+ * PyGILState_*() only knows about the main interpreter. Callbacks of
+ * streams opened in a sub-interpreter get a thread state of that
+ * interpreter for the duration of the callback. Those cannot be
+ * pinned: an interpreter can only be ended once it has no thread
+ * states left, and PortAudio may keep its threads around. Use
+ * callback_thread to avoid the cost there. */
+
+#ifdef _WIN32
+static DWORD _callbackThreadKey = FLS_OUT_OF_INDEXES;
+#else
+static pthread_key_t _callbackThreadKey;
+static int _callbackThreadKeyValid = 0;
 #endif
 
-  PyObject *py_callback;
-  int bytesPerFrame;
-  if (!PyArg_ParseTuple((PyObject*)userData,"Oi",&py_callback, &bytesPerFrame))
-    return paAbort;
+static void
+#ifdef _WIN32
+WINAPI
+#endif
+_unpin_callback_thread_state(void *value)
+{
+  PyThreadState *tstate;
 
-  PyObject *py_frameCount = PyLong_FromUnsignedLong(frameCount);
-  PyObject *py_timeInfo =
-	  Py_BuildValue("{s:d,s:d,s:d}",
-					"inputBufferAdcTime",  timeInfo->inputBufferAdcTime,
-					"currentTime",         timeInfo->currentTime,
-					"outputBufferDacTime", timeInfo->outputBufferDacTime);
-  PyObject *py_flags = PyLong_FromUnsignedLong(statusFlags);
+  if (value == NULL || !Py_IsInitialized())
+    return;
 
-  PyObject *py_inputData;
-  if (input) {
-    py_inputData = PyByteArray_FromStringAndSize(input,bytesPerFrame*frameCount);
-    Py_INCREF(py_inputData);
-  } else {
-    py_inputData = Py_None;
-  }
+  tstate = PyGILState_GetThisThreadState();
+  if (tstate == NULL)
+    return;
 
-  PyObject *py_result;
-  py_result = PyObject_CallFunctionObjArgs(py_callback,
-										   py_inputData,
-                                           py_frameCount,
-										   py_timeInfo,
-										   py_flags,
-                                           NULL);
-  if (input) {
-    Py_DECREF(py_inputData);
-  }
+  /* dropping the last reference deletes the thread state */
+  PyEval_RestoreThread(tstate);
+  PyGILState_Release(PyGILState_UNLOCKED);
+}
 
-  Py_DECREF(py_frameCount);
-  Py_DECREF(py_timeInfo);
-  Py_DECREF(py_flags);
+static void
+_init_callback_thread_key(void)
+{
+#ifdef _WIN32
+  if (_callbackThreadKey == FLS_OUT_OF_INDEXES)
+    _callbackThreadKey = FlsAlloc(_unpin_callback_thread_state);
+#else
+  if (!_callbackThreadKeyValid)
+    _callbackThreadKeyValid =
+      (pthread_key_create(&_callbackThreadKey,
+                          _unpin_callback_thread_state) == 0);
+#endif
+}
 
-  if (py_result == NULL) {
-#ifdef VERBOSE
-    fprintf(stderr, "An error occured while using the portaudio stream\n");
-    fprintf(stderr, "Error message: Could not call callback function\n");
+/* Must be called without the GIL. */
+static void
+_pin_callback_thread_state(void)
+{
+#ifdef _WIN32
+  if (_callbackThreadKey == FLS_OUT_OF_INDEXES ||
+      FlsGetValue(_callbackThreadKey) != NULL)
+    return;
+#else
+  if (!_callbackThreadKeyValid ||
+      pthread_getspecific(_callbackThreadKey) != NULL)
+    return;
 #endif
 
-    PyErr_Print();
-    PyGILState_Release(_state);
-    return paAbort;
-  }
+  PyGILState_Ensure();
+  PyEval_SaveThread();
 
-  const char* pData;
-  int output_len;
-  int returnVal;
+#ifdef _WIN32
+  FlsSetValue(_callbackThreadKey, (void *) 1);
+#else
+  pthread_setspecific(_callbackThreadKey, (void *) 1);
+#endif
+}
 
-  if (output) {
-    if (PyTuple_Check(py_result)) {
-      if (!PyArg_ParseTuple(py_result, "s#i",
-                            &pData,
-                            &output_len,
-                            &returnVal)) {
-        PyGILState_Release(_state);
-        Py_DECREF(py_result);
-        return paAbort;
-      }
-    } else {
-      if (!PyArg_Parse(py_result, "s#",
-                       &pData,
-                       &output_len)) {
-        PyGILState_Release(_state);
-        Py_DECREF(py_result);
-        return paAbort;
-      } else if (output_len == frameCount*bytesPerFrame) {
-        returnVal = paContinue;
-      } else {
-        returnVal = paComplete;
-      }
-    }
-    Py_DECREF(py_result);
+/* Returns a new reference to the frame count argument. PortAudio
+ * almost always calls back with the same frame count, so the PyLong
+ * is kept around and only rebuilt when the count changes. */
+static PyObject *
+_callback_context_frame_count(_pyAudio_StreamCallbackContext *context,
+                              unsigned long frameCount)
+{
+  if (context->frameCount == NULL ||
+      context->frameCountValue != frameCount) {
+    Py_XDECREF(context->frameCount);
+    context->frameCount = PyLong_FromUnsignedLong(frameCount);
+    if (context->frameCount == NULL)
+      return NULL;
+    context->frameCountValue = frameCount;
+  }
 
-    memcpy(output,pData,output_len <= frameCount*bytesPerFrame
-           ? output_len
-           : frameCount*bytesPerFrame);
+  Py_INCREF(context->frameCount);
+  return context->frameCount;
+}
 
-    if (output_len < frameCount*bytesPerFrame) {
-      memset(output+output_len,0,frameCount*bytesPerFrame-output_len);
-      PyGILState_Release(_state);
-      return paComplete;
-    }
+static int
+_set_time_info_item(PyObject *dict, PyObject *key, PaTime value)
+{
+  int err;
+  PyObject *py_value = PyFloat_FromDouble(value);
 
-  } else {
-    if (!PyInt_Check(py_result)) {
-      PyErr_SetString(PyExc_ValueError, "return value for input callback must be integer");
-      PyErr_Print();
-      PyGILState_Release(_state);
-      Py_DECREF(py_result);
-      return paAbort;
-    }
-    returnVal = PyInt_AS_LONG(py_result);
-    Py_DECREF(py_result);
-  }
+  if (py_value == NULL)
+    return -1;
 
-  PyGILState_Release(_state);
-  return returnVal;
+  err = PyDict_SetItem(dict, key, py_value);
+  Py_DECREF(py_value);
+  return err;
 }
 
+/* Returns a new reference to the time_info argument. The dictionary
+ * is refilled in place unless the callback kept a reference to the
+ * previous one (or modified it), in which case a fresh one is made so
+ * that the caller never sees its saved copy change under it. */
 static PyObject *
-pa_open(PyObject *self, PyObject *args, PyObject *kwargs)
+_callback_context_time_info(_pyAudio_StreamCallbackContext *context,
+                            const PaStreamCallbackTimeInfo *timeInfo)
 {
-  int rate, channels;
-  int input, output, frames_per_buffer;
-  int input_device_index = -1;
-  int output_device_index = -1;
-  PyObject *input_device_index_arg = NULL;
-  PyObject *output_device_index_arg = NULL;
-  PyObject *stream_callback = NULL;
-  PaSampleFormat format;
-  PaError err;
-
-#ifdef MACOSX
-  _pyAudio_MacOSX_hostApiSpecificStreamInfo *inputHostSpecificStreamInfo =
-      NULL;
-  _pyAudio_MacOSX_hostApiSpecificStreamInfo *outputHostSpecificStreamInfo =
-      NULL;
-#else
-  /* mostly ignored...*/
-  PyObject *inputHostSpecificStreamInfo = NULL;
-  PyObject *outputHostSpecificStreamInfo = NULL;
-#endif
+  PyObject *dict = context->timeInfo;
 
-  /* default to neither output nor input */
-  input = 0;
-  output = 0;
-  frames_per_buffer = DEFAULT_FRAMES_PER_BUFFER;
+  if (dict == NULL || Py_REFCNT(dict) != 1 || PyDict_GET_SIZE(dict) != 3) {
+    Py_XDECREF(dict);
+    dict = context->timeInfo = PyDict_New();
+    if (dict == NULL)
+      return NULL;
+  }
 
-  /* pass in rate, channel, width */
-  static char *kwlist[] = {"rate",
-			   "channels",
-			   "format",
-			   "input",
-			   "output",
-			   "input_device_index",
-			   "output_device_index",
-			   "frames_per_buffer",
-			   "input_host_api_specific_stream_info",
-			   "output_host_api_specific_stream_info",
-               "stream_callback",
-			   NULL};
+  if (_set_time_info_item(dict, context->inputBufferAdcTimeKey,
+                          timeInfo->inputBufferAdcTime) < 0 ||
+      _set_time_info_item(dict, context->currentTimeKey,
+                          timeInfo->currentTime) < 0 ||
+      _set_time_info_item(dict, context->outputBufferDacTimeKey,
+                          timeInfo->outputBufferDacTime) < 0)
+    return NULL;
 
-  if (!PyArg_ParseTupleAndKeywords(args, kwargs,
-#ifdef MACOSX
-				   "iik|iiOOiO!O!O",
-#else
-				   "iik|iiOOiOOO",
-#endif
-				   kwlist,
-				   &rate, &channels, &format,
-				   &input, &output,
-				   &input_device_index_arg,
-				   &output_device_index_arg,
-				   &frames_per_buffer,
-#ifdef MACOSX
-				   &_pyAudio_MacOSX_hostApiSpecificStreamInfoType,
-#endif
-				   &inputHostSpecificStreamInfo,
-#ifdef MACOSX
-				   &_pyAudio_MacOSX_hostApiSpecificStreamInfoType,
-#endif
-				   &outputHostSpecificStreamInfo,
-                                   &stream_callback))
+  Py_INCREF(dict);
+  return dict;
+}
 
-    return NULL;
+/* Releases a memoryview handed to the callback over one of
+ * PortAudio's buffers, which are only valid until the callback
+ * returns. This fails if the callback still has buffers exported from
+ * the view (e.g. a numpy array made with frombuffer), which then point
+ * into memory that PortAudio reuses or frees. Returns -1 with a
+ * RuntimeError set in that case, so that the stream can be aborted;
+ * an exception already pending (from the callback) is printed
+ * first. */
+static int
+_release_callback_view(_pyAudio_StreamCallbackContext *context,
+                       PyObject *view)
+{
+  PyObject *type, *value, *traceback;
+  PyObject *rv;
+  Py_ssize_t i;
+  int status = 0;
+
+  /* non_interleaved: a tuple of one view per channel */
+  if (PyTuple_Check(view)) {
+    for (i = 0; i < PyTuple_GET_SIZE(view); i++)
+      if (_release_callback_view(context, PyTuple_GET_ITEM(view, i)) < 0)
+        status = -1;
+    return status;
+  }
 
-  if (PyCallable_Check(stream_callback) == 0) {
-    PyErr_SetString(PyExc_TypeError, "stream_callback must be callable");
-    return NULL;
+  PyErr_Fetch(&type, &value, &traceback);
+  rv = PyObject_CallMethodObjArgs(view, context->releaseName, NULL);
+  if (rv != NULL) {
+    Py_DECREF(rv);
+    PyErr_Restore(type, value, traceback);
+    return 0;
   }
 
-  /* check to see if device indices were specified */
-  if ((input_device_index_arg == NULL) ||
-      (input_device_index_arg == Py_None)) {
+  PyErr_Clear();
+  if (type != NULL) {
+    PyErr_Restore(type, value, traceback);
+    PyErr_Print();
+  }
 
-#ifdef VERBOSE
-    printf("Using default input device\n");
-#endif
+  PyErr_SetString(PyExc_RuntimeError,
+                  "a buffer exported from the callback's memoryview "
+                  "outlived the callback; aborting the stream");
+  return -1;
+}
 
-    input_device_index = -1;
+/* Returns a tuple with one object per channel of a non-interleaved
+ * buffer: a memoryview with the given flags (PyBUF_READ or
+ * PyBUF_WRITE) if view is set, a bytearray copy otherwise. */
+static PyObject *
+_callback_channel_buffers(_pyAudio_StreamCallbackContext *context,
+                          void *const *channels, unsigned long channelBytes,
+                          int view, int flags)
+{
+  PyObject *tuple;
+  PyObject *item;
+  PyObject *type, *value, *traceback;
+  int c, i;
 
-  } else {
+  tuple = PyTuple_New(context->channels);
+  if (tuple == NULL)
+    return NULL;
 
-    if (!PyLong_Check(input_device_index_arg)) {
-      PyErr_SetString(PyExc_ValueError,
-		      "input_device_index must be integer (or None)");
+  for (c = 0; c < context->channels; c++) {
+    item = view ?
+      PyMemoryView_FromMemory((char *) channels[c], channelBytes, flags) :
+      PyByteArray_FromStringAndSize((const char *) channels[c],
+                                    channelBytes);
+    if (item == NULL) {
+      /* views made so far must not outlive the callback either; the
+         rest of the tuple is still empty */
+      PyErr_Fetch(&type, &value, &traceback);
+      for (i = 0; view && i < c; i++)
+        _release_callback_view(context, PyTuple_GET_ITEM(tuple, i));
+      PyErr_Restore(type, value, traceback);
+      Py_DECREF(tuple);
       return NULL;
     }
+    PyTuple_SET_ITEM(tuple, c, item);
+  }
 
-    input_device_index = (int)PyLong_AsLong(input_device_index_arg);
+  return tuple;
+}
 
-#ifdef VERBOSE
-    printf("Using input device index number: %d\n", input_device_index);
-#endif
+/* Fills PortAudio's output buffer with silence. */
+static void
+_silence_callback_output(_pyAudio_StreamCallbackContext *context,
+                         void *output, unsigned long outputBytes)
+{
+  int c;
 
+  if (!context->nonInterleaved) {
+    memset(output, 0, outputBytes);
+    return;
   }
 
-  if ((output_device_index_arg == NULL) ||
-      (output_device_index_arg == Py_None)) {
+  for (c = 0; c < context->channels; c++)
+    memset(((void **) output)[c], 0, outputBytes / context->channels);
+}
 
-#ifdef VERBOSE
-    printf("Using default output device\n");
-#endif
+/* Copies one buffer returned by the callback to out, padding it with
+ * silence if it is short. Returns 1 if it was short, 0 if not, or -1
+ * with a Python exception set. */
+static int
+_copy_callback_buffer(PyObject *py_data, void *out, unsigned long bytes)
+{
+  Py_buffer data;
+  int isShort;
 
-    output_device_index = -1;
+  if (PyObject_GetBuffer(py_data, &data, PyBUF_SIMPLE) < 0)
+    return -1;
 
+  isShort = (unsigned long) data.len < bytes;
+  if (!isShort) {
+    memcpy(out, data.buf, bytes);
   } else {
+    memcpy(out, data.buf, data.len);
+    memset((char *) out + data.len, 0, bytes - data.len);
+  }
 
-    if (!PyLong_Check(output_device_index_arg)) {
-      PyErr_SetString(PyExc_ValueError,
-		      "output_device_index must be integer (or None)");
-      return NULL;
+  PyBuffer_Release(&data);
+  return isShort;
+}
+
+/* Copies the audio data returned by the Python callback into
+ * PortAudio's output buffer. Returns the callback return code, or -1
+ * (with a Python exception set) if py_result is malformed. */
+static int
+_copy_callback_output(_pyAudio_StreamCallbackContext *context,
+                      PyObject *py_result, void *output,
+                      unsigned long outputBytes)
+{
+  PyObject *py_data = py_result;
+  PyObject *py_channels;
+  int returnVal = paContinue;
+  int isShort = 0;
+  int c;
+
+  /* with non_interleaved, the data may itself be a tuple of channels,
+     so only a pair ending in an integer is (data, flag) */
+  if (PyTuple_Check(py_result) &&
+      (!context->nonInterleaved ||
+       (PyTuple_GET_SIZE(py_result) == 2 &&
+        PyLong_Check(PyTuple_GET_ITEM(py_result, 1))))) {
+    if (PyTuple_GET_SIZE(py_result) != 2) {
+      PyErr_SetString(PyExc_ValueError,
+                      "callback must return (data, flag)");
+      return -1;
+    }
+
+    py_data = PyTuple_GET_ITEM(py_result, 0);
+    returnVal = (int) PyLong_AsLong(PyTuple_GET_ITEM(py_result, 1));
+    if (returnVal == -1 && PyErr_Occurred())
+      return -1;
+  }
+
+  if (!context->nonInterleaved) {
+    isShort = _copy_callback_buffer(py_data, output, outputBytes);
+  } else {
+    py_channels = PySequence_Fast(py_data, "callback must return a "
+                                  "sequence of channel buffers");
+    if (py_channels == NULL)
+      return -1;
+
+    if (PySequence_Fast_GET_SIZE(py_channels) != context->channels) {
+      Py_DECREF(py_channels);
+      PyErr_SetString(PyExc_ValueError,
+                      "callback must return one buffer per channel");
+      return -1;
+    }
+
+    for (c = 0; c < context->channels && isShort >= 0; c++) {
+      int rv = _copy_callback_buffer(
+        PySequence_Fast_GET_ITEM(py_channels, c),
+        ((void **) output)[c], outputBytes / context->channels);
+      isShort = (rv < 0) ? rv : (isShort | rv);
+    }
+    Py_DECREF(py_channels);
+  }
+
+  if (isShort < 0)
+    return -1;
+
+  /* short read implies the end of the stream */
+  if (isShort)
+    returnVal = paComplete;
+
+  return returnVal;
+}
+
+static void
+_record_callback_phase(_pyAudio_CallbackPhaseStats *phase,
+                       unsigned long long ns)
+{
+  unsigned long long us = ns / 1000;
+  int bucket = 0;
+
+  while (us && bucket < CALLBACK_STATS_BUCKETS - 1) {
+    us >>= 1;
+    bucket++;
+  }
+
+  phase->histogram[bucket]++;
+  phase->totalNs += ns;
+  if (ns > phase->maxNs)
+    phase->maxNs = ns;
+}
+
+/* Accounts for one callback, given the times (from _monotonic_ns) at
+ * which it was entered, got the GIL, finished calling into Python and
+ * returned. Must be called with the GIL held. */
+static void
+_record_callback_timing(_pyAudio_StreamCallbackContext *context,
+                        unsigned long frameCount,
+                        unsigned long long entered,
+                        unsigned long long locked,
+                        unsigned long long called,
+                        unsigned long long returned)
+{
+  _pyAudio_CallbackStats *stats = &context->stats;
+
+  stats->callbacks++;
+  _record_callback_phase(&stats->phases[CALLBACK_PHASE_GIL_WAIT],
+                         locked - entered);
+  _record_callback_phase(&stats->phases[CALLBACK_PHASE_CALLBACK],
+                         called - locked);
+  _record_callback_phase(&stats->phases[CALLBACK_PHASE_TOTAL],
+                         returned - entered);
+
+  if (context->sampleRate > 0 &&
+      (double) (returned - entered) > frameCount * 1e9 / context->sampleRate)
+    stats->deadlineMisses++;
+}
+
+/* Calls the Python callback for one block of audio and fills output
+ * from its result. Must be called with the GIL held. */
+static int
+_invoke_stream_callback(_pyAudio_StreamCallbackContext *context,
+                        const void *input, void *output,
+                        unsigned long frameCount,
+                        const PaStreamCallbackTimeInfo *timeInfo,
+                        PaStreamCallbackFlags statusFlags)
+{
+  unsigned long frameBytes = frameCount * context->bytesPerFrame;
+  unsigned long inputBytes = frameCount * context->inputBytesPerFrame;
+  PyObject *py_inputData = NULL;
+  PyObject *py_outputView = NULL;
+  PyObject *py_frameCount = NULL;
+  PyObject *py_timeInfo = NULL;
+  PyObject *py_flags = NULL;
+  PyObject *py_result = NULL;
+  int returnVal = paAbort;
+
+  py_frameCount = _callback_context_frame_count(context, frameCount);
+  py_timeInfo = _callback_context_time_info(context, timeInfo);
+  /* status flags are nearly always 0, which CPython caches */
+  py_flags = PyLong_FromUnsignedLong(statusFlags);
+
+  if (!py_frameCount || !py_timeInfo || !py_flags)
+    goto error;
+
+  if (input && context->nonInterleaved) {
+    py_inputData = _callback_channel_buffers(context, (void *const *) input,
+                                             inputBytes / context->channels,
+                                             context->zeroCopyInput,
+                                             PyBUF_READ);
+    if (py_inputData == NULL)
+      goto error;
+  } else if (input && context->zeroCopyInput) {
+    py_inputData = PyMemoryView_FromMemory((char *) input, inputBytes,
+                                           PyBUF_READ);
+    if (py_inputData == NULL)
+      goto error;
+  } else if (input) {
+    py_inputData = PyByteArray_FromStringAndSize(input, inputBytes);
+    if (py_inputData == NULL)
+      goto error;
+  } else {
+    Py_INCREF(Py_None);
+    py_inputData = Py_None;
+  }
+
+  if (output && context->zeroCopyOutput) {
+    py_outputView = context->nonInterleaved ?
+      _callback_channel_buffers(context, (void *const *) output,
+                                frameBytes / context->channels, 1,
+                                PyBUF_WRITE) :
+      PyMemoryView_FromMemory((char *) output, frameBytes, PyBUF_WRITE);
+    if (py_outputView == NULL)
+      goto error;
+
+    py_result = PyObject_CallFunctionObjArgs(context->callback,
+                                             py_inputData,
+                                             py_outputView,
+                                             py_frameCount,
+                                             py_timeInfo,
+                                             py_flags,
+                                             NULL);
+    /* nothing may write to the buffer once PortAudio has it back */
+    if (_release_callback_view(context, py_outputView) < 0)
+      Py_CLEAR(py_result);
+  } else {
+    py_result = PyObject_CallFunctionObjArgs(context->callback,
+                                             py_inputData,
+                                             py_frameCount,
+                                             py_timeInfo,
+                                             py_flags,
+                                             NULL);
+  }
+
+  if (input && context->zeroCopyInput &&
+      _release_callback_view(context, py_inputData) < 0)
+    Py_CLEAR(py_result);
+  if (py_result == NULL) {
+#ifdef VERBOSE
+    fprintf(stderr, "An error occured while using the portaudio stream\n");
+    fprintf(stderr, "Error message: Could not call callback function\n");
+#endif
+    goto error;
+  }
+
+  if (output && !context->zeroCopyOutput) {
+    returnVal = _copy_callback_output(context, py_result, output,
+                                      frameBytes);
+  } else if (PyLong_Check(py_result)) {
+    returnVal = (int) PyLong_AsLong(py_result);
+  } else {
+    PyErr_SetString(PyExc_ValueError,
+                    output ?
+                    "return value for zero_copy_output callback must be "
+                    "integer" :
+                    "return value for input callback must be integer");
+    returnVal = -1;
+  }
+
+  if (returnVal == -1)
+    goto error;
+
+  goto done;
+
+ error:
+  if (PyErr_Occurred())
+    PyErr_Print();
+  if (output)
+    _silence_callback_output(context, output, frameBytes);
+  returnVal = paAbort;
+
+ done:
+  Py_XDECREF(py_result);
+  Py_XDECREF(py_inputData);
+  Py_XDECREF(py_outputView);
+  Py_XDECREF(py_frameCount);
+  Py_XDECREF(py_timeInfo);
+  Py_XDECREF(py_flags);
+
+  return returnVal;
+}
+
+/* Runs the Python callback from the PortAudio thread, and records
+ * its timing against a deadline of deadlineFrames frames from
+ * entered. */
+static int
+_call_stream_callback(_pyAudio_StreamCallbackContext *context,
+                      const void *input, void *output,
+                      unsigned long frameCount,
+                      const PaStreamCallbackTimeInfo *timeInfo,
+                      PaStreamCallbackFlags statusFlags,
+                      unsigned long deadlineFrames,
+                      unsigned long long entered)
+{
+  PyGILState_STATE _state = PyGILState_UNLOCKED;
+  PyThreadState *tstate = NULL;
+  unsigned long long locked, called;
+  int returnVal;
+
+  if (context->interp) {
+    tstate = PyThreadState_New(context->interp);
+    PyEval_RestoreThread(tstate);
+  } else {
+    _pin_callback_thread_state();
+    _state = PyGILState_Ensure();
+  }
+  locked = _monotonic_ns();
+
+  returnVal = _invoke_stream_callback(context, input, output, frameCount,
+                                      timeInfo, statusFlags);
+  called = _monotonic_ns();
+
+  /* "returned" is taken just before giving up the GIL, as the stats
+     may only be touched while holding it */
+  _record_callback_timing(context, deadlineFrames, entered, locked,
+                          called, _monotonic_ns());
+
+  if (tstate) {
+    PyThreadState_Clear(tstate);
+    PyThreadState_DeleteCurrent();
+  } else {
+    PyGILState_Release(_state);
+  }
+  return returnVal;
+}
+
+/* hands the input to the recorder and the meter, if the stream has
+   them */
+static void
+_monitor_input(_pyAudio_StreamCallbackContext *context, const void *input,
+               unsigned long frameCount)
+{
+  if (context->recorder)
+    _recorder_write(context->recorder, input, frameCount);
+  if (context->meter)
+    _dsp_meter_write(context->meter, input, context->nonInterleaved,
+                     frameCount);
+}
+
+static int
+_stream_callback_cfunction(const void *input, void *output,
+                           unsigned long frameCount,
+                           const PaStreamCallbackTimeInfo *timeInfo,
+                           PaStreamCallbackFlags statusFlags,
+                           void *userData)
+{
+  _pyAudio_StreamCallbackContext *context =
+    (_pyAudio_StreamCallbackContext *) userData;
+  unsigned long long entered = _monotonic_ns();
+
+  if (statusFlags)
+    _count_xruns(context, statusFlags);
+
+  if (input)
+    _monitor_input(context, input, frameCount);
+
+  return _call_stream_callback(context, input, output, frameCount,
+                               timeInfo, statusFlags, frameCount, entered);
+}
+
+/* PortAudio callback for batch_periods streams. Collects input and
+ * plays output one period at a time, and calls the Python callback
+ * whenever a whole batch of input is in, which also provides the
+ * output for the next batch of periods. */
+static int
+_stream_batch_callback(const void *input, void *output,
+                       unsigned long frameCount,
+                       const PaStreamCallbackTimeInfo *timeInfo,
+                       PaStreamCallbackFlags statusFlags,
+                       void *userData)
+{
+  _pyAudio_StreamCallbackContext *context =
+    (_pyAudio_StreamCallbackContext *) userData;
+  unsigned long long entered = _monotonic_ns();
+  unsigned long frameSize = context->bytesPerFrame;
+  unsigned long done = 0;
+  unsigned long frames;
+  int finished = 0;
+
+  if (statusFlags)
+    _count_xruns(context, statusFlags);
+
+  if (input)
+    _monitor_input(context, input, frameCount);
+
+  context->batchFlags |= statusFlags;
+
+  while (done < frameCount) {
+    if (context->batchFill == 0 && input)
+      context->batchTimeInfo.inputBufferAdcTime =
+        timeInfo->inputBufferAdcTime + done / context->sampleRate;
+
+    frames = context->batchFrames - context->batchFill;
+    if (frames > frameCount - done)
+      frames = frameCount - done;
+
+    if (input)
+      memcpy(context->batchInput + context->batchFill * frameSize,
+             (const char *) input + done * frameSize, frames * frameSize);
+    if (output)
+      memcpy((char *) output + done * frameSize,
+             context->batchOutput + context->batchFill * frameSize,
+             frames * frameSize);
+
+    context->batchFill += frames;
+    done += frames;
+
+    if (context->batchFill < context->batchFrames)
+      continue;
+
+    /* the final batch has played out */
+    if (context->batchResult != paContinue) {
+      finished = 1;
+      break;
+    }
+
+    /* the new output batch starts playing right after this one */
+    context->batchTimeInfo.currentTime = timeInfo->currentTime;
+    context->batchTimeInfo.outputBufferDacTime = output ?
+      timeInfo->outputBufferDacTime + done / context->sampleRate : 0;
+
+    context->batchResult =
+      _call_stream_callback(context, context->batchInput,
+                            context->batchOutput, context->batchFrames,
+                            &context->batchTimeInfo, context->batchFlags,
+                            frameCount, entered);
+    context->batchFill = 0;
+    context->batchFlags = 0;
+
+    if (context->batchResult == paAbort ||
+        (context->batchResult == paComplete && !output)) {
+      finished = 1;
+      break;
+    }
+  }
+
+  if (finished) {
+    if (output)
+      memset((char *) output + done * frameSize, 0,
+             (frameCount - done) * frameSize);
+    return context->batchResult;
+  }
+
+  return paContinue;
+}
+
+/* PortAudio callback for file playback streams: copies straight from
+ * the mapped file. A concurrent seek wins over the position this
+ * callback would have stored. */
+static int
+_stream_file_callback(const void *input, void *output,
+                      unsigned long frameCount,
+                      const PaStreamCallbackTimeInfo *timeInfo,
+                      PaStreamCallbackFlags statusFlags,
+                      void *userData)
+{
+  _pyAudio_StreamCallbackContext *context =
+    (_pyAudio_StreamCallbackContext *) userData;
+  unsigned long frameSize = context->bytesPerFrame;
+  unsigned long start = PA_ATOMIC_LOAD(&context->filePosition);
+  unsigned long position = start;
+  unsigned long done = 0;
+  unsigned long frames;
+
+  if (statusFlags)
+    _count_xruns(context, statusFlags);
+
+  while (done < frameCount) {
+    if (position >= context->fileFrames) {
+      if (!context->fileLoop)
+        break;
+      position = 0;
+    }
+
+    frames = context->fileFrames - position;
+    if (frames > frameCount - done)
+      frames = frameCount - done;
+
+    memcpy((char *) output + done * frameSize,
+           context->fileData + (size_t) position * frameSize,
+           frames * frameSize);
+    done += frames;
+    position += frames;
+  }
+
+  PA_ATOMIC_CAS(&context->filePosition, start, position);
+
+  if (done < frameCount) {
+    memset((char *) output + done * frameSize, 0,
+           (frameCount - done) * frameSize);
+    return paComplete;
+  }
+
+  return paContinue;
+}
+
+/* PortAudio callback for streams with a processing graph. Runs the
+ * graph on the input and, without a Python tap, writes its result
+ * straight to the output, never taking the GIL. */
+static int
+_stream_graph_callback(const void *input, void *output,
+                       unsigned long frameCount,
+                       const PaStreamCallbackTimeInfo *timeInfo,
+                       PaStreamCallbackFlags statusFlags,
+                       void *userData)
+{
+  _pyAudio_StreamCallbackContext *context =
+    (_pyAudio_StreamCallbackContext *) userData;
+  unsigned long long entered = _monotonic_ns();
+  void *processed;
+
+  if (statusFlags)
+    _count_xruns(context, statusFlags);
+
+  /* cannot happen with a fixed frames_per_buffer */
+  if (frameCount > context->graph->maxFrames) {
+    if (output)
+      memset(output, 0, frameCount * context->bytesPerFrame);
+    return paAbort;
+  }
+
+  _monitor_input(context, input, frameCount);
+
+  if (context->callback == NULL) {
+    _dsp_graph_process(context->graph, input, output, frameCount);
+    return paContinue;
+  }
+
+  processed = _dsp_graph_process(context->graph, input, NULL, frameCount);
+  return _call_stream_callback(context, processed, output, frameCount,
+                               timeInfo, statusFlags, frameCount, entered);
+}
+
+/* PortAudio callback for streams that only record or meter: input
+ * goes straight to the recorder and the meter. */
+static int
+_stream_monitor_callback(const void *input, void *output,
+                         unsigned long frameCount,
+                         const PaStreamCallbackTimeInfo *timeInfo,
+                         PaStreamCallbackFlags statusFlags,
+                         void *userData)
+{
+  _pyAudio_StreamCallbackContext *context =
+    (_pyAudio_StreamCallbackContext *) userData;
+
+  if (statusFlags)
+    _count_xruns(context, statusFlags);
+
+  _monitor_input(context, input, frameCount);
+  return paContinue;
+}
+
+/* PortAudio callback for mixer streams: mixes whatever the voices
+ * have queued and wakes up writers waiting for room. */
+static int
+_stream_mixer_callback(const void *input, void *output,
+                       unsigned long frameCount,
+                       const PaStreamCallbackTimeInfo *timeInfo,
+                       PaStreamCallbackFlags statusFlags,
+                       void *userData)
+{
+  _pyAudio_StreamCallbackContext *context =
+    (_pyAudio_StreamCallbackContext *) userData;
+
+  if (statusFlags)
+    _count_xruns(context, statusFlags);
+
+  _mixer_process(context->mixer, output, frameCount);
+  _semaphore_post(&context->outputSignal);
+  return paContinue;
+}
+
+/* whether one of a notify stream's watermarks is reached */
+static int
+_notify_watermark_reached(_pyAudio_StreamCallbackContext *context)
+{
+  unsigned long readFrames = PA_ATOMIC_LOAD(&context->notifyReadFrames);
+  unsigned long writeFrames = PA_ATOMIC_LOAD(&context->notifyWriteFrames);
+
+  if (readFrames && context->inputRing.buffer &&
+      _ringbuffer_read_available(&context->inputRing) >= readFrames)
+    return 1;
+
+  return writeFrames && context->outputRing.buffer &&
+    _ringbuffer_write_available(&context->outputRing) >= writeFrames;
+}
+
+/* Resamples a period of device input into the input ring. Returns
+ * the number of frames (at the device's rate) queued, less than
+ * frameCount if the ring filled up. */
+static unsigned long
+_resample_input(_pyAudio_StreamCallbackContext *context, const void *input,
+                unsigned long frameCount)
+{
+  _pyAudio_Resampler *rs = context->inputResampler;
+  unsigned long done = 0;
+  unsigned long n, frames;
+
+  while (done < frameCount) {
+    n = frameCount - done;
+    if (n > RESAMPLE_PERIOD_FRAMES)
+      n = RESAMPLE_PERIOD_FRAMES;
+
+    frames = _resampler_process(rs, (const char *) input +
+                                done * context->bytesPerFrame, n,
+                                context->resampleBuffer,
+                                _resampler_max_output_frames(rs, n));
+    if (_ringbuffer_write(&context->inputRing, context->resampleBuffer,
+                          frames) < frames)
+      return done;
+    done += n;
+  }
+
+  return frameCount;
+}
+
+/* Fills a period of device output by resampling from the output ring.
+ * Returns the number of frames (at the device's rate) filled, less
+ * than frameCount if the ring ran dry. */
+static unsigned long
+_resample_output(_pyAudio_StreamCallbackContext *context, void *output,
+                 unsigned long frameCount)
+{
+  _pyAudio_Resampler *rs = context->outputResampler;
+  unsigned long frameSize = context->bytesPerFrame;
+  unsigned long done = 0;
+  unsigned long n, needed, frames;
+
+  while (done < frameCount) {
+    n = frameCount - done;
+    if (n > RESAMPLE_PERIOD_FRAMES)
+      n = RESAMPLE_PERIOD_FRAMES;
+
+    needed = _resampler_input_frames(rs, n);
+    frames = _ringbuffer_read(&context->outputRing, context->resampleBuffer,
+                              needed);
+    if (frames < needed)
+      memset(context->resampleBuffer + frames * frameSize, 0,
+             (needed - frames) * frameSize);
+
+    _resampler_process(rs, context->resampleBuffer, needed,
+                       (char *) output + done * frameSize, n);
+    if (frames < needed)
+      return done + n * frames / needed;
+    done += n;
+  }
+
+  return frameCount;
+}
+
+/* PortAudio callback for ring-buffered streams. Runs without the GIL:
+ * input is queued for the worker (or read()), output is taken from
+ * what the worker (or write()) has queued, and anything that does not
+ * fit is counted and reported to the worker as an overflow/underflow
+ * in the next callback's flags. */
+static int
+_stream_ring_callback(const void *input, void *output,
+                      unsigned long frameCount,
+                      const PaStreamCallbackTimeInfo *timeInfo,
+                      PaStreamCallbackFlags statusFlags,
+                      void *userData)
+{
+  _pyAudio_StreamCallbackContext *context =
+    (_pyAudio_StreamCallbackContext *) userData;
+  unsigned long result = PA_ATOMIC_LOAD(&context->callbackResult);
+  unsigned long flags = statusFlags;
+  unsigned long frames;
+
+  if (statusFlags)
+    _count_xruns(context, statusFlags);
+
+  if (result == paAbort) {
+    if (output)
+      memset(output, 0, frameCount * context->bytesPerFrame);
+    return paAbort;
+  }
+
+  if (input && result == paContinue) {
+    _monitor_input(context, input, frameCount);
+
+    if ((context->inputResampler ?
+         _resample_input(context, input, frameCount) :
+         _ringbuffer_write(&context->inputRing, input, frameCount)) <
+        frameCount) {
+      PA_ATOMIC_ADD(&context->inputOverflows, 1);
+      flags |= paInputOverflow;
+    }
+  }
+
+  if (output) {
+    frames = context->outputResampler ?
+      _resample_output(context, output, frameCount) :
+      _ringbuffer_read(&context->outputRing, output, frameCount);
+    if (frames < frameCount) {
+      memset((char *) output + frames * context->bytesPerFrame, 0,
+             (frameCount - frames) * context->bytesPerFrame);
+
+      /* the worker finished and everything it queued has played */
+      if (result == paComplete)
+        return paComplete;
+
+      PA_ATOMIC_ADD(&context->outputUnderflows, 1);
+      flags |= paOutputUnderflow;
+    }
+  } else if (result == paComplete) {
+    return paComplete;
+  }
+
+  if (flags && context->callback)
+    PA_ATOMIC_OR(&context->pendingFlags, flags);
+
+  /* a duplex worker only waits for input */
+  if (input)
+    _semaphore_post(&context->inputSignal);
+  if (output && !(input && context->callback))
+    _semaphore_post(&context->outputSignal);
+  if (context->notify && _notify_watermark_reached(context))
+    _notifier_signal(&context->notifier);
+  return paContinue;
+}
+
+/* whether the worker can process another period */
+static int
+_callback_worker_ready(_pyAudio_StreamCallbackContext *context)
+{
+  unsigned long frames = context->framesPerBuffer;
+
+  if (context->inputRing.buffer &&
+      _ringbuffer_read_available(&context->inputRing) < frames)
+    return 0;
+
+  if (context->outputRing.buffer &&
+      _ringbuffer_write_available(&context->outputRing) < frames)
+    return 0;
+
+  return 1;
+}
+
+/* Estimates the time info for the period the worker is about to
+ * process from the ring fill levels, since it runs ahead of (input:
+ * behind) the device by however much is queued. */
+static void
+_callback_worker_time_info(_pyAudio_StreamCallbackContext *context,
+                           PaStreamCallbackTimeInfo *timeInfo)
+{
+  PaTime now = Pa_GetStreamTime(context->stream);
+
+  timeInfo->currentTime = now;
+  timeInfo->inputBufferAdcTime = 0;
+  timeInfo->outputBufferDacTime = 0;
+
+  if (context->inputRing.buffer)
+    timeInfo->inputBufferAdcTime = now - context->inputLatency -
+      (_ringbuffer_read_available(&context->inputRing) +
+       context->framesPerBuffer) / context->sampleRate;
+
+  if (context->outputRing.buffer)
+    timeInfo->outputBufferDacTime = now + context->outputLatency +
+      _ringbuffer_read_available(&context->outputRing) /
+      context->sampleRate;
+}
+
+/* Reads a number or a sequence of channels numbers into values;
+   returns -1 with an exception set on failure. */
+static int
+_parse_graph_gains(PyObject *arg, float *values, int channels,
+		   const char *node)
+{
+  PyObject *seq;
+  int i;
+
+  if (PyNumber_Check(arg)) {
+    double gain = PyFloat_AsDouble(arg);
+    if (gain == -1.0 && PyErr_Occurred())
+      return -1;
+    for (i = 0; i < channels; i++)
+      values[i] = (float) gain;
+    return 0;
+  }
+
+  if (!PySequence_Check(arg)) {
+    PyErr_Format(PyExc_TypeError, "%s must be a number or a sequence",
+		 node);
+    return -1;
+  }
+
+  seq = PySequence_Fast(arg, "");
+  if (seq == NULL)
+    return -1;
+
+  if (PySequence_Fast_GET_SIZE(seq) != channels) {
+    Py_DECREF(seq);
+    PyErr_Format(PyExc_ValueError, "%s needs one value per channel",
+		 node);
+    return -1;
+  }
+
+  for (i = 0; i < channels; i++) {
+    values[i] = (float) PyFloat_AsDouble(PySequence_Fast_GET_ITEM(seq, i));
+    if (values[i] == -1.0f && PyErr_Occurred()) {
+      Py_DECREF(seq);
+      return -1;
+    }
+  }
+
+  Py_DECREF(seq);
+  return 0;
+}
+
+static int
+_add_graph_channel_map(_pyAudio_DspGraph *graph, PyObject *arg)
+{
+  PyObject *seq;
+  Py_ssize_t i, n;
+  int *map;
+  int err = -1;
+
+  seq = PySequence_Fast(arg, "channel_map must be a sequence");
+  if (seq == NULL)
+    return -1;
+
+  n = PySequence_Fast_GET_SIZE(seq);
+  if (n < 1 || n > INT_MAX) {
+    Py_DECREF(seq);
+    PyErr_SetString(PyExc_ValueError, "channel_map must not be empty");
+    return -1;
+  }
+
+  map = (int *) malloc(n * sizeof(int));
+  if (map == NULL) {
+    Py_DECREF(seq);
+    PyErr_NoMemory();
+    return -1;
+  }
+
+  for (i = 0; i < n; i++) {
+    long channel = PyLong_AsLong(PySequence_Fast_GET_ITEM(seq, i));
+    if (channel == -1 && PyErr_Occurred())
+      goto done;
+    if (channel < -1 || channel >= graph->outChannels) {
+      PyErr_SetString(PyExc_ValueError,
+		      "channel_map refers to a nonexistent channel");
+      goto done;
+    }
+    map[i] = (int) channel;
+  }
+
+  err = _dsp_graph_add_channel_map(graph, map, (int) n);
+  if (err < 0)
+    PyErr_NoMemory();
+
+ done:
+  free(map);
+  Py_DECREF(seq);
+  return err;
+}
+
+static int
+_add_graph_mix(_pyAudio_DspGraph *graph, PyObject *arg)
+{
+  int inChannels = graph->outChannels;
+  PyObject *rows;
+  Py_ssize_t i, n;
+  float *matrix;
+  int err = -1;
+
+  rows = PySequence_Fast(arg, "mix must be a sequence of rows");
+  if (rows == NULL)
+    return -1;
+
+  n = PySequence_Fast_GET_SIZE(rows);
+  if (n < 1 || n > INT_MAX) {
+    Py_DECREF(rows);
+    PyErr_SetString(PyExc_ValueError, "mix must not be empty");
+    return -1;
+  }
+
+  matrix = (float *) malloc(n * inChannels * sizeof(float));
+  if (matrix == NULL) {
+    Py_DECREF(rows);
+    PyErr_NoMemory();
+    return -1;
+  }
+
+  for (i = 0; i < n; i++) {
+    if (_parse_graph_gains(PySequence_Fast_GET_ITEM(rows, i),
+			   matrix + i * inChannels, inChannels,
+			   "mix row") < 0)
+      goto done;
+  }
+
+  err = _dsp_graph_add_mix(graph, matrix, (int) n);
+  if (err < 0)
+    PyErr_NoMemory();
+
+ done:
+  free(matrix);
+  Py_DECREF(rows);
+  return err;
+}
+
+/* Builds the processing graph described by nodes, a sequence of
+ * (name, argument) pairs as produced by pyaudio.ProcessingGraph, for
+ * input of the given channels and format. */
+static _pyAudio_DspGraph *
+_create_processing_graph(PyObject *nodes, int channels,
+			 PaSampleFormat format, unsigned long maxFrames)
+{
+  _pyAudio_DspGraph *graph;
+  PyObject *seq;
+  Py_ssize_t i, n;
+  float *gains;
+
+  seq = PySequence_Fast(nodes, "processing must be a sequence of nodes");
+  if (seq == NULL)
+    return NULL;
+
+  graph = _dsp_graph_new(channels, format, maxFrames);
+  if (graph == NULL) {
+    Py_DECREF(seq);
+    PyErr_NoMemory();
+    return NULL;
+  }
+
+  n = PySequence_Fast_GET_SIZE(seq);
+  for (i = 0; i < n; i++) {
+    const char *name;
+    PyObject *arg;
+    unsigned long nodeFormat;
+
+    if (!PyArg_ParseTuple(PySequence_Fast_GET_ITEM(seq, i),
+			  "sO;processing nodes are (name, argument) pairs",
+			  &name, &arg))
+      goto error;
+
+    if (strcmp(name, "gain") == 0) {
+      gains = (float *) malloc(graph->outChannels * sizeof(float));
+      if (gains == NULL) {
+	PyErr_NoMemory();
+	goto error;
+      }
+      if (_parse_graph_gains(arg, gains, graph->outChannels, "gain") < 0) {
+	free(gains);
+	goto error;
+      }
+      if (_dsp_graph_add_gain(graph, gains) < 0) {
+	free(gains);
+	PyErr_NoMemory();
+	goto error;
+      }
+      free(gains);
+    } else if (strcmp(name, "channel_map") == 0) {
+      if (_add_graph_channel_map(graph, arg) < 0)
+	goto error;
+    } else if (strcmp(name, "mix") == 0) {
+      if (_add_graph_mix(graph, arg) < 0)
+	goto error;
+    } else if (strcmp(name, "format") == 0) {
+      if (i != n - 1) {
+	PyErr_SetString(PyExc_ValueError,
+			"format must be the last processing node");
+	goto error;
+      }
+      nodeFormat = PyLong_AsUnsignedLong(arg);
+      if (nodeFormat == (unsigned long) -1 && PyErr_Occurred())
+	goto error;
+      if (nodeFormat != paFloat32 && nodeFormat != paInt32 &&
+	  nodeFormat != paInt24 && nodeFormat != paInt16 &&
+	  nodeFormat != paInt8 && nodeFormat != paUInt8) {
+	PyErr_SetString(PyExc_ValueError, "Invalid processing format");
+	goto error;
+      }
+      _dsp_graph_set_format(graph, (PaSampleFormat) nodeFormat);
+    } else {
+      PyErr_Format(PyExc_ValueError, "Unknown processing node '%s'", name);
+      goto error;
+    }
+  }
+
+  Py_DECREF(seq);
+
+  if (_dsp_graph_finish(graph) < 0) {
+    _dsp_graph_free(graph);
+    PyErr_NoMemory();
+    return NULL;
+  }
+
+  return graph;
+
+ error:
+  Py_DECREF(seq);
+  _dsp_graph_free(graph);
+  return NULL;
+}
+
+/* reads a suggested latency: None or "low" for the device's default
+   low latency, "high" for its default high latency, or a number of
+   seconds; returns -1 with an exception set otherwise */
+static int
+_parse_suggested_latency(PyObject *arg, const char *name, PaTime low,
+			 PaTime high, PaTime *latency)
+{
+  if (arg == NULL || arg == Py_None) {
+    *latency = low;
+    return 0;
+  }
+
+  if (PyUnicode_Check(arg)) {
+    if (PyUnicode_CompareWithASCIIString(arg, "low") == 0) {
+      *latency = low;
+      return 0;
+    }
+    if (PyUnicode_CompareWithASCIIString(arg, "high") == 0) {
+      *latency = high;
+      return 0;
+    }
+    PyErr_Format(PyExc_ValueError,
+		 "%s must be 'low', 'high' or a number of seconds", name);
+    return -1;
+  }
+
+  *latency = PyFloat_AsDouble(arg);
+  if (*latency == -1.0 && PyErr_Occurred()) {
+    PyErr_Clear();
+    PyErr_Format(PyExc_ValueError,
+		 "%s must be 'low', 'high' or a number of seconds", name);
+    return -1;
+  }
+
+  /* NaN fails the comparison */
+  if (!(*latency >= 0) || isinf(*latency)) {
+    PyErr_Format(PyExc_ValueError,
+		 "%s must be a finite number of seconds, not negative", name);
+    return -1;
+  }
+
+  return 0;
+}
+
+static PyObject *
+pa_open(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+  int rate, channels;
+  int input, output, frames_per_buffer;
+  int input_device_index = -1;
+  int output_device_index = -1;
+  PyObject *input_device_index_arg = NULL;
+  PyObject *output_device_index_arg = NULL;
+  PyObject *stream_callback = NULL;
+  int zero_copy_input = 0;
+  int zero_copy_output = 0;
+  int callback_thread = 0;
+  unsigned long ring_buffer_frames = 0;
+  int batch_periods = 1;
+  unsigned long callback_frames;
+  PyObject *processing = NULL;
+  PyObject *playback_file = NULL;
+  int file_fd = -1;
+  unsigned long long file_offset = 0;
+  unsigned long file_frames = 0;
+  int file_loop = 0;
+  PyObject *record_file = NULL;
+  PyObject *record_path = NULL;
+  int record_wav = 0;
+  unsigned long record_rotate_frames = 0;
+  unsigned long record_ring_frames = 0;
+  int non_interleaved = 0;
+  int metering = 0;
+  int notify = 0;
+  int mixer_voices = 0;
+  int device_rate = 0;
+  int resample_quality = RESAMPLE_QUALITY_MEDIUM;
+  int device_frames_per_buffer;
+  PyObject *input_latency = NULL;
+  PyObject *output_latency = NULL;
+  PaStreamFlags stream_flags = paClipOff;
+  PaSampleFormat format;
+  PaError err;
+
+#ifdef MACOSX
+  _pyAudio_MacOSX_hostApiSpecificStreamInfo *inputHostSpecificStreamInfo =
+      NULL;
+  _pyAudio_MacOSX_hostApiSpecificStreamInfo *outputHostSpecificStreamInfo =
+      NULL;
+#else
+  /* mostly ignored...*/
+  PyObject *inputHostSpecificStreamInfo = NULL;
+  PyObject *outputHostSpecificStreamInfo = NULL;
+#endif
+
+  /* default to neither output nor input */
+  input = 0;
+  output = 0;
+  frames_per_buffer = DEFAULT_FRAMES_PER_BUFFER;
+
+  /* pass in rate, channel, width */
+  static char *kwlist[] = {"rate",
+			   "channels",
+			   "format",
+			   "input",
+			   "output",
+			   "input_device_index",
+			   "output_device_index",
+			   "frames_per_buffer",
+			   "input_host_api_specific_stream_info",
+			   "output_host_api_specific_stream_info",
+			   "stream_callback",
+			   "zero_copy_input",
+			   "zero_copy_output",
+			   "callback_thread",
+			   "ring_buffer_frames",
+			   "batch_periods",
+			   "processing",
+			   "playback_file",
+			   "record_file",
+			   "non_interleaved",
+			   "notify",
+			   "metering",
+			   "mixer_voices",
+			   "device_rate",
+			   "resample_quality",
+			   "input_latency",
+			   "output_latency",
+			   "stream_flags",
+			   NULL};
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs,
+#ifdef MACOSX
+				   "iik|iiOOiO!O!OiiikiOOOiiiiiiOOk",
+#else
+				   "iik|iiOOiOOOiiikiOOOiiiiiiOOk",
+#endif
+				   kwlist,
+				   &rate, &channels, &format,
+				   &input, &output,
+				   &input_device_index_arg,
+				   &output_device_index_arg,
+				   &frames_per_buffer,
+#ifdef MACOSX
+				   _get_state(self)->macCoreStreamInfoType,
+#endif
+				   &inputHostSpecificStreamInfo,
+#ifdef MACOSX
+				   _get_state(self)->macCoreStreamInfoType,
+#endif
+				   &outputHostSpecificStreamInfo,
+				   &stream_callback,
+				   &zero_copy_input,
+				   &zero_copy_output,
+				   &callback_thread,
+				   &ring_buffer_frames,
+				   &batch_periods,
+				   &processing,
+				   &playback_file,
+				   &record_file,
+				   &non_interleaved,
+				   &notify,
+				   &metering,
+				   &mixer_voices,
+				   &device_rate,
+				   &resample_quality,
+				   &input_latency,
+				   &output_latency,
+				   &stream_flags))
+
+    return NULL;
+
+  if (stream_callback == Py_None)
+    stream_callback = NULL;
+
+  if (stream_callback && (PyCallable_Check(stream_callback) == 0)) {
+    PyErr_SetString(PyExc_TypeError, "stream_callback must be callable");
+    return NULL;
+  }
+
+  if ((zero_copy_input || zero_copy_output) && !stream_callback) {
+    PyErr_SetString(PyExc_ValueError,
+		    "zero_copy_input and zero_copy_output require "
+		    "a stream_callback");
+    return NULL;
+  }
+
+  if (processing == Py_None)
+    processing = NULL;
+
+  if (playback_file == Py_None)
+    playback_file = NULL;
+
+  if (playback_file) {
+    if (!PyArg_ParseTuple(playback_file, "iKki;playback_file must be a "
+			  "(fd, offset, frames, loop) tuple",
+			  &file_fd, &file_offset, &file_frames, &file_loop))
+      return NULL;
+
+    if (input || !output) {
+      PyErr_SetString(PyExc_ValueError,
+		      "playback_file requires an output-only stream");
+      return NULL;
+    }
+
+    if (file_frames == 0) {
+      PyErr_SetString(PyExc_ValueError, "playback_file has no frames");
+      return NULL;
+    }
+
+    if (stream_callback || processing || callback_thread ||
+	ring_buffer_frames || batch_periods != 1) {
+      PyErr_SetString(PyExc_ValueError,
+		      "playback_file cannot be combined with "
+		      "stream_callback or other callback options");
+      return NULL;
+    }
+  }
+
+  if (record_file == Py_None)
+    record_file = NULL;
+
+  if (record_file) {
+    if (!PyArg_ParseTuple(record_file, "Oikk;record_file must be a "
+			  "(path, wav, rotate_frames, ring_buffer_frames) "
+			  "tuple",
+			  &record_path, &record_wav,
+			  &record_rotate_frames, &record_ring_frames))
+      return NULL;
+
+    if (!input) {
+      PyErr_SetString(PyExc_ValueError,
+		      "record_file requires an input stream");
+      return NULL;
+    }
+
+    if (record_ring_frames == 0) {
+      PyErr_SetString(PyExc_ValueError,
+		      "record_file ring_buffer_frames must be positive");
+      return NULL;
+    }
+
+    /* otherwise the output would have to come from somewhere */
+    if (output && !stream_callback && !processing && !ring_buffer_frames) {
+      PyErr_SetString(PyExc_ValueError,
+		      "record_file on a duplex stream requires a "
+		      "stream_callback, processing or ring_buffer_frames");
+      return NULL;
+    }
+  }
+
+  if (processing) {
+    if (!input) {
+      PyErr_SetString(PyExc_ValueError,
+		      "processing requires an input stream");
+      return NULL;
+    }
+
+    if (frames_per_buffer <= 0) {
+      PyErr_SetString(PyExc_ValueError,
+		      "processing requires a fixed frames_per_buffer");
+      return NULL;
+    }
+
+    if (callback_thread || ring_buffer_frames || batch_periods != 1) {
+      PyErr_SetString(PyExc_ValueError,
+		      "processing cannot be combined with callback_thread, "
+		      "ring_buffer_frames or batch_periods");
+      return NULL;
+    }
+  }
+
+  if (batch_periods < 1) {
+    PyErr_SetString(PyExc_ValueError, "batch_periods must be at least 1");
+    return NULL;
+  }
+
+  /* the native modes all work on interleaved frames */
+  if (non_interleaved &&
+      (callback_thread || ring_buffer_frames || batch_periods != 1 ||
+       processing || playback_file || record_file)) {
+    PyErr_SetString(PyExc_ValueError,
+		    "non_interleaved cannot be combined with callback_thread, "
+		    "ring_buffer_frames, batch_periods, processing, "
+		    "playback_file or record_file");
+    return NULL;
+  }
+
+  if (batch_periods > 1) {
+    if (!stream_callback) {
+      PyErr_SetString(PyExc_ValueError,
+		      "batch_periods requires a stream_callback");
+      return NULL;
+    }
+
+    if (frames_per_buffer <= 0) {
+      PyErr_SetString(PyExc_ValueError,
+		      "batch_periods requires a fixed frames_per_buffer");
+      return NULL;
+    }
+  }
+
+  /* frames per Python callback */
+  callback_frames = (unsigned long) batch_periods * frames_per_buffer;
+
+  if (callback_thread) {
+    if (!stream_callback) {
+      PyErr_SetString(PyExc_ValueError,
+		      "callback_thread requires a stream_callback");
+      return NULL;
+    }
+
+    if (frames_per_buffer <= 0) {
+      PyErr_SetString(PyExc_ValueError,
+		      "callback_thread requires a fixed frames_per_buffer");
+      return NULL;
+    }
+
+    if (ring_buffer_frames == 0)
+      ring_buffer_frames = DEFAULT_RING_BUFFER_PERIODS * callback_frames;
+
+    if (ring_buffer_frames < 2 * callback_frames) {
+      PyErr_SetString(PyExc_ValueError,
+		      "ring_buffer_frames must hold at least two buffers");
+      return NULL;
+    }
+  } else if (ring_buffer_frames && stream_callback) {
+    PyErr_SetString(PyExc_ValueError,
+		    "ring_buffer_frames requires callback_thread "
+		    "when a stream_callback is given");
+    return NULL;
+  } else if (ring_buffer_frames && frames_per_buffer > 0 &&
+	     ring_buffer_frames < (unsigned long) frames_per_buffer) {
+    PyErr_SetString(PyExc_ValueError,
+		    "ring_buffer_frames must hold at least one buffer");
+    return NULL;
+  }
+
+  if (metering) {
+    if (!input) {
+      PyErr_SetString(PyExc_ValueError,
+		      "metering requires an input stream");
+      return NULL;
+    }
+
+    if (_dsp_sample_size(format) == 0) {
+      PyErr_SetString(PyExc_ValueError,
+		      "metering requires a standard sample format");
+      return NULL;
+    }
+
+    /* otherwise the output would have to come from somewhere */
+    if (output && !stream_callback && !processing && !ring_buffer_frames) {
+      PyErr_SetString(PyExc_ValueError,
+		      "metering on a duplex stream requires a "
+		      "stream_callback, processing or ring_buffer_frames");
+      return NULL;
+    }
+  }
+
+  if (device_rate == rate)
+    device_rate = 0;
+
+  if (device_rate < 0) {
+    PyErr_SetString(PyExc_ValueError, "device_rate must be positive");
+    return NULL;
+  }
+
+  /* the rings are where the two rates meet */
+  if (device_rate) {
+    if (!ring_buffer_frames) {
+      PyErr_SetString(PyExc_ValueError,
+		      "device_rate requires ring_buffer_frames or "
+		      "callback_thread");
+      return NULL;
+    }
+
+    if (_dsp_sample_size(format) == 0) {
+      PyErr_SetString(PyExc_ValueError,
+		      "device_rate requires a standard sample format");
+      return NULL;
+    }
+  }
+
+  /* frames_per_buffer is at the stream's rate, PortAudio's period at
+     the device's */
+  device_frames_per_buffer = frames_per_buffer;
+  if (device_rate && frames_per_buffer > 0) {
+    device_frames_per_buffer = (int)
+      (((long long) frames_per_buffer * device_rate + rate / 2) / rate);
+    if (device_frames_per_buffer < 1)
+      device_frames_per_buffer = 1;
+  }
+
+  if (mixer_voices < 0) {
+    PyErr_SetString(PyExc_ValueError, "mixer_voices must not be negative");
+    return NULL;
+  }
+
+  if (mixer_voices) {
+    if (input || !output) {
+      PyErr_SetString(PyExc_ValueError,
+		      "mixer_voices requires an output-only stream");
+      return NULL;
+    }
+
+    if (_dsp_sample_size(format) == 0) {
+      PyErr_SetString(PyExc_ValueError,
+		      "mixer_voices requires a standard sample format");
+      return NULL;
+    }
+
+    if (stream_callback || processing || callback_thread ||
+	ring_buffer_frames || batch_periods != 1 || playback_file ||
+	non_interleaved) {
+      PyErr_SetString(PyExc_ValueError,
+		      "mixer_voices cannot be combined with stream_callback, "
+		      "non_interleaved or other callback options");
+      return NULL;
+    }
+  }
+
+  if (notify && (!ring_buffer_frames || stream_callback)) {
+    PyErr_SetString(PyExc_ValueError,
+		    "notify requires ring_buffer_frames without a "
+		    "stream_callback");
+    return NULL;
+  }
+
+  /* check to see if device indices were specified */
+  if ((input_device_index_arg == NULL) ||
+      (input_device_index_arg == Py_None)) {
+
+#ifdef VERBOSE
+    printf("Using default input device\n");
+#endif
+
+    input_device_index = -1;
+
+  } else {
+
+    if (!PyLong_Check(input_device_index_arg)) {
+      PyErr_SetString(PyExc_ValueError,
+		      "input_device_index must be integer (or None)");
+      return NULL;
+    }
+
+    input_device_index = (int)PyLong_AsLong(input_device_index_arg);
+
+#ifdef VERBOSE
+    printf("Using input device index number: %d\n", input_device_index);
+#endif
+
+  }
+
+  if ((output_device_index_arg == NULL) ||
+      (output_device_index_arg == Py_None)) {
+
+#ifdef VERBOSE
+    printf("Using default output device\n");
+#endif
+
+    output_device_index = -1;
+
+  } else {
+
+    if (!PyLong_Check(output_device_index_arg)) {
+      PyErr_SetString(PyExc_ValueError,
+		      "output_device_index must be integer (or None)");
+      return NULL;
+    }
+
+    output_device_index = (int)PyLong_AsLong(output_device_index_arg);
+
+#ifdef VERBOSE
+    printf("Using output device index number: %d\n", output_device_index);
+#endif
+
+  }
+
+  /* sanity checks */
+  if (input == 0 && output == 0) {
+    PyErr_SetString(PyExc_ValueError, "Must specify either input or output");
+    return NULL;
+  }
+
+  if (zero_copy_output && !output) {
+    PyErr_SetString(PyExc_ValueError,
+		    "zero_copy_output requires an output stream");
+    return NULL;
+  }
+
+  if (channels < 1) {
+    PyErr_SetString(PyExc_ValueError, "Invalid audio channels");
+    return NULL;
+  }
+
+  PaStreamParameters *outputParameters = NULL;
+  PaStreamParameters *inputParameters = NULL;
+
+  if (output) {
+    outputParameters =
+      (PaStreamParameters *) malloc(sizeof(PaStreamParameters));
+
+
+    if (output_device_index < 0)
+      /* default output device */
+      outputParameters->device = Pa_GetDefaultOutputDevice();
+    else
+      outputParameters->device = output_device_index;
+
+    /* final check -- ensure that there is a default device */
+    if (outputParameters->device < 0 ||
+        outputParameters->device >= Pa_GetDeviceCount()) {
+      free(outputParameters);
+      PyErr_SetObject(PyExc_IOError,
+		      Py_BuildValue("(s,i)",
+				    "Invalid output device "
+				    "(no default output device)",
+				    paInvalidDevice));
+      return NULL;
+    }
+
+    outputParameters->channelCount = channels;
+    outputParameters->sampleFormat = format |
+      (non_interleaved ? paNonInterleaved : 0);
+    if (_parse_suggested_latency(output_latency, "output_latency",
+	  Pa_GetDeviceInfo(outputParameters->device)->defaultLowOutputLatency,
+	  Pa_GetDeviceInfo(outputParameters->device)->defaultHighOutputLatency,
+	  &outputParameters->suggestedLatency) < 0) {
+      free(outputParameters);
+      return NULL;
+    }
+    outputParameters->hostApiSpecificStreamInfo = NULL;
+
+#ifdef MACOSX
+    if (outputHostSpecificStreamInfo) {
+      outputParameters->hostApiSpecificStreamInfo =
+	outputHostSpecificStreamInfo->paMacCoreStreamInfo;
+    }
+#endif
+
+  }
+
+  if (input) {
+    inputParameters =
+      (PaStreamParameters *) malloc(sizeof(PaStreamParameters));
+
+    if (input_device_index < 0) {
+      /* default output device */
+      inputParameters->device = Pa_GetDefaultInputDevice();
+    } else {
+      inputParameters->device = input_device_index;
+    }
+
+    /* final check -- ensure that there is a default device */
+    if (inputParameters->device < 0) {
+      free(inputParameters);
+      PyErr_SetObject(PyExc_IOError,
+		      Py_BuildValue("(s,i)",
+				    "Invalid input device "
+				    "(no default output device)",
+				    paInvalidDevice));
+      return NULL;
+    }
+
+    inputParameters->channelCount = channels;
+    inputParameters->sampleFormat = format |
+      (non_interleaved ? paNonInterleaved : 0);
+    if (_parse_suggested_latency(input_latency, "input_latency",
+	  Pa_GetDeviceInfo(inputParameters->device)->defaultLowInputLatency,
+	  Pa_GetDeviceInfo(inputParameters->device)->defaultHighInputLatency,
+	  &inputParameters->suggestedLatency) < 0) {
+      free(inputParameters);
+      free(outputParameters);
+      return NULL;
+    }
+    inputParameters->hostApiSpecificStreamInfo = NULL;
+
+#ifdef MACOSX
+    if (inputHostSpecificStreamInfo) {
+      inputParameters->hostApiSpecificStreamInfo =
+	inputHostSpecificStreamInfo->paMacCoreStreamInfo;
+    }
+#endif
+
+  }
+
+  PaStream *stream = NULL;
+  PaStreamInfo *streamInfo = NULL;
+  PaStreamCallback *callback;
+  _pyAudio_StreamCallbackContext *context;
+
+  /* every stream has a context, if only for its xrun counters */
+  context = _create_callback_context(stream_callback,
+                                     Pa_GetSampleSize(format) * channels,
+                                     zero_copy_input,
+                                     zero_copy_output);
+  if (context == NULL) {
+    free(inputParameters);
+    free(outputParameters);
+    return NULL;
+  }
+
+  context->nonInterleaved = non_interleaved;
+  context->channels = channels;
+
+  if (notify) {
+    if (_notifier_init(&context->notifier) < 0) {
+      PyErr_SetFromErrno(PyExc_OSError);
+      _destroy_callback_context(context);
+      free(inputParameters);
+      free(outputParameters);
+      return NULL;
+    }
+    context->notify = 1;
+
+    /* a period, or a ring's share of one if PortAudio picks it */
+    context->notifyPeriodFrames = (callback_frames > 0) ?
+      callback_frames : ring_buffer_frames / DEFAULT_RING_BUFFER_PERIODS;
+    if (context->notifyPeriodFrames > ring_buffer_frames)
+      context->notifyPeriodFrames = ring_buffer_frames;
+    if (context->notifyPeriodFrames == 0)
+      context->notifyPeriodFrames = 1;
+    context->notifyReadFrames = input ? context->notifyPeriodFrames : 0;
+    context->notifyWriteFrames = output ? context->notifyPeriodFrames : 0;
+  }
+
+  if (metering) {
+    context->meter = _dsp_meter_new(channels, format);
+    if (context->meter == NULL) {
+      PyErr_NoMemory();
+      _destroy_callback_context(context);
+      free(inputParameters);
+      free(outputParameters);
+      return NULL;
+    }
+  }
+
+  if (device_rate &&
+      _init_callback_context_resample(context, input, output, format, rate,
+                                      device_rate, resample_quality) < 0) {
+    _destroy_callback_context(context);
+    free(inputParameters);
+    free(outputParameters);
+    return NULL;
+  }
+
+  if (mixer_voices &&
+      _init_callback_context_mixer(context, format, mixer_voices) < 0) {
+    _destroy_callback_context(context);
+    free(inputParameters);
+    free(outputParameters);
+    return NULL;
+  }
+
+  /* with callback_thread, the worker does the batching by running
+     the callback on batches of frames from the rings */
+  if ((ring_buffer_frames &&
+       _init_callback_context_rings(context, input, output,
+                                    callback_frames,
+                                    ring_buffer_frames) < 0) ||
+      (!callback_thread && batch_periods > 1 &&
+       _init_callback_context_batch(context, input, output,
+                                    callback_frames) < 0)) {
+    _destroy_callback_context(context);
+    free(inputParameters);
+    free(outputParameters);
+    return NULL;
+  }
+
+  if (playback_file) {
+    unsigned long long fileBytes =
+      (unsigned long long) file_frames * context->bytesPerFrame;
+
+    if (_mappedfile_open(&context->file, file_fd) < 0) {
+      PyErr_SetFromErrno(PyExc_IOError);
+      _destroy_callback_context(context);
+      free(inputParameters);
+      free(outputParameters);
+      return NULL;
+    }
+
+    if (file_offset > context->file.size ||
+        fileBytes > context->file.size - file_offset) {
+      PyErr_SetString(PyExc_ValueError,
+                      "playback_file frames extend past the end of the file");
+      _destroy_callback_context(context);
+      free(inputParameters);
+      free(outputParameters);
+      return NULL;
+    }
+
+    context->fileData = context->file.data + file_offset;
+    context->fileFrames = file_frames;
+    context->fileLoop = file_loop;
+    _mappedfile_prefetch(&context->file, file_offset, fileBytes);
+  }
+
+  if (processing) {
+    context->graph = _create_processing_graph(processing, channels, format,
+                                              frames_per_buffer);
+    if (context->graph == NULL) {
+      _destroy_callback_context(context);
+      free(inputParameters);
+      free(outputParameters);
+      return NULL;
+    }
+
+    context->inputBytesPerFrame = context->graph->outChannels *
+      Pa_GetSampleSize(context->graph->outFormat);
+
+    /* without a tap, the graph's result is the output */
+    if (!stream_callback &&
+        (!output || context->graph->outChannels != channels ||
+         context->graph->outFormat != format)) {
+      PyErr_SetString(PyExc_ValueError,
+                      "Without a stream_callback, processing must produce "
+                      "the stream's output channels and format");
+      _destroy_callback_context(context);
+      free(inputParameters);
+      free(outputParameters);
+      return NULL;
+    }
+  }
+
+  /* callback, if specified */
+  callback =
+    (playback_file) ? (_stream_file_callback) :
+    (mixer_voices) ? (_stream_mixer_callback) :
+    (processing) ? (_stream_graph_callback) :
+    (ring_buffer_frames) ? (_stream_ring_callback) :
+    (batch_periods > 1) ? (_stream_batch_callback) :
+    (stream_callback) ? (_stream_callback_cfunction) :
+    (record_file || metering) ? (_stream_monitor_callback) : (NULL);
+
+  Py_BEGIN_ALLOW_THREADS
+  _lock_portaudio();
+  err = Pa_OpenStream(&stream,
+		      /* input/output parameters */
+		      /* NULL values are ignored */
+		      inputParameters,
+		      outputParameters,
+		      /* Samples Per Second */
+		      device_rate ? device_rate : rate,
+		      /* allocate frames in the buffer */
+		      device_frames_per_buffer,
+		      /* paClipOff unless asked otherwise: we won't
+			 output out of range samples so don't bother
+			 clipping them */
+		      stream_flags,
+		      callback,
+		      /* callback userData */
+		      context);
+  _unlock_portaudio();
+  Py_END_ALLOW_THREADS
+
+  if (err != paNoError) {
+
+#ifdef VERBOSE
+    fprintf(stderr, "An error occured while using the portaudio stream\n");
+    fprintf(stderr, "Error number: %d\n", err);
+    fprintf(stderr, "Error message: %s\n", Pa_GetErrorText(err));
+#endif
+
+    _destroy_callback_context(context);
+    free(inputParameters);
+    free(outputParameters);
+
+    PyErr_SetObject(PyExc_IOError,
+		    Py_BuildValue("(s,i)",
+				  Pa_GetErrorText(err), err));
+    return NULL;
+  }
+
+  _pyAudio_Stream *streamObject = _create_Stream_object(self);
+  if (streamObject == NULL) {
+    Py_BEGIN_ALLOW_THREADS
+    _lock_portaudio();
+    Pa_CloseStream(stream);
+    _unlock_portaudio();
+    Py_END_ALLOW_THREADS
+    _destroy_callback_context(context);
+    free(inputParameters);
+    free(outputParameters);
+    return NULL;
+  }
+
+  /* from here on, _cleanup_Stream_object owns everything */
+  streamObject->stream = stream;
+  streamObject->inputParameters = inputParameters;
+  streamObject->outputParameters = outputParameters;
+  streamObject->callbackContext = context;
+  streamObject->is_open = 1;
+
+  streamInfo = (PaStreamInfo *) Pa_GetStreamInfo(stream);
+  if (!streamInfo) {
+    Py_DECREF(streamObject);
+    PyErr_SetObject(PyExc_IOError,
+		    Py_BuildValue("(s,i)",
+ 				  "Could not get stream information",
+				  paInternalError));
+    return NULL;
+  }
+
+  streamObject->streamInfo = streamInfo;
+
+  context->stream = stream;
+  context->sampleRate = streamInfo->sampleRate;
+  context->inputLatency = streamInfo->inputLatency;
+  context->outputLatency = streamInfo->outputLatency;
+
+  /* the rings and the worker run at the stream's rate, behind (or
+     ahead of) the device by the resamplers' delay as well */
+  if (device_rate) {
+    context->sampleRate = rate;
+    if (context->inputResampler)
+      context->inputLatency += _resampler_latency(context->inputResampler);
+    if (context->outputResampler)
+      context->outputLatency +=
+        _resampler_latency(context->outputResampler);
+  }
+
+  /* the stream has not been started, so the callbacks cannot see the
+     recorder yet */
+  if (record_file) {
+    PyObject *path_bytes;
+
+    if (!PyUnicode_FSConverter(record_path, &path_bytes)) {
+      Py_DECREF(streamObject);
+      return NULL;
+    }
+
+    context->recorder = _recorder_new(PyBytes_AS_STRING(path_bytes),
+                                      record_wav, record_rotate_frames,
+                                      format, channels,
+                                      device_rate ? device_rate : rate,
+                                      record_ring_frames);
+    Py_DECREF(path_bytes);
+
+    if (context->recorder == NULL) {
+      PyErr_SetFromErrnoWithFilenameObject(PyExc_IOError, record_path);
+      Py_DECREF(streamObject);
+      return NULL;
+    }
+
+    if (_recorder_start(context->recorder) < 0) {
+      PyErr_SetString(PyExc_OSError, "Could not start recorder thread");
+      Py_DECREF(streamObject);
+      return NULL;
+    }
+  }
+
+  return (PyObject *) streamObject;
+}
+
+static PyObject *
+pa_close(PyObject *self, PyObject *args)
+{
+  PyObject *stream_arg;
+  _pyAudio_Stream *streamObject;
+
+  if (!PyArg_ParseTuple(args, "O!", _get_state(self)->streamType,
+			&stream_arg))
+    return NULL;
+
+  streamObject = (_pyAudio_Stream *) stream_arg;
+
+  _cleanup_Stream_object(streamObject);
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject *
+pa_get_sample_size(PyObject *self, PyObject *args)
+{
+  PaSampleFormat format;
+  int size_in_bytes;
+
+  if (!PyArg_ParseTuple(args, "k", &format))
+    return NULL;
+
+  size_in_bytes = Pa_GetSampleSize(format);
+
+  if (size_in_bytes < 0) {
+    PyErr_SetObject(PyExc_ValueError,
+		    Py_BuildValue("(s,i)",
+				  Pa_GetErrorText(size_in_bytes),
+				  size_in_bytes));
+    return NULL;
+  }
+
+  return PyLong_FromLong(size_in_bytes);
+}
+
+
+static PyObject *
+pa_is_format_supported(PyObject *self, PyObject *args,
+		       PyObject *kwargs)
+{
+  /* pass in rate, channel, width */
+  static char *kwlist[] = {
+      "sample_rate",
+      "input_device",
+      "input_channels",
+      "input_format",
+      "output_device",
+      "output_channels",
+      "output_format",
+      NULL
+  };
+
+  int input_device, input_channels;
+  int output_device, output_channels;
+  float sample_rate;
+  PaStreamParameters inputParams;
+  PaStreamParameters outputParams;
+  PaSampleFormat input_format, output_format;
+  PaError error;
+
+  input_device = input_channels =
+    output_device = output_channels = -1;
+
+  input_format = output_format = -1;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "f|iikiik", kwlist,
+				   &sample_rate,
+				   &input_device,
+				   &input_channels,
+				   &input_format,
+				   &output_device,
+				   &output_channels,
+				   &output_format))
+    return NULL;
+
+  if (!(input_device < 0)) {
+    inputParams.device = input_device;
+    inputParams.channelCount = input_channels;
+    inputParams.sampleFormat = input_format;
+    inputParams.suggestedLatency = 0;
+    inputParams.hostApiSpecificStreamInfo = NULL;
+  }
+
+  if (!(output_device < 0)) {
+    outputParams.device = output_device;
+    outputParams.channelCount = output_channels;
+    outputParams.sampleFormat = output_format;
+    outputParams.suggestedLatency = 0;
+    outputParams.hostApiSpecificStreamInfo = NULL;
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  _lock_portaudio();
+  error = Pa_IsFormatSupported((input_device < 0) ? NULL : &inputParams,
+			       (output_device < 0) ? NULL : &outputParams,
+			       sample_rate);
+  _unlock_portaudio();
+  Py_END_ALLOW_THREADS
+
+  if (error == paFormatIsSupported) {
+    Py_INCREF(Py_True);
+    return Py_True;
+  } else {
+    PyErr_SetObject(PyExc_ValueError,
+		    Py_BuildValue("(s,i)",
+				  Pa_GetErrorText(error),
+				  error));
+    return NULL;
+  }
+}
+
+/*************************************************************
+ * Stream Start / Stop / Info
+ *************************************************************/
+
+static PyObject *
+pa_start_stream(PyObject *self, PyObject *args)
+{
+  int err;
+  PyObject *stream_arg;
+  _pyAudio_Stream *streamObject;
+
+  if (!PyArg_ParseTuple(args, "O!", _get_state(self)->streamType,
+			&stream_arg))
+    return NULL;
+
+  streamObject = (_pyAudio_Stream *) stream_arg;
+
+  if (!_is_open(streamObject)) {
+    PyErr_SetObject(PyExc_IOError,
+		    Py_BuildValue("(s,i)",
+				  "Stream closed",
+				  paBadStreamPtr));
+    return NULL;
+  }
+
+  PaStream *stream = streamObject->stream;
+
+  if ( ((err = Pa_StartStream(stream)) != paNoError) &&
+       (err != paStreamIsNotStopped)) {
+    _cleanup_Stream_object(streamObject);
+
+#ifdef VERBOSE
+    fprintf(stderr, "An error occured while using the portaudio stream\n");
+    fprintf(stderr, "Error number: %d\n", err);
+    fprintf(stderr, "Error message: %s\n", Pa_GetErrorText(err));
+#endif
+
+    PyErr_SetObject(PyExc_IOError,
+		    Py_BuildValue("(s,i)",
+				  Pa_GetErrorText(err),
+				  err));
+    return NULL;
+  }
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject *
+pa_stop_stream(PyObject *self, PyObject *args)
+{
+
+  int err;
+  PyObject *stream_arg;
+  _pyAudio_Stream *streamObject;
+
+  if (!PyArg_ParseTuple(args, "O!", _get_state(self)->streamType,
+			&stream_arg))
+    return NULL;
+
+  streamObject = (_pyAudio_Stream *) stream_arg;
+
+  if (!_is_open(streamObject)) {
+    PyErr_SetString(PyExc_IOError, "Stream not open");
+    return NULL;
+  }
+
+  PaStream *stream = streamObject->stream;
+
+  /* release the GIL: the stream callback may need it to finish */
+  Py_BEGIN_ALLOW_THREADS
+  err = Pa_StopStream(stream);
+  Py_END_ALLOW_THREADS
+
+  if ((err != paNoError) && (err != paStreamIsStopped)) {
+
+    _cleanup_Stream_object(streamObject);
+
+#ifdef VERBOSE
+    fprintf(stderr, "An error occured while using the portaudio stream\n");
+    fprintf(stderr, "Error number: %d\n", err);
+    fprintf(stderr, "Error message: %s\n", Pa_GetErrorText(err));
+#endif
+
+    PyErr_SetObject(PyExc_IOError,
+		    Py_BuildValue("(s,i)",
+				  Pa_GetErrorText(err),
+				  err));
+    return NULL;
+  }
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject *
+pa_abort_stream(PyObject *self, PyObject *args)
+{
+  int err;
+  PyObject *stream_arg;
+  _pyAudio_Stream *streamObject;
+
+  if (!PyArg_ParseTuple(args, "O!", _get_state(self)->streamType,
+			&stream_arg))
+    return NULL;
+
+  streamObject = (_pyAudio_Stream *) stream_arg;
+
+  if (!_is_open(streamObject)) {
+    PyErr_SetString(PyExc_IOError, "Stream not open");
+    return NULL;
+  }
+
+  PaStream *stream = streamObject->stream;
+
+  Py_BEGIN_ALLOW_THREADS
+  err = Pa_AbortStream(stream);
+  Py_END_ALLOW_THREADS
+
+  if ((err != paNoError) && (err != paStreamIsStopped)) {
+    _cleanup_Stream_object(streamObject);
+
+#ifdef VERBOSE
+    fprintf(stderr, "An error occured while using the portaudio stream\n");
+    fprintf(stderr, "Error number: %d\n", err);
+    fprintf(stderr, "Error message: %s\n", Pa_GetErrorText(err));
+#endif
+
+    PyErr_SetObject(PyExc_IOError,
+		    Py_BuildValue("(s,i)",
+				  Pa_GetErrorText(err),
+				  err));
+    return NULL;
+  }
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject *
+pa_is_stream_stopped(PyObject *self, PyObject *args)
+{
+  int err;
+  PyObject *stream_arg;
+  _pyAudio_Stream *streamObject;
+
+  if (!PyArg_ParseTuple(args, "O!", _get_state(self)->streamType,
+			&stream_arg))
+    return NULL;
+
+  streamObject = (_pyAudio_Stream *) stream_arg;
+
+  if (!_is_open(streamObject)) {
+    PyErr_SetObject(PyExc_IOError,
+		    Py_BuildValue("(s,i)",
+				  "Stream closed",
+				  paBadStreamPtr));
+    return NULL;
+  }
+
+  PaStream *stream = streamObject->stream;
+
+  if ((err = Pa_IsStreamStopped(stream)) < 0) {
+    _cleanup_Stream_object(streamObject);
+
+#ifdef VERBOSE
+    fprintf(stderr, "An error occured while using the portaudio stream\n");
+    fprintf(stderr, "Error number: %d\n", err);
+    fprintf(stderr, "Error message: %s\n", Pa_GetErrorText(err));
+#endif
+
+    PyErr_SetObject(PyExc_IOError,
+		    Py_BuildValue("(s,i)",
+				  Pa_GetErrorText(err),
+				  err));
+    return NULL;
+  }
+
+  if (err) {
+    Py_INCREF(Py_True);
+    return Py_True;
+  }
+
+  Py_INCREF(Py_False);
+  return Py_False;
+}
+
+static PyObject *
+pa_is_stream_active(PyObject *self, PyObject *args)
+{
+
+  int err;
+  PyObject *stream_arg;
+  _pyAudio_Stream *streamObject;
+
+  if (!PyArg_ParseTuple(args, "O!", _get_state(self)->streamType,
+			&stream_arg))
+    return NULL;
+
+  streamObject = (_pyAudio_Stream *) stream_arg;
+
+  if (!_is_open(streamObject)) {
+    PyErr_SetString(PyExc_IOError, "Stream not open");
+    return NULL;
+  }
+
+  PaStream *stream = streamObject->stream;
+
+  if ((err = Pa_IsStreamActive(stream)) < 0) {
+    _cleanup_Stream_object(streamObject);
+
+#ifdef VERBOSE
+    fprintf(stderr, "An error occured while using the portaudio stream\n");
+    fprintf(stderr, "Error number: %d\n", err);
+    fprintf(stderr, "Error message: %s\n", Pa_GetErrorText(err));
+#endif
+
+    PyErr_SetObject(PyExc_IOError,
+		    Py_BuildValue("(s,i)",
+				  Pa_GetErrorText(err),
+				  err));
+    return NULL;
+  }
+
+  if (err) {
+    Py_INCREF(Py_True);
+    return Py_True;
+  }
+
+  Py_INCREF(Py_False);
+  return Py_False;
+}
+
+static PyObject *
+pa_get_stream_time(PyObject *self, PyObject *args)
+{
+  double time;
+  PyObject *stream_arg;
+  _pyAudio_Stream *streamObject;
+
+  if (!PyArg_ParseTuple(args, "O!", _get_state(self)->streamType,
+			&stream_arg))
+    return NULL;
+
+  streamObject = (_pyAudio_Stream *) stream_arg;
+
+  if (!_is_open(streamObject)) {
+    PyErr_SetObject(PyExc_IOError,
+		    Py_BuildValue("(s,i)",
+				  "Stream closed",
+				  paBadStreamPtr));
+    return NULL;
+  }
+
+  PaStream *stream = streamObject->stream;
+
+  if ((time = Pa_GetStreamTime(stream)) == 0) {
+    _cleanup_Stream_object(streamObject);
+    PyErr_SetObject(PyExc_IOError,
+		    Py_BuildValue("(s,i)",
+				  "Internal Error",
+				  paInternalError));
+    return NULL;
+  }
+
+  return PyFloat_FromDouble(time);
+}
+
+static PyObject *
+pa_get_stream_cpu_load(PyObject *self, PyObject *args)
+{
+  PyObject *stream_arg;
+  _pyAudio_Stream *streamObject;
+
+  if (!PyArg_ParseTuple(args, "O!", _get_state(self)->streamType,
+			&stream_arg))
+    return NULL;
+
+  streamObject = (_pyAudio_Stream *) stream_arg;
+
+  if (!_is_open(streamObject)) {
+    PyErr_SetObject(PyExc_IOError,
+		    Py_BuildValue("(s,i)",
+				  "Stream closed",
+				  paBadStreamPtr));
+    return NULL;
+  }
+
+  PaStream *stream = streamObject->stream;
+  return PyFloat_FromDouble(Pa_GetStreamCpuLoad(stream));
+}
+
+/* the callback context of the stream in args, for the callback stats
+   functions below */
+static _pyAudio_StreamCallbackContext *
+_parse_callback_stream(PyObject *self, PyObject *args)
+{
+  PyObject *stream_arg;
+  _pyAudio_Stream *streamObject;
+
+  if (!PyArg_ParseTuple(args, "O!", _get_state(self)->streamType,
+			&stream_arg))
+    return NULL;
+
+  streamObject = (_pyAudio_Stream *) stream_arg;
+
+  if (!_is_open(streamObject)) {
+    PyErr_SetObject(PyExc_IOError,
+		    Py_BuildValue("(s,i)",
+				  "Stream closed",
+				  paBadStreamPtr));
+    return NULL;
+  }
+
+  if (streamObject->callbackContext->callback == NULL) {
+    PyErr_SetString(PyExc_ValueError, "Stream has no stream_callback");
+    return NULL;
+  }
+
+  return streamObject->callbackContext;
+}
+
+static PyObject *
+_callback_phase_stats_dict(_pyAudio_CallbackPhaseStats *phase)
+{
+  PyObject *histogram;
+  int i;
+
+  histogram = PyList_New(CALLBACK_STATS_BUCKETS);
+  if (histogram == NULL)
+    return NULL;
+
+  for (i = 0; i < CALLBACK_STATS_BUCKETS; i++) {
+    PyObject *count = PyLong_FromUnsignedLong(phase->histogram[i]);
+    if (count == NULL) {
+      Py_DECREF(histogram);
+      return NULL;
+    }
+    PyList_SET_ITEM(histogram, i, count);
+  }
+
+  return Py_BuildValue("{s:N,s:d,s:d}",
+		       "histogram", histogram,
+		       "sum", phase->totalNs * 1e-9,
+		       "max", phase->maxNs * 1e-9);
+}
+
+static PyObject *
+pa_get_stream_callback_stats(PyObject *self, PyObject *args)
+{
+  _pyAudio_StreamCallbackContext *context;
+  _pyAudio_CallbackStats *stats;
+  PyObject *limits;
+  PyObject *phases[CALLBACK_PHASES];
+  int i;
+
+  context = _parse_callback_stream(self, args);
+  if (context == NULL)
+    return NULL;
+
+  stats = &context->stats;
+
+  /* upper bounds of all but the last (open-ended) bucket */
+  limits = PyList_New(CALLBACK_STATS_BUCKETS - 1);
+  if (limits == NULL)
+    return NULL;
+
+  for (i = 0; i < CALLBACK_STATS_BUCKETS - 1; i++) {
+    PyObject *limit = PyFloat_FromDouble((double) (1UL << i) * 1e-6);
+    if (limit == NULL) {
+      Py_DECREF(limits);
+      return NULL;
+    }
+    PyList_SET_ITEM(limits, i, limit);
+  }
+
+  /* every N argument must be valid: Py_BuildValue consumes them all */
+  for (i = 0; i < CALLBACK_PHASES; i++) {
+    phases[i] = _callback_phase_stats_dict(&stats->phases[i]);
+    if (phases[i] == NULL) {
+      while (--i >= 0)
+	Py_DECREF(phases[i]);
+      Py_DECREF(limits);
+      return NULL;
+    }
+  }
+
+  return Py_BuildValue("{s:k,s:k,s:N,s:N,s:N,s:N}",
+		       "callbacks", stats->callbacks,
+		       "deadline_misses", stats->deadlineMisses,
+		       "bucket_limits", limits,
+		       "gil_wait", phases[CALLBACK_PHASE_GIL_WAIT],
+		       "callback", phases[CALLBACK_PHASE_CALLBACK],
+		       "total", phases[CALLBACK_PHASE_TOTAL]);
+}
+
+static PyObject *
+pa_reset_stream_callback_stats(PyObject *self, PyObject *args)
+{
+  _pyAudio_StreamCallbackContext *context;
+
+  context = _parse_callback_stream(self, args);
+  if (context == NULL)
+    return NULL;
+
+  memset(&context->stats, 0, sizeof(context->stats));
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+pa_get_stream_xrun_counts(PyObject *self, PyObject *args)
+{
+  PyObject *stream_arg;
+  _pyAudio_Stream *streamObject;
+  volatile unsigned long *counts;
+
+  if (!PyArg_ParseTuple(args, "O!", _get_state(self)->streamType,
+			&stream_arg))
+    return NULL;
+
+  streamObject = (_pyAudio_Stream *) stream_arg;
+
+  if (!_is_open(streamObject)) {
+    PyErr_SetObject(PyExc_IOError,
+		    Py_BuildValue("(s,i)",
+				  "Stream closed",
+				  paBadStreamPtr));
+    return NULL;
+  }
+
+  counts = streamObject->callbackContext->xrunCounts;
+
+  return Py_BuildValue("{s:k,s:k,s:k,s:k,s:k}",
+		       "input_underflow", PA_ATOMIC_LOAD(&counts[0]),
+		       "input_overflow", PA_ATOMIC_LOAD(&counts[1]),
+		       "output_underflow", PA_ATOMIC_LOAD(&counts[2]),
+		       "output_overflow", PA_ATOMIC_LOAD(&counts[3]),
+		       "priming_output", PA_ATOMIC_LOAD(&counts[4]));
+}
+
+static _pyAudio_StreamCallbackContext *
+_parse_playback_stream(PyObject *self, PyObject *args,
+		       unsigned long *frame)
+{
+  PyObject *stream_arg;
+  _pyAudio_Stream *streamObject;
+
+  if (frame ?
+      !PyArg_ParseTuple(args, "O!k", _get_state(self)->streamType,
+			&stream_arg, frame) :
+      !PyArg_ParseTuple(args, "O!", _get_state(self)->streamType,
+			&stream_arg))
+    return NULL;
+
+  streamObject = (_pyAudio_Stream *) stream_arg;
+
+  if (!_is_open(streamObject)) {
+    PyErr_SetObject(PyExc_IOError,
+		    Py_BuildValue("(s,i)",
+				  "Stream closed",
+				  paBadStreamPtr));
+    return NULL;
+  }
+
+  if (streamObject->callbackContext->fileData == NULL) {
+    PyErr_SetString(PyExc_ValueError, "Stream is not playing a file");
+    return NULL;
+  }
+
+  return streamObject->callbackContext;
+}
+
+static PyObject *
+pa_seek_stream_playback(PyObject *self, PyObject *args)
+{
+  _pyAudio_StreamCallbackContext *context;
+  unsigned long frame;
+
+  context = _parse_playback_stream(self, args, &frame);
+  if (context == NULL)
+    return NULL;
+
+  if (frame > context->fileFrames)
+    frame = context->fileFrames;
+
+  _mappedfile_prefetch(&context->file,
+		       (context->fileData - context->file.data) +
+		       (unsigned long long) frame * context->bytesPerFrame,
+		       (unsigned long long) (context->fileFrames - frame) *
+		       context->bytesPerFrame);
+  PA_ATOMIC_STORE(&context->filePosition, frame);
+
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+pa_get_stream_playback_position(PyObject *self, PyObject *args)
+{
+  _pyAudio_StreamCallbackContext *context;
+
+  context = _parse_playback_stream(self, args, NULL);
+  if (context == NULL)
+    return NULL;
+
+  return PyLong_FromUnsignedLong(PA_ATOMIC_LOAD(&context->filePosition));
+}
+
+static PyObject *
+pa_get_stream_recorder_stats(PyObject *self, PyObject *args)
+{
+  PyObject *stream_arg;
+  _pyAudio_Stream *streamObject;
+  _pyAudio_Recorder *rec;
+
+  if (!PyArg_ParseTuple(args, "O!", _get_state(self)->streamType,
+			&stream_arg))
+    return NULL;
+
+  streamObject = (_pyAudio_Stream *) stream_arg;
+
+  if (!_is_open(streamObject)) {
+    PyErr_SetObject(PyExc_IOError,
+		    Py_BuildValue("(s,i)",
+				  "Stream closed",
+				  paBadStreamPtr));
+    return NULL;
+  }
+
+  rec = streamObject->callbackContext->recorder;
+  if (rec == NULL) {
+    PyErr_SetString(PyExc_ValueError, "Stream is not recording");
+    return NULL;
+  }
+
+  return Py_BuildValue("{s:k,s:k,s:k,s:k,s:k}",
+		       "frames_written", PA_ATOMIC_LOAD(&rec->framesWritten),
+		       "frames_dropped", PA_ATOMIC_LOAD(&rec->framesDropped),
+		       "queued_frames",
+		       _ringbuffer_read_available(&rec->ring),
+		       "files", PA_ATOMIC_LOAD(&rec->files),
+		       "error", PA_ATOMIC_LOAD(&rec->error));
+}
+
+
+/*************************************************************
+ * Stream Read/Write
+ *************************************************************/
+
+/* Ring-buffered blocking streams (ring_buffer_frames without a
+ * stream_callback): read() and write() only copy to and from the rings
+ * fed by _stream_ring_callback, and wait for the device only when the
+ * ring is empty (read) or full (write). */
+
+/* how long to wait for the ring callback before checking that the
+   stream is still running, in seconds */
+#define RING_WAIT_INTERVAL 0.1
+
+/* how often timed reads and writes on other blocking streams poll for
+   frames, at most, in seconds */
+#define POLL_INTERVAL 0.005
+
+/* Timed reads and writes (a timeout of 0 or more seconds) transfer as
+ * much as they can until their deadline, then return what they have.
+ * A negative timeout means none, and gives a deadline of 0. */
+static unsigned long long
+_io_deadline(double timeout)
+{
+  if (timeout < 0)
+    return 0;
+
+  return _monotonic_ns() + (unsigned long long) (timeout * 1e9);
+}
+
+/* How long to wait for more frames, in seconds: interval, or less if
+ * the deadline comes sooner, or 0 once it has passed. */
+static double
+_io_wait_interval(unsigned long long deadline, double interval)
+{
+  unsigned long long now;
+
+  if (deadline == 0)
+    return interval;
+
+  now = _monotonic_ns();
+  if (now >= deadline)
+    return 0;
+
+  if ((deadline - now) / 1e9 < interval)
+    return (deadline - now) / 1e9;
+  return interval;
+}
+
+/* frames as a count for PortAudio and the rings, which use unsigned
+   long, which may be narrower than Py_ssize_t */
+static unsigned long
+_ulong_frames(Py_ssize_t frames)
+{
+  return (frames > LONG_MAX) ? LONG_MAX : (unsigned long) frames;
+}
+
+/* Waits, with the GIL released, until the ring callback has run, or
+ * for at most interval seconds. Returns 0, or -1 with an exception set
+ * if the stream is not running or was closed in the meantime (in
+ * which case context is no longer valid on return). */
+static int
+_wait_ring_stream(_pyAudio_Stream *streamObject,
+                  _pyAudio_StreamCallbackContext *context,
+                  _pyAudio_Semaphore *signal, double interval)
+{
+  if (Pa_IsStreamActive(streamObject->stream) != 1) {
+    PyErr_SetObject(PyExc_IOError,
+		    Py_BuildValue("(s,i)",
+				  Pa_GetErrorText(paStreamIsStopped),
+				  paStreamIsStopped));
+    return -1;
+  }
+
+  context->ringWaiters++;
+  Py_BEGIN_ALLOW_THREADS
+  _semaphore_wait(signal, interval);
+  Py_END_ALLOW_THREADS
+  context->ringWaiters--;
+
+  if (!_is_open(streamObject)) {
+    /* _cleanup_Stream_object is waiting for us to let go */
+    if (context->ringWaiters == 0)
+      _semaphore_post(&context->workerExited);
+
+    PyErr_SetObject(PyExc_IOError,
+		    Py_BuildValue("(s,i)",
+				  "Stream closed",
+				  paBadStreamPtr));
+    return -1;
+  }
+
+  return 0;
+}
+
+/* After read() or write() on a notify stream, clears the notifier
+ * unless a watermark is still reached. */
+static void
+_update_notify(_pyAudio_StreamCallbackContext *context)
+{
+  if (!context->notify)
+    return;
+
+  _notifier_clear(&context->notifier);
+  if (_notify_watermark_reached(context))
+    _notifier_signal(&context->notifier);
+}
+
+/* Queues frames frames, or as many as fit within timeout seconds (see
+ * _io_deadline). Returns the number of frames written, or -1 with an
+ * exception set. Either way, *queued is set to the number of frames
+ * queued: an underflow is raised after the data has been queued. */
+static Py_ssize_t
+_write_ring_stream(_pyAudio_Stream *streamObject, const char *data,
+                   Py_ssize_t frames, int should_throw_exception,
+                   double timeout, Py_ssize_t *queued)
+{
+  _pyAudio_StreamCallbackContext *context = streamObject->callbackContext;
+  unsigned long frameSize = context->bytesPerFrame;
+  unsigned long long deadline = _io_deadline(timeout);
+  Py_ssize_t written = 0;
+  unsigned long underflows;
+  double interval;
+
+  *queued = 0;
+
+  if (context->outputRing.buffer == NULL) {
+    PyErr_SetObject(PyExc_IOError,
+		    Py_BuildValue("(s,i)",
+				  Pa_GetErrorText(
+				    paCanNotWriteToAnInputOnlyStream),
+				  paCanNotWriteToAnInputOnlyStream));
+    return -1;
+  }
+
+  while (1) {
+    written += _ringbuffer_write(&context->outputRing,
+                                 data + (size_t) written * frameSize,
+                                 _ulong_frames(frames - written));
+    *queued = written;
+    if (written == frames)
+      break;
+
+    interval = _io_wait_interval(deadline, RING_WAIT_INTERVAL);
+    if (interval == 0)
+      break;
+
+    if (_wait_ring_stream(streamObject, context,
+                          &context->outputSignal, interval) < 0)
+      return -1;
+  }
+
+  _update_notify(context);
+
+  /* report underflows since the previous write, without closing the
+     stream: the data is queued regardless */
+  underflows = PA_ATOMIC_LOAD(&context->outputUnderflows);
+  if (underflows != context->reportedOutputUnderflows) {
+    context->reportedOutputUnderflows = underflows;
+
+    if (should_throw_exception) {
+      PyErr_SetObject(PyExc_IOError,
+		      Py_BuildValue("(s,i)",
+				    Pa_GetErrorText(paOutputUnderflowed),
+				    paOutputUnderflowed));
+      return -1;
+    }
+  }
+
+  return written;
+}
+
+/* Reads frames frames, or as many as arrive within timeout seconds
+ * (see _io_deadline). Returns the number of frames read, or -1 with an
+ * exception set. */
+static Py_ssize_t
+_read_ring_stream(_pyAudio_Stream *streamObject, char *buffer,
+                  Py_ssize_t frames, int should_throw_exception,
+                  double timeout)
+{
+  _pyAudio_StreamCallbackContext *context = streamObject->callbackContext;
+  unsigned long frameSize = context->bytesPerFrame;
+  unsigned long long deadline = _io_deadline(timeout);
+  Py_ssize_t read = 0;
+  unsigned long overflows;
+  double interval;
+
+  if (context->inputRing.buffer == NULL) {
+    PyErr_SetObject(PyExc_IOError,
+		    Py_BuildValue("(s,i)",
+				  Pa_GetErrorText(
+				    paCanNotReadFromAnOutputOnlyStream),
+				  paCanNotReadFromAnOutputOnlyStream));
+    return -1;
+  }
+
+  while (1) {
+    read += _ringbuffer_read(&context->inputRing,
+                             buffer + (size_t) read * frameSize,
+                             _ulong_frames(frames - read));
+    if (read == frames)
+      break;
+
+    interval = _io_wait_interval(deadline, RING_WAIT_INTERVAL);
+    if (interval == 0)
+      break;
+
+    if (_wait_ring_stream(streamObject, context,
+                          &context->inputSignal, interval) < 0)
+      return -1;
+  }
+
+  _update_notify(context);
+
+  /* report overflows since the previous read, like Pa_ReadStream:
+     the input dropped is lost either way */
+  overflows = PA_ATOMIC_LOAD(&context->inputOverflows);
+  if (overflows != context->reportedInputOverflows) {
+    context->reportedInputOverflows = overflows;
+
+    if (should_throw_exception) {
+      PyErr_SetObject(PyExc_IOError,
+		      Py_BuildValue("(s,i)",
+				    Pa_GetErrorText(paInputOverflowed),
+				    paInputOverflowed));
+      return -1;
+    }
+  }
+
+  return read;
+}
+
+/* whether read()/write() go through the rings */
+static int
+_is_ring_stream(_pyAudio_Stream *streamObject)
+{
+  return streamObject->callbackContext->ringBuffered &&
+    streamObject->callbackContext->callback == NULL;
+}
+
+/* non_interleaved: gets one buffer per channel from the sequence
+ * channels into views, an array of context->channels, using the given
+ * PyObject_GetBuffer flags. Sets *frames to the number of whole frames
+ * that the shortest buffer holds. Returns 0, or -1 with an exception
+ * set and no buffers held. */
+static int
+_get_channel_buffers(_pyAudio_StreamCallbackContext *context,
+                     PyObject *channels, Py_buffer *views, int flags,
+                     Py_ssize_t *frames)
+{
+  Py_ssize_t sampleSize = context->bytesPerFrame / context->channels;
+  PyObject *seq;
+  int c;
+
+  seq = PySequence_Fast(channels, "non_interleaved streams take a "
+                        "sequence of channel buffers");
+  if (seq == NULL)
+    return -1;
+
+  if (PySequence_Fast_GET_SIZE(seq) != context->channels) {
+    Py_DECREF(seq);
+    PyErr_SetString(PyExc_ValueError, "Expected one buffer per channel");
+    return -1;
+  }
+
+  *frames = PY_SSIZE_T_MAX;
+  for (c = 0; c < context->channels; c++) {
+    if (PyObject_GetBuffer(PySequence_Fast_GET_ITEM(seq, c), &views[c],
+                           flags) < 0) {
+      while (--c >= 0)
+        PyBuffer_Release(&views[c]);
+      Py_DECREF(seq);
+      return -1;
+    }
+
+    if (views[c].len / sampleSize < *frames)
+      *frames = views[c].len / sampleSize;
+  }
+
+  Py_DECREF(seq);
+  return 0;
+}
+
+/* Points *data at a C-contiguous copy of the contents of view: the
+ * buffer itself if it is contiguous, otherwise a gathered copy in
+ * *gathered, to be freed with PyMem_Free. Returns 0, or -1 with an
+ * exception set. */
+static int
+_contiguous_write_data(Py_buffer *view, char **data, char **gathered)
+{
+  *gathered = NULL;
+
+  if (PyBuffer_IsContiguous(view, 'C')) {
+    *data = (char *) view->buf;
+    return 0;
+  }
+
+  *gathered = (char *) PyMem_Malloc(view->len);
+  if (*gathered == NULL) {
+    PyErr_NoMemory();
+    return -1;
+  }
+
+  if (PyBuffer_ToContiguous(*gathered, view, view->len, 'C') < 0) {
+    PyMem_Free(*gathered);
+    *gathered = NULL;
+    return -1;
+  }
+
+  *data = *gathered;
+  return 0;
+}
+
+/* Reads (or writes, if output is set) *frames frames into (or from)
+ * buffers, which holds the data pointer, or one pointer per channel
+ * with non_interleaved, and is advanced past the frames transferred;
+ * *frames is decreased accordingly. With a timeout (see _io_deadline),
+ * only transfers what PortAudio can take without blocking, polling
+ * for more until the deadline. Does not touch any Python object, so
+ * may be called with the GIL released. Returns the first error other
+ * than an (already counted) overflow or underflow, or else the
+ * overflow or underflow if there was one. */
+static PaError
+_transfer_frames(_pyAudio_Stream *streamObject, char **buffers,
+                 Py_ssize_t *frames, double timeout, int output)
+{
+  _pyAudio_StreamCallbackContext *context = streamObject->callbackContext;
+  PaStream *stream = streamObject->stream;
+  int count = context->nonInterleaved ? context->channels : 1;
+  unsigned long stride = context->bytesPerFrame / count;
+  unsigned long long deadline = _io_deadline(timeout);
+  void *buffer = context->nonInterleaved ? (void *) buffers : buffers[0];
+  PaError xrun = output ? paOutputUnderflowed : paInputOverflowed;
+  PaError rv = paNoError;
+  PaError err;
+  unsigned long chunk;
+  signed long available;
+  double interval;
+  int c;
+
+  while (*frames > 0) {
+    chunk = _ulong_frames(*frames);
+
+    if (deadline) {
+      available = output ? Pa_GetStreamWriteAvailable(stream) :
+        Pa_GetStreamReadAvailable(stream);
+      if (available < 0)
+        return (PaError) available;
+
+      if (available == 0) {
+        /* until the frames could be there, but not so long that the
+           device's buffer overflows (or runs dry) meanwhile */
+        interval = _io_wait_interval(deadline, POLL_INTERVAL);
+        if (interval == 0)
+          break;
+        if (chunk / context->sampleRate < interval)
+          interval = chunk / context->sampleRate;
+        Pa_Sleep(interval < 0.001 ? 1 : (long) (interval * 1000));
+        continue;
+      }
+
+      if ((unsigned long) available < chunk)
+        chunk = (unsigned long) available;
+    }
+
+    err = output ? Pa_WriteStream(stream, buffer, chunk) :
+      Pa_ReadStream(stream, buffer, chunk);
+    if (err == xrun) {
+      /* the frames are transferred nonetheless */
+      _count_xruns(context, output ? paOutputUnderflow : paInputOverflow);
+      rv = err;
+    } else if (err != paNoError) {
+      return err;
     }
 
-    output_device_index = (int)PyLong_AsLong(output_device_index_arg);
+    if (!context->nonInterleaved)
+      buffer = buffers[0] += (size_t) chunk * stride;
+    else
+      for (c = 0; c < count; c++)
+        buffers[c] += (size_t) chunk * stride;
+    *frames -= chunk;
+  }
+
+  return rv;
+}
+
+/* Raises the IOError for a failed read or write. Both have always
+ * closed the stream on errors other than overflows and underflows. */
+static void
+_stream_io_error(_pyAudio_Stream *streamObject, PaError err)
+{
+  if (err == paInputOverflowed) {
+
+#ifdef VERBOSE
+    fprintf(stderr, "Input Overflow.\n");
+#endif
+
+  } else if (err == paOutputUnderflowed) {
+
+#ifdef VERBOSE
+    fprintf(stderr, "Output Underflow.\n");
+#endif
+
+  } else {
+    /* cleanup */
+    _cleanup_Stream_object(streamObject);
+
+#ifdef VERBOSE
+    fprintf(stderr, "An error occured while using the portaudio stream\n");
+    fprintf(stderr, "Error number: %d\n", err);
+    fprintf(stderr, "Error message: %s\n", Pa_GetErrorText(err));
+#endif
+  }
+
+  PyErr_SetObject(PyExc_IOError,
+		  Py_BuildValue("(s,i)",
+				Pa_GetErrorText(err),
+				err));
+}
+
+/* Adds a frames_written attribute to the exception being raised, so
+ * that the caller knows where a batch of writes stopped. */
+static void
+_set_frames_written(Py_ssize_t frames)
+{
+  PyObject *type, *value, *traceback;
+  PyObject *py_frames;
+
+  PyErr_Fetch(&type, &value, &traceback);
+  PyErr_NormalizeException(&type, &value, &traceback);
+
+  py_frames = PyLong_FromSsize_t(frames);
+  if (py_frames == NULL || value == NULL ||
+      PyObject_SetAttrString(value, "frames_written", py_frames) < 0)
+    PyErr_Clear();
+
+  Py_XDECREF(py_frames);
+  PyErr_Restore(type, value, traceback);
+}
+
+/* Writes frames frames from buffers (see _transfer_frames) with the
+ * GIL released. Returns the number of frames written, or -1 with an
+ * exception set. */
+static Py_ssize_t
+_write_stream(_pyAudio_Stream *streamObject, char **buffers,
+              Py_ssize_t total_frames, int should_throw_exception,
+              double timeout)
+{
+  Py_ssize_t remaining = total_frames;
+  PaError err;
+
+  Py_BEGIN_ALLOW_THREADS
+  err = _transfer_frames(streamObject, buffers, &remaining, timeout, 1);
+  Py_END_ALLOW_THREADS
+
+  if (err == paOutputUnderflowed && !should_throw_exception)
+    err = paNoError;
+
+  if (err != paNoError) {
+    _stream_io_error(streamObject, err);
+    _set_frames_written(total_frames - remaining);
+    return -1;
+  }
+
+  return total_frames - remaining;
+}
+
+/* write() on a non_interleaved stream, from a sequence of channel
+ * buffers. Returns the number of frames written, or -1 with an
+ * exception set. */
+static Py_ssize_t
+_write_channels(_pyAudio_Stream *streamObject, PyObject *channels,
+                Py_ssize_t total_frames, int should_throw_exception,
+                double timeout)
+{
+  _pyAudio_StreamCallbackContext *context = streamObject->callbackContext;
+  Py_ssize_t frames;
+  Py_buffer *views;
+  char **buffers;
+  char **gathered;
+  Py_ssize_t rv = -1;
+  int c;
+
+  views = PyMem_Calloc(context->channels, sizeof(Py_buffer));
+  buffers = PyMem_Calloc(context->channels, sizeof(char *));
+  gathered = PyMem_Calloc(context->channels, sizeof(char *));
+  if (views == NULL || buffers == NULL || gathered == NULL) {
+    PyErr_NoMemory();
+    goto done;
+  }
+
+  if (_get_channel_buffers(context, channels, views, PyBUF_FULL_RO,
+                           &frames) < 0)
+    goto done;
+
+  if (total_frames < 0) {
+    total_frames = frames;
+  } else if (total_frames > frames) {
+    PyErr_SetString(PyExc_ValueError, "Not enough data for num_frames");
+    goto release;
+  }
+
+  for (c = 0; c < context->channels; c++) {
+    if (_contiguous_write_data(&views[c], &buffers[c], &gathered[c]) < 0)
+      goto release;
+  }
+
+  rv = _write_stream(streamObject, buffers, total_frames,
+                     should_throw_exception, timeout);
+
+ release:
+  for (c = 0; c < context->channels; c++) {
+    PyMem_Free(gathered[c]);
+    PyBuffer_Release(&views[c]);
+  }
+
+ done:
+  PyMem_Free(views);
+  PyMem_Free(buffers);
+  PyMem_Free(gathered);
+  return rv;
+}
+
+static PyObject *
+pa_write_stream(PyObject *self, PyObject *args)
+{
+  PyObject *data_arg;
+  Py_buffer view;
+  char *data;
+  char *gathered;
+  Py_ssize_t total_frames = -1;
+  Py_ssize_t written, queued;
+  unsigned long frameSize;
+  int should_throw_exception = 0;
+  double timeout = -1.0;
 
-#ifdef VERBOSE
-    printf("Using output device index number: %d\n", output_device_index);
-#endif
+  PyObject *stream_arg;
+  _pyAudio_Stream *streamObject;
+
+  if (!PyArg_ParseTuple(args, "O!O|nid",
+			_get_state(self)->streamType,
+			&stream_arg,
+			&data_arg,
+			&total_frames,
+			&should_throw_exception,
+			&timeout))
+    return NULL;
+
+  streamObject = (_pyAudio_Stream *) stream_arg;
 
+  if (!_is_open(streamObject)) {
+    PyErr_SetObject(PyExc_IOError,
+		    Py_BuildValue("(s,i)",
+				  "Stream closed",
+				  paBadStreamPtr));
+    return NULL;
   }
 
-  /* sanity checks */
-  if (input == 0 && output == 0) {
-    PyErr_SetString(PyExc_ValueError, "Must specify either input or output");
+  if (streamObject->callbackContext->nonInterleaved) {
+    written = _write_channels(streamObject, data_arg, total_frames,
+                              should_throw_exception, timeout);
+    goto done;
+  }
+
+  /* any buffer, including strided ones such as a numpy channel
+     slice */
+  if (PyObject_GetBuffer(data_arg, &view, PyBUF_FULL_RO) < 0)
+    return NULL;
+
+  frameSize = streamObject->callbackContext->bytesPerFrame;
+
+  /* by default, write all whole frames in the buffer */
+  if (total_frames < 0) {
+    total_frames = view.len / frameSize;
+  } else if (total_frames > view.len / (Py_ssize_t) frameSize) {
+    PyBuffer_Release(&view);
+    PyErr_SetString(PyExc_ValueError, "Not enough data for num_frames");
     return NULL;
   }
 
-  if (channels < 1) {
-    PyErr_SetString(PyExc_ValueError, "Invalid audio channels");
+  if (_contiguous_write_data(&view, &data, &gathered) < 0) {
+    PyBuffer_Release(&view);
     return NULL;
   }
 
-  PaStreamParameters *outputParameters = NULL;
-  PaStreamParameters *inputParameters = NULL;
+  /* the buffer stays exported, and so cannot be resized, while the
+     GIL is released */
+  if (_is_ring_stream(streamObject)) {
+    written = _write_ring_stream(streamObject, data, total_frames,
+                                 should_throw_exception, timeout,
+                                 &queued);
+    if (written < 0)
+      _set_frames_written(queued);
+  } else
+    written = _write_stream(streamObject, &data, total_frames,
+                            should_throw_exception, timeout);
+
+  PyMem_Free(gathered);
+  PyBuffer_Release(&view);
+
+ done:
+  if (written < 0)
+    return NULL;
 
-  if (output) {
-    outputParameters =
-      (PaStreamParameters *) malloc(sizeof(PaStreamParameters));
+  /* only a timed write can be partial */
+  if (timeout < 0)
+    Py_RETURN_NONE;
 
+  return PyLong_FromSsize_t(written);
+}
 
-    if (output_device_index < 0)
-      /* default output device */
-      outputParameters->device = Pa_GetDefaultOutputDevice();
-    else
-      outputParameters->device = output_device_index;
+static PyObject *
+pa_write_stream_many(PyObject *self, PyObject *args)
+{
+  PyObject *buffers_arg;
+  PyObject *seq;
+  Py_buffer *views = NULL;
+  char **data = NULL;
+  char **gathered = NULL;
+  Py_ssize_t count, taken = 0, written = 0;
+  Py_ssize_t i, frames, queued;
+  unsigned long frameSize;
+  PaError err = paNoError;
+  PaError rv_err;
+  int should_throw_exception = 0;
 
-    /* final check -- ensure that there is a default device */
-    if (outputParameters->device < 0 ||
-        outputParameters->device >= Pa_GetDeviceCount()) {
-      free(outputParameters);
-      PyErr_SetObject(PyExc_IOError,
-		      Py_BuildValue("(s,i)",
-				    "Invalid output device "
-				    "(no default output device)",
-				    paInvalidDevice));
-      return NULL;
-    }
+  PyObject *stream_arg;
+  _pyAudio_Stream *streamObject;
+  PyObject *rv = NULL;
 
-    outputParameters->channelCount = channels;
-    outputParameters->sampleFormat = format;
-    outputParameters->suggestedLatency =
-      Pa_GetDeviceInfo(outputParameters->device)->defaultLowOutputLatency;
-    outputParameters->hostApiSpecificStreamInfo = NULL;
+  if (!PyArg_ParseTuple(args, "O!O|i",
+			_get_state(self)->streamType,
+			&stream_arg,
+			&buffers_arg,
+			&should_throw_exception))
+    return NULL;
 
-#ifdef MACOSX
-    if (outputHostSpecificStreamInfo) {
-      outputParameters->hostApiSpecificStreamInfo =
-	outputHostSpecificStreamInfo->paMacCoreStreamInfo;
-    }
-#endif
+  streamObject = (_pyAudio_Stream *) stream_arg;
 
+  if (!_is_open(streamObject)) {
+    PyErr_SetObject(PyExc_IOError,
+		    Py_BuildValue("(s,i)",
+				  "Stream closed",
+				  paBadStreamPtr));
+    return NULL;
   }
 
-  if (input) {
-    inputParameters =
-      (PaStreamParameters *) malloc(sizeof(PaStreamParameters));
+  if (streamObject->callbackContext->nonInterleaved) {
+    PyErr_SetString(PyExc_ValueError,
+		    "write_many does not support non_interleaved streams");
+    return NULL;
+  }
 
-    if (input_device_index < 0) {
-      /* default output device */
-      inputParameters->device = Pa_GetDefaultInputDevice();
-    } else {
-      inputParameters->device = input_device_index;
-    }
+  seq = PySequence_Fast(buffers_arg, "buffers must be iterable");
+  if (seq == NULL)
+    return NULL;
 
-    /* final check -- ensure that there is a default device */
-    if (inputParameters->device < 0) {
-      free(inputParameters);
-      PyErr_SetObject(PyExc_IOError,
-		      Py_BuildValue("(s,i)",
-				    "Invalid input device "
-				    "(no default output device)",
-				    paInvalidDevice));
-      return NULL;
-    }
+  count = PySequence_Fast_GET_SIZE(seq);
+  frameSize = streamObject->callbackContext->bytesPerFrame;
 
-    inputParameters->channelCount = channels;
-    inputParameters->sampleFormat = format;
-    inputParameters->suggestedLatency =
-      Pa_GetDeviceInfo(inputParameters->device)->defaultLowInputLatency;
-    inputParameters->hostApiSpecificStreamInfo = NULL;
+  views = PyMem_Calloc(count + 1, sizeof(Py_buffer));
+  data = PyMem_Calloc(count + 1, sizeof(char *));
+  gathered = PyMem_Calloc(count + 1, sizeof(char *));
+  if (views == NULL || data == NULL || gathered == NULL) {
+    PyErr_NoMemory();
+    goto done;
+  }
 
-#ifdef MACOSX
-    if (inputHostSpecificStreamInfo) {
-      inputParameters->hostApiSpecificStreamInfo =
-	inputHostSpecificStreamInfo->paMacCoreStreamInfo;
+  /* pin every buffer first, so that the GIL need only be released
+     once */
+  for (taken = 0; taken < count; taken++) {
+    if (PyObject_GetBuffer(PySequence_Fast_GET_ITEM(seq, taken),
+                           &views[taken], PyBUF_FULL_RO) < 0)
+      goto done;
+
+    /* a partial frame would shift every buffer after it */
+    if (views[taken].len % frameSize != 0) {
+      PyBuffer_Release(&views[taken]);
+      PyErr_SetString(PyExc_ValueError,
+		      "Buffer size is not a multiple of the frame size");
+      goto done;
     }
-#endif
 
+    if (_contiguous_write_data(&views[taken], &data[taken],
+                               &gathered[taken]) < 0) {
+      PyBuffer_Release(&views[taken]);
+      goto done;
+    }
   }
 
-  PaStream *stream = NULL;
-  PaStreamInfo *streamInfo = NULL;
-  PyObject *userData = NULL;
-  if (stream_callback) {
-      userData = Py_BuildValue("Oi",stream_callback,Pa_GetSampleSize(format)*channels);
-  }
-  Py_XINCREF(userData);
+  if (_is_ring_stream(streamObject)) {
+    for (i = 0; i < count; i++) {
+      frames = _write_ring_stream(streamObject, data[i],
+                                  views[i].len / frameSize,
+                                  should_throw_exception, -1.0, &queued);
+      if (frames < 0) {
+        _set_frames_written(written + queued);
+        goto done;
+      }
+      written += frames;
+    }
 
-  err = Pa_OpenStream(&stream,
-		      /* input/output parameters */
-		      /* NULL values are ignored */
-		      inputParameters,
-		      outputParameters,
-		      /* Samples Per Second */
-		      rate,
-		      /* allocate frames in the buffer */
-		      frames_per_buffer,
-		      /* we won't output out of range samples
-			 so don't bother clipping them */
-		      paClipOff,
-		      /* callback, if specified */
-		      (stream_callback)?(_stream_callback_cfunction):(NULL),
-		      /* callback userData, if applicable */
-		      (stream_callback)?(userData):(NULL));
+    rv = PyLong_FromSsize_t(written);
+    goto done;
+  }
 
-  if (err != paNoError) {
+  Py_BEGIN_ALLOW_THREADS
+  for (i = 0; i < count; i++) {
+    Py_ssize_t remaining = views[i].len / frameSize;
 
-#ifdef VERBOSE
-    fprintf(stderr, "An error occured while using the portaudio stream\n");
-    fprintf(stderr, "Error number: %d\n", err);
-    fprintf(stderr, "Error message: %s\n", Pa_GetErrorText(err));
-#endif
+    frames = remaining;
+    rv_err = _transfer_frames(streamObject, &data[i], &remaining, -1.0, 1);
+    written += frames - remaining;
 
-    PyErr_SetObject(PyExc_IOError,
-		    Py_BuildValue("(s,i)",
-				  Pa_GetErrorText(err), err));
-    return NULL;
+    if (rv_err != paNoError &&
+        (rv_err != paOutputUnderflowed || should_throw_exception)) {
+      err = rv_err;
+      break;
+    }
   }
+  Py_END_ALLOW_THREADS
 
-  streamInfo = (PaStreamInfo *) Pa_GetStreamInfo(stream);
-  if (!streamInfo) {
-    /* Pa_Terminate(); */
-    PyErr_SetObject(PyExc_IOError,
-		    Py_BuildValue("(s,i)",
- 				  "Could not get stream information",
-				  paInternalError));
-    return NULL;
+  if (err != paNoError) {
+    _stream_io_error(streamObject, err);
+    _set_frames_written(written);
+    goto done;
   }
 
-  _pyAudio_Stream *streamObject = _create_Stream_object();
-  streamObject->stream = stream;
-  streamObject->inputParameters = inputParameters;
-  streamObject->outputParameters = outputParameters;
-  streamObject->is_open = 1;
-  streamObject->streamInfo = streamInfo;
+  rv = PyLong_FromSsize_t(written);
 
-  return (PyObject *) streamObject;
+ done:
+  for (i = 0; i < taken; i++) {
+    PyMem_Free(gathered[i]);
+    PyBuffer_Release(&views[i]);
+  }
+
+  PyMem_Free(views);
+  PyMem_Free(data);
+  PyMem_Free(gathered);
+  Py_DECREF(seq);
+  return rv;
 }
 
-static PyObject *
-pa_close(PyObject *self, PyObject *args)
+/* Reads frames frames into buffers (see _transfer_frames), which must
+ * be large enough, with the GIL released, or as many as arrive within
+ * timeout seconds (see _io_deadline). Returns the number of frames
+ * read, or -1 with an exception set. */
+static Py_ssize_t
+_read_stream(_pyAudio_Stream *streamObject, char **buffers,
+             Py_ssize_t frames, int should_throw_exception, double timeout)
 {
-  PyObject *stream_arg;
-  _pyAudio_Stream *streamObject;
+  Py_ssize_t remaining = frames;
+  PaError err;
 
-  if (!PyArg_ParseTuple(args, "O!", &_pyAudio_StreamType, &stream_arg))
-    return NULL;
+  if (_is_ring_stream(streamObject))
+    return _read_ring_stream(streamObject, buffers[0], frames,
+                             should_throw_exception, timeout);
 
-  streamObject = (_pyAudio_Stream *) stream_arg;
+  Py_BEGIN_ALLOW_THREADS
+  err = _transfer_frames(streamObject, buffers, &remaining, timeout, 0);
+  Py_END_ALLOW_THREADS
 
-  _cleanup_Stream_object(streamObject);
+  /* the data read is valid nonetheless */
+  if (err == paInputOverflowed && !should_throw_exception)
+    err = paNoError;
 
-  Py_INCREF(Py_None);
-  return Py_None;
+  if (err != paNoError) {
+    _stream_io_error(streamObject, err);
+    return -1;
+  }
+
+  return frames - remaining;
 }
 
+/* read() on a non_interleaved stream; returns a list of one bytes
+ * object per channel */
 static PyObject *
-pa_get_sample_size(PyObject *self, PyObject *args)
+_read_channels(_pyAudio_Stream *streamObject, int total_frames,
+               int should_throw_exception, double timeout)
 {
-  PaSampleFormat format;
-  int size_in_bytes;
+  _pyAudio_StreamCallbackContext *context = streamObject->callbackContext;
+  unsigned long sampleSize = context->bytesPerFrame / context->channels;
+  Py_ssize_t frames;
+  PyObject *rv;
+  char **buffers;
+  int c;
 
-  if (!PyArg_ParseTuple(args, "k", &format))
-    return NULL;
+  rv = PyList_New(context->channels);
+  buffers = PyMem_Calloc(context->channels, sizeof(char *));
+  if (rv == NULL || buffers == NULL) {
+    Py_XDECREF(rv);
+    PyMem_Free(buffers);
+    return PyErr_NoMemory();
+  }
 
-  size_in_bytes = Pa_GetSampleSize(format);
+  for (c = 0; c < context->channels; c++) {
+    PyObject *channel = PyBytes_FromStringAndSize(
+      NULL, (Py_ssize_t) total_frames * sampleSize);
+    if (channel == NULL) {
+      Py_DECREF(rv);
+      PyMem_Free(buffers);
+      return NULL;
+    }
+    PyList_SET_ITEM(rv, c, channel);
+    buffers[c] = PyBytes_AS_STRING(channel);
+  }
 
-  if (size_in_bytes < 0) {
-    PyErr_SetObject(PyExc_ValueError,
-		    Py_BuildValue("(s,i)",
-				  Pa_GetErrorText(size_in_bytes),
-				  size_in_bytes));
+  frames = _read_stream(streamObject, buffers, total_frames,
+                        should_throw_exception, timeout);
+  PyMem_Free(buffers);
+
+  if (frames < 0) {
+    Py_DECREF(rv);
     return NULL;
   }
 
-  return PyLong_FromLong(size_in_bytes);
-}
+  /* a timed read may come up short */
+  for (c = 0; frames < total_frames && c < context->channels; c++) {
+    PyObject *channel = PyList_GET_ITEM(rv, c);
 
+    /* on failure, the channel is already freed */
+    if (_PyBytes_Resize(&channel, frames * sampleSize) < 0) {
+      PyList_SET_ITEM(rv, c, PyBytes_FromStringAndSize(NULL, 0));
+      Py_DECREF(rv);
+      return NULL;
+    }
+    PyList_SET_ITEM(rv, c, channel);
+  }
+
+  return rv;
+}
 
 static PyObject *
-pa_is_format_supported(PyObject *self, PyObject *args,
-		       PyObject *kwargs)
+pa_read_stream(PyObject *self, PyObject *args)
 {
-  /* pass in rate, channel, width */
-  static char *kwlist[] = {
-      "sample_rate",
-      "input_device",
-      "input_channels",
-      "input_format",
-      "output_device",
-      "output_channels",
-      "output_format",
-      NULL
-  };
-
-  int input_device, input_channels;
-  int output_device, output_channels;
-  float sample_rate;
-  PaStreamParameters inputParams;
-  PaStreamParameters outputParams;
-  PaSampleFormat input_format, output_format;
-  PaError error;
+  int total_frames;
+  char *sampleBlock;
+  Py_ssize_t num_bytes;
+  Py_ssize_t frames;
+  PyObject *rv;
+  int should_throw_exception = 1;
+  double timeout = -1.0;
 
-  input_device = input_channels =
-    output_device = output_channels = -1;
+  PyObject *stream_arg;
+  _pyAudio_Stream *streamObject;
 
-  input_format = output_format = -1;
+  if (!PyArg_ParseTuple(args, "O!i|id",
+			_get_state(self)->streamType,
+			&stream_arg,
+			&total_frames,
+			&should_throw_exception,
+			&timeout))
+    return NULL;
 
-  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "f|iikiik", kwlist,
-				   &sample_rate,
-				   &input_device,
-				   &input_channels,
-				   &input_format,
-				   &output_device,
-				   &output_channels,
-				   &output_format))
+  /* make sure value is positive! */
+  if (total_frames < 0) {
+    PyErr_SetString(PyExc_ValueError, "Invalid number of frames");
     return NULL;
+  }
 
-  if (!(input_device < 0)) {
-    inputParams.device = input_device;
-    inputParams.channelCount = input_channels;
-    inputParams.sampleFormat = input_format;
-    inputParams.suggestedLatency = 0;
-    inputParams.hostApiSpecificStreamInfo = NULL;
+  streamObject = (_pyAudio_Stream *) stream_arg;
+
+  if (!_is_open(streamObject)) {
+    PyErr_SetObject(PyExc_IOError,
+		    Py_BuildValue("(s,i)",
+				  "Stream closed",
+				  paBadStreamPtr));
+    return NULL;
   }
 
-  if (!(output_device < 0)) {
-    outputParams.device = output_device;
-    outputParams.channelCount = output_channels;
-    outputParams.sampleFormat = output_format;
-    outputParams.suggestedLatency = 0;
-    outputParams.hostApiSpecificStreamInfo = NULL;
-  }
+  if (streamObject->callbackContext->nonInterleaved)
+    return _read_channels(streamObject, total_frames,
+                          should_throw_exception, timeout);
 
-  error = Pa_IsFormatSupported((input_device < 0) ? NULL : &inputParams,
-			       (output_device < 0) ? NULL : &outputParams,
-			       sample_rate);
+  num_bytes = (Py_ssize_t) total_frames *
+    streamObject->callbackContext->bytesPerFrame;
 
-  if (error == paFormatIsSupported) {
-    Py_INCREF(Py_True);
-    return Py_True;
-  } else {
-    PyErr_SetObject(PyExc_ValueError,
+#ifdef VERBOSE
+  fprintf(stderr, "Allocating %zd bytes\n", num_bytes);
+#endif
+
+  rv = PyBytes_FromStringAndSize(NULL, num_bytes);
+  sampleBlock = PyBytes_AsString(rv);
+
+  if (sampleBlock == NULL) {
+    PyErr_SetObject(PyExc_IOError,
 		    Py_BuildValue("(s,i)",
-				  Pa_GetErrorText(error),
-				  error));
+				  "Out of memory",
+				  paInsufficientMemory));
+    return NULL;
+  }
+
+  frames = _read_stream(streamObject, &sampleBlock, total_frames,
+                        should_throw_exception, timeout);
+  if (frames < 0) {
+    /* free the string buffer */
+    Py_XDECREF(rv);
     return NULL;
   }
+
+  /* a timed read may come up short */
+  if (frames < total_frames &&
+      _PyBytes_Resize(&rv, frames *
+                      streamObject->callbackContext->bytesPerFrame) < 0)
+    return NULL;
+
+  return rv;
 }
 
-/*************************************************************
- * Stream Start / Stop / Info
- *************************************************************/
+/* read_into() on a non_interleaved stream, into a sequence of
+ * writable channel buffers */
+static PyObject *
+_read_channels_into(_pyAudio_Stream *streamObject, PyObject *channels,
+                    Py_ssize_t total_frames, int should_throw_exception,
+                    double timeout)
+{
+  _pyAudio_StreamCallbackContext *context = streamObject->callbackContext;
+  Py_ssize_t frames;
+  Py_buffer *views;
+  char **buffers;
+  PyObject *rv = NULL;
+  int c;
+
+  views = PyMem_Calloc(context->channels, sizeof(Py_buffer));
+  buffers = PyMem_Calloc(context->channels, sizeof(char *));
+  if (views == NULL || buffers == NULL) {
+    PyErr_NoMemory();
+    goto done;
+  }
+
+  if (_get_channel_buffers(context, channels, views,
+                           PyBUF_WRITABLE | PyBUF_C_CONTIGUOUS,
+                           &frames) < 0)
+    goto done;
+
+  /* by default, fill the shortest buffer */
+  if (total_frames < 0) {
+    total_frames = frames;
+  } else if (total_frames > frames) {
+    PyErr_SetString(PyExc_ValueError, "Buffer too small");
+    goto release;
+  }
+
+  for (c = 0; c < context->channels; c++)
+    buffers[c] = (char *) views[c].buf;
+
+  frames = _read_stream(streamObject, buffers, total_frames,
+                        should_throw_exception, timeout);
+  if (frames >= 0)
+    rv = PyLong_FromSsize_t(frames);
+
+ release:
+  for (c = 0; c < context->channels; c++)
+    PyBuffer_Release(&views[c]);
+
+ done:
+  PyMem_Free(views);
+  PyMem_Free(buffers);
+  return rv;
+}
 
 static PyObject *
-pa_start_stream(PyObject *self, PyObject *args)
+pa_read_stream_into(PyObject *self, PyObject *args)
 {
-  int err;
+  PyObject *buffer_arg;
+  Py_buffer view;
+  char *buffer;
+  Py_ssize_t total_frames = -1;
+  unsigned long frameSize;
+  int should_throw_exception = 1;
+  double timeout = -1.0;
+
   PyObject *stream_arg;
   _pyAudio_Stream *streamObject;
 
-  if (!PyArg_ParseTuple(args, "O!", &_pyAudio_StreamType, &stream_arg))
+  if (!PyArg_ParseTuple(args, "O!O|nid",
+			_get_state(self)->streamType,
+			&stream_arg,
+			&buffer_arg,
+			&total_frames,
+			&should_throw_exception,
+			&timeout))
     return NULL;
 
   streamObject = (_pyAudio_Stream *) stream_arg;
@@ -1999,119 +5979,225 @@ pa_start_stream(PyObject *self, PyObject *args)
     return NULL;
   }
 
-  PaStream *stream = streamObject->stream;
+  if (streamObject->callbackContext->nonInterleaved)
+    return _read_channels_into(streamObject, buffer_arg, total_frames,
+                               should_throw_exception, timeout);
 
-  if ( ((err = Pa_StartStream(stream)) != paNoError) &&
-       (err != paStreamIsNotStopped)) {
-    _cleanup_Stream_object(streamObject);
+  if (!PyArg_Parse(buffer_arg, "w*", &view))
+    return NULL;
 
-#ifdef VERBOSE
-    fprintf(stderr, "An error occured while using the portaudio stream\n");
-    fprintf(stderr, "Error number: %d\n", err);
-    fprintf(stderr, "Error message: %s\n", Pa_GetErrorText(err));
-#endif
+  frameSize = streamObject->callbackContext->bytesPerFrame;
 
-    PyErr_SetObject(PyExc_IOError,
-		    Py_BuildValue("(s,i)",
-				  Pa_GetErrorText(err),
-				  err));
+  /* by default, fill the whole buffer */
+  if (total_frames < 0) {
+    if (view.len % frameSize != 0) {
+      PyBuffer_Release(&view);
+      PyErr_SetString(PyExc_ValueError,
+		      "Buffer size is not a multiple of the frame size");
+      return NULL;
+    }
+    total_frames = view.len / frameSize;
+  } else if (total_frames > view.len / (Py_ssize_t) frameSize) {
+    PyBuffer_Release(&view);
+    PyErr_SetString(PyExc_ValueError, "Buffer too small");
     return NULL;
   }
 
-  Py_INCREF(Py_None);
-  return Py_None;
+  /* the buffer stays exported, and so cannot be resized, while the
+     GIL is released */
+  buffer = (char *) view.buf;
+  total_frames = _read_stream(streamObject, &buffer, total_frames,
+                              should_throw_exception, timeout);
+
+  PyBuffer_Release(&view);
+  if (total_frames < 0)
+    return NULL;
+
+  return PyLong_FromSsize_t(total_frames);
 }
 
 static PyObject *
-pa_stop_stream(PyObject *self, PyObject *args)
+pa_read_stream_array(PyObject *self, PyObject *args)
 {
+  Py_ssize_t total_frames;
+  Py_ssize_t frames;
+  int should_throw_exception = 1;
+  double timeout = -1.0;
+  _pyAudio_SampleBuffer *rv;
+  _pyAudio_StreamCallbackContext *context;
+  PaSampleFormat format;
+  char **buffers;
+  int planar, c;
 
-  int err;
   PyObject *stream_arg;
   _pyAudio_Stream *streamObject;
 
-  if (!PyArg_ParseTuple(args, "O!", &_pyAudio_StreamType, &stream_arg))
+  if (!PyArg_ParseTuple(args, "O!n|id",
+			_get_state(self)->streamType,
+			&stream_arg,
+			&total_frames,
+			&should_throw_exception,
+			&timeout))
+    return NULL;
+
+  if (total_frames < 0) {
+    PyErr_SetString(PyExc_ValueError, "Invalid number of frames");
     return NULL;
+  }
 
   streamObject = (_pyAudio_Stream *) stream_arg;
 
   if (!_is_open(streamObject)) {
-    PyErr_SetString(PyExc_IOError, "Stream not open");
+    PyErr_SetObject(PyExc_IOError,
+		    Py_BuildValue("(s,i)",
+				  "Stream closed",
+				  paBadStreamPtr));
     return NULL;
   }
 
-  PaStream *stream = streamObject->stream;
+  if (streamObject->inputParameters == NULL) {
+    PyErr_SetObject(PyExc_IOError,
+		    Py_BuildValue("(s,i)",
+				  Pa_GetErrorText(
+				    paCanNotReadFromAnOutputOnlyStream),
+				  paCanNotReadFromAnOutputOnlyStream));
+    return NULL;
+  }
 
-  if ( ((err = Pa_StopStream(stream)) != paNoError)  &&
-       (err != paStreamIsStopped)) {
+  format = streamObject->inputParameters->sampleFormat;
+  if (_sample_format_code(format) == NULL) {
+    PyErr_SetString(PyExc_ValueError,
+		    "Sample format has no buffer protocol equivalent");
+    return NULL;
+  }
 
-    _cleanup_Stream_object(streamObject);
+  context = streamObject->callbackContext;
+  planar = context->nonInterleaved;
 
-#ifdef VERBOSE
-    fprintf(stderr, "An error occured while using the portaudio stream\n");
-    fprintf(stderr, "Error number: %d\n", err);
-    fprintf(stderr, "Error message: %s\n", Pa_GetErrorText(err));
-#endif
+  rv = _create_SampleBuffer_object(self, format, context->channels,
+				   total_frames, planar);
+  if (rv == NULL)
+    return NULL;
 
-    PyErr_SetObject(PyExc_IOError,
-		    Py_BuildValue("(s,i)",
-				  Pa_GetErrorText(err),
-				  err));
+  buffers = PyMem_Calloc(context->channels, sizeof(char *));
+  if (buffers == NULL) {
+    Py_DECREF(rv);
+    return PyErr_NoMemory();
+  }
+
+  for (c = 0; c < context->channels; c++)
+    buffers[c] = rv->data + (planar ? c * rv->strides[1] : 0);
+
+  /* nothing can export rv while the GIL is released: it is not
+     visible to Python yet */
+  frames = _read_stream(streamObject, buffers, total_frames,
+                        should_throw_exception, timeout);
+  PyMem_Free(buffers);
+
+  if (frames < 0) {
+    Py_DECREF(rv);
     return NULL;
   }
 
-  Py_INCREF(Py_None);
-  return Py_None;
+  /* a timed read may come up short; close the gaps between planar
+     channels so that the buffer stays contiguous */
+  if (planar && frames < total_frames) {
+    for (c = 1; c < context->channels; c++)
+      memmove(rv->data + c * frames * rv->itemsize,
+	      rv->data + c * rv->strides[1],
+	      frames * rv->itemsize);
+    rv->strides[1] = frames * rv->itemsize;
+  }
+
+  rv->shape[0] = frames;
+  return (PyObject *) rv;
 }
 
 static PyObject *
-pa_abort_stream(PyObject *self, PyObject *args)
+pa_get_stream_write_available(PyObject *self, PyObject *args)
 {
-  int err;
+  signed long frames;
   PyObject *stream_arg;
   _pyAudio_Stream *streamObject;
 
-  if (!PyArg_ParseTuple(args, "O!", &_pyAudio_StreamType, &stream_arg))
+  if (!PyArg_ParseTuple(args, "O!", _get_state(self)->streamType,
+			&stream_arg))
     return NULL;
 
   streamObject = (_pyAudio_Stream *) stream_arg;
 
   if (!_is_open(streamObject)) {
-    PyErr_SetString(PyExc_IOError, "Stream not open");
+    PyErr_SetObject(PyExc_IOError,
+		    Py_BuildValue("(s,i)",
+				  "Stream closed",
+				  paBadStreamPtr));
     return NULL;
   }
 
+  if (_is_ring_stream(streamObject) &&
+      streamObject->callbackContext->outputRing.buffer)
+    return PyLong_FromUnsignedLong(_ringbuffer_write_available(
+      &streamObject->callbackContext->outputRing));
+
   PaStream *stream = streamObject->stream;
+  frames = Pa_GetStreamWriteAvailable(stream);
+  return PyLong_FromLong(frames);
+}
 
-  if ( ((err = Pa_AbortStream(stream)) != paNoError) &&
-       (err != paStreamIsStopped)) {
-    _cleanup_Stream_object(streamObject);
+static PyObject *
+pa_get_stream_read_available(PyObject *self, PyObject *args)
+{
+  signed long frames;
+  PyObject *stream_arg;
+  _pyAudio_Stream *streamObject;
 
-#ifdef VERBOSE
-    fprintf(stderr, "An error occured while using the portaudio stream\n");
-    fprintf(stderr, "Error number: %d\n", err);
-    fprintf(stderr, "Error message: %s\n", Pa_GetErrorText(err));
-#endif
+  if (!PyArg_ParseTuple(args, "O!", _get_state(self)->streamType,
+			&stream_arg))
+    return NULL;
+
+  streamObject = (_pyAudio_Stream *) stream_arg;
 
+  if (!_is_open(streamObject)) {
     PyErr_SetObject(PyExc_IOError,
 		    Py_BuildValue("(s,i)",
-				  Pa_GetErrorText(err),
-				  err));
+				  "Stream closed",
+				  paBadStreamPtr));
     return NULL;
   }
 
-  Py_INCREF(Py_None);
-  return Py_None;
+  if (_is_ring_stream(streamObject) &&
+      streamObject->callbackContext->inputRing.buffer)
+    return PyLong_FromUnsignedLong(_ringbuffer_read_available(
+      &streamObject->callbackContext->inputRing));
+
+  PaStream *stream = streamObject->stream;
+  frames = Pa_GetStreamReadAvailable(stream);
+  return PyLong_FromLong(frames);
 }
 
-static PyObject *
-pa_is_stream_stopped(PyObject *self, PyObject *args)
+static int
+_set_dict_item_ulong(PyObject *dict, const char *key, unsigned long value)
 {
+  PyObject *item = PyLong_FromUnsignedLong(value);
   int err;
+
+  if (item == NULL)
+    return -1;
+
+  err = PyDict_SetItemString(dict, key, item);
+  Py_DECREF(item);
+  return err;
+}
+
+/* the stream's notifier, or NULL with an exception set */
+static _pyAudio_Notifier *
+_parse_notify_stream(PyObject *self, PyObject *args)
+{
   PyObject *stream_arg;
   _pyAudio_Stream *streamObject;
 
-  if (!PyArg_ParseTuple(args, "O!", &_pyAudio_StreamType, &stream_arg))
+  if (!PyArg_ParseTuple(args, "O!", _get_state(self)->streamType,
+			&stream_arg))
     return NULL;
 
   streamObject = (_pyAudio_Stream *) stream_arg;
@@ -2124,86 +6210,179 @@ pa_is_stream_stopped(PyObject *self, PyObject *args)
     return NULL;
   }
 
-  PaStream *stream = streamObject->stream;
+  if (!streamObject->callbackContext->notify) {
+    PyErr_SetString(PyExc_ValueError, "Stream was not opened with notify");
+    return NULL;
+  }
 
-  if ((err = Pa_IsStreamStopped(stream)) < 0) {
-    _cleanup_Stream_object(streamObject);
+  return &streamObject->callbackContext->notifier;
+}
 
-#ifdef VERBOSE
-    fprintf(stderr, "An error occured while using the portaudio stream\n");
-    fprintf(stderr, "Error number: %d\n", err);
-    fprintf(stderr, "Error message: %s\n", Pa_GetErrorText(err));
-#endif
+static PyObject *
+pa_get_stream_notify_fd(PyObject *self, PyObject *args)
+{
+  _pyAudio_Notifier *notifier = _parse_notify_stream(self, args);
 
-    PyErr_SetObject(PyExc_IOError,
-		    Py_BuildValue("(s,i)",
-				  Pa_GetErrorText(err),
-				  err));
+  if (notifier == NULL)
     return NULL;
-  }
-
-  if (err) {
-    Py_INCREF(Py_True);
-    return Py_True;
-  }
 
-  Py_INCREF(Py_False);
-  return Py_False;
+  return PyLong_FromLong(notifier->readFd);
 }
 
 static PyObject *
-pa_is_stream_active(PyObject *self, PyObject *args)
+pa_clear_stream_notify(PyObject *self, PyObject *args)
 {
+  _pyAudio_Notifier *notifier = _parse_notify_stream(self, args);
 
-  int err;
+  if (notifier == NULL)
+    return NULL;
+
+  _notifier_clear(notifier);
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+pa_set_stream_notify_watermarks(PyObject *self, PyObject *args)
+{
   PyObject *stream_arg;
   _pyAudio_Stream *streamObject;
+  _pyAudio_StreamCallbackContext *context;
+  unsigned long read_frames, write_frames;
 
-  if (!PyArg_ParseTuple(args, "O!", &_pyAudio_StreamType, &stream_arg))
+  if (!PyArg_ParseTuple(args, "O!kk", _get_state(self)->streamType,
+			&stream_arg, &read_frames, &write_frames))
     return NULL;
 
   streamObject = (_pyAudio_Stream *) stream_arg;
 
   if (!_is_open(streamObject)) {
-    PyErr_SetString(PyExc_IOError, "Stream not open");
+    PyErr_SetObject(PyExc_IOError,
+		    Py_BuildValue("(s,i)",
+				  "Stream closed",
+				  paBadStreamPtr));
     return NULL;
   }
 
-  PaStream *stream = streamObject->stream;
+  context = streamObject->callbackContext;
+  if (!context->notify) {
+    PyErr_SetString(PyExc_ValueError, "Stream was not opened with notify");
+    return NULL;
+  }
 
-  if ((err = Pa_IsStreamActive(stream)) < 0) {
-    _cleanup_Stream_object(streamObject);
+  /* a watermark beyond the ring would never be reached */
+  if ((read_frames && (context->inputRing.buffer == NULL ||
+                       read_frames > context->inputRing.size)) ||
+      (write_frames && (context->outputRing.buffer == NULL ||
+                        write_frames > context->outputRing.size))) {
+    PyErr_SetString(PyExc_ValueError,
+		    "Watermark exceeds the ring buffer capacity");
+    return NULL;
+  }
 
-#ifdef VERBOSE
-    fprintf(stderr, "An error occured while using the portaudio stream\n");
-    fprintf(stderr, "Error number: %d\n", err);
-    fprintf(stderr, "Error message: %s\n", Pa_GetErrorText(err));
-#endif
+  /* neither: back to a period in each direction */
+  if (!read_frames && !write_frames) {
+    if (context->inputRing.buffer)
+      read_frames = context->notifyPeriodFrames;
+    if (context->outputRing.buffer)
+      write_frames = context->notifyPeriodFrames;
+  }
+
+  PA_ATOMIC_STORE(&context->notifyReadFrames, read_frames);
+  PA_ATOMIC_STORE(&context->notifyWriteFrames, write_frames);
+
+  /* bring the descriptor in line with the new watermarks right away */
+  _notifier_clear(&context->notifier);
+  if (_notify_watermark_reached(context))
+    _notifier_signal(&context->notifier);
+
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+pa_get_stream_levels(PyObject *self, PyObject *args)
+{
+  PyObject *stream_arg;
+  _pyAudio_Stream *streamObject;
+  _pyAudio_DspMeter *meter;
+  const _pyAudio_DspLevels *levels;
+  PyObject *peak, *rms, *clips;
+  int reset = 1;
+  int c;
+
+  if (!PyArg_ParseTuple(args, "O!|i", _get_state(self)->streamType,
+			&stream_arg, &reset))
+    return NULL;
+
+  streamObject = (_pyAudio_Stream *) stream_arg;
 
+  if (!_is_open(streamObject)) {
     PyErr_SetObject(PyExc_IOError,
 		    Py_BuildValue("(s,i)",
-				  Pa_GetErrorText(err),
-				  err));
+				  "Stream closed",
+				  paBadStreamPtr));
     return NULL;
   }
 
-  if (err) {
-    Py_INCREF(Py_True);
-    return Py_True;
+  meter = streamObject->callbackContext->meter;
+  if (meter == NULL) {
+    PyErr_SetString(PyExc_ValueError,
+		    "Stream was not opened with metering");
+    return NULL;
   }
 
-  Py_INCREF(Py_False);
-  return Py_False;
+  levels = _dsp_meter_read(meter, reset);
+
+  peak = PyList_New(meter->channels);
+  rms = PyList_New(meter->channels);
+  clips = PyList_New(meter->channels);
+  if (peak == NULL || rms == NULL || clips == NULL)
+    goto error;
+
+  for (c = 0; c < meter->channels; c++) {
+    PyObject *item;
+
+    item = PyFloat_FromDouble(levels->peak[c]);
+    if (item == NULL)
+      goto error;
+    PyList_SET_ITEM(peak, c, item);
+
+    item = PyFloat_FromDouble(levels->frames ?
+			      sqrt(levels->sumSquares[c] / levels->frames) :
+			      0.0);
+    if (item == NULL)
+      goto error;
+    PyList_SET_ITEM(rms, c, item);
+
+    item = PyLong_FromUnsignedLong(levels->clips[c]);
+    if (item == NULL)
+      goto error;
+    PyList_SET_ITEM(clips, c, item);
+  }
+
+  return Py_BuildValue("{s:k,s:N,s:N,s:N}",
+		       "frames", levels->frames,
+		       "peak", peak,
+		       "rms", rms,
+		       "clips", clips);
+
+ error:
+  Py_XDECREF(peak);
+  Py_XDECREF(rms);
+  Py_XDECREF(clips);
+  return NULL;
 }
 
 static PyObject *
-pa_get_stream_time(PyObject *self, PyObject *args)
+pa_get_stream_ring_buffer_stats(PyObject *self, PyObject *args)
 {
-  double time;
   PyObject *stream_arg;
   _pyAudio_Stream *streamObject;
+  _pyAudio_StreamCallbackContext *context;
+  _pyAudio_RingBuffer *ring;
+  PyObject *rv;
 
-  if (!PyArg_ParseTuple(args, "O!", &_pyAudio_StreamType, &stream_arg))
+  if (!PyArg_ParseTuple(args, "O!", _get_state(self)->streamType,
+			&stream_arg))
     return NULL;
 
   streamObject = (_pyAudio_Stream *) stream_arg;
@@ -2216,218 +6395,335 @@ pa_get_stream_time(PyObject *self, PyObject *args)
     return NULL;
   }
 
-  PaStream *stream = streamObject->stream;
+  context = streamObject->callbackContext;
+  if (!context->ringBuffered) {
+    PyErr_SetString(PyExc_ValueError, "Stream is not ring-buffered");
+    return NULL;
+  }
 
-  if ((time = Pa_GetStreamTime(stream)) == 0) {
-    _cleanup_Stream_object(streamObject);
+  ring = context->inputRing.buffer ? &context->inputRing :
+    &context->outputRing;
+  rv = Py_BuildValue("{s:k}", "capacity", ring->size);
+  if (rv == NULL)
+    return NULL;
+
+  if (context->inputRing.buffer) {
+    if (_set_dict_item_ulong(rv, "input_frames",
+			     _ringbuffer_read_available(
+			       &context->inputRing)) < 0 ||
+	_set_dict_item_ulong(rv, "input_overflows",
+			     PA_ATOMIC_LOAD(&context->inputOverflows)) < 0)
+      goto error;
+  }
+
+  if (context->outputRing.buffer) {
+    if (_set_dict_item_ulong(rv, "output_frames",
+			     _ringbuffer_read_available(
+			       &context->outputRing)) < 0 ||
+	_set_dict_item_ulong(rv, "output_underflows",
+			     PA_ATOMIC_LOAD(&context->outputUnderflows)) < 0)
+      goto error;
+  }
+
+  return rv;
+
+ error:
+  Py_DECREF(rv);
+  return NULL;
+}
+
+
+/*************************************************************
+ * Mixer Voices
+ *************************************************************/
+
+/* Gets the mixer of an open mixer_voices stream, or returns NULL with
+ * an exception set. */
+static _pyAudio_Mixer *
+_get_stream_mixer(_pyAudio_Stream *streamObject)
+{
+  if (!_is_open(streamObject)) {
     PyErr_SetObject(PyExc_IOError,
 		    Py_BuildValue("(s,i)",
-				  "Internal Error",
-				  paInternalError));
+				  "Stream closed",
+				  paBadStreamPtr));
     return NULL;
   }
 
-  return PyFloat_FromDouble(time);
+  if (streamObject->callbackContext->mixer == NULL) {
+    PyErr_SetString(PyExc_ValueError,
+		    "Stream was not opened with mixer_voices");
+    return NULL;
+  }
+
+  return streamObject->callbackContext->mixer;
 }
 
 static PyObject *
-pa_get_stream_cpu_load(PyObject *self, PyObject *args)
+pa_add_stream_voice(PyObject *self, PyObject *args)
 {
   PyObject *stream_arg;
-  _pyAudio_Stream *streamObject;
+  _pyAudio_Mixer *mixer;
+  unsigned long queue_frames;
+  float gain = 1.0f;
+  int slot;
 
-  if (!PyArg_ParseTuple(args, "O!", &_pyAudio_StreamType, &stream_arg))
+  if (!PyArg_ParseTuple(args, "O!k|f", _get_state(self)->streamType,
+			&stream_arg, &queue_frames, &gain))
     return NULL;
 
-  streamObject = (_pyAudio_Stream *) stream_arg;
+  mixer = _get_stream_mixer((_pyAudio_Stream *) stream_arg);
+  if (mixer == NULL)
+    return NULL;
 
-  if (!_is_open(streamObject)) {
-    PyErr_SetObject(PyExc_IOError,
-		    Py_BuildValue("(s,i)",
-				  "Stream closed",
-				  paBadStreamPtr));
+  if (queue_frames == 0 || queue_frames > LONG_MAX) {
+    PyErr_SetString(PyExc_ValueError, "Invalid voice buffer size");
     return NULL;
   }
 
-  PaStream *stream = streamObject->stream;
-  return PyFloat_FromDouble(Pa_GetStreamCpuLoad(stream));
-}
+  slot = _mixer_add_voice(mixer, queue_frames, gain);
+  if (slot < 0) {
+    if (errno == ENOMEM)
+      return PyErr_NoMemory();
 
+    PyErr_SetString(PyExc_RuntimeError, "All mixer voices are in use");
+    return NULL;
+  }
 
-/*************************************************************
- * Stream Read/Write
- *************************************************************/
+  return Py_BuildValue("(ik)", slot, mixer->voices[slot].generation);
+}
 
+/* Queues the frames in buffer for a voice, or as many as fit within
+ * timeout seconds (see _io_deadline). Stops early if the voice is
+ * removed in the meantime. Returns the number of frames queued. */
 static PyObject *
-pa_write_stream(PyObject *self, PyObject *args)
+pa_write_stream_voice(PyObject *self, PyObject *args)
 {
-  const char *data;
-  int total_size;
-  int total_frames;
-  int err;
-  int should_throw_exception = 0;
-
   PyObject *stream_arg;
   _pyAudio_Stream *streamObject;
-
-  if (!PyArg_ParseTuple(args, "O!s#i|i",
-			&_pyAudio_StreamType,
-			&stream_arg,
-			&data,
-			&total_size,
-			&total_frames,
-			&should_throw_exception))
+  _pyAudio_StreamCallbackContext *context;
+  _pyAudio_Mixer *mixer;
+  int slot;
+  unsigned long generation;
+  Py_buffer view;
+  double timeout = -1.0;
+  unsigned long long deadline;
+  Py_ssize_t frames, written = 0;
+  double interval;
+
+  if (!PyArg_ParseTuple(args, "O!iky*|d", _get_state(self)->streamType,
+			&stream_arg, &slot, &generation, &view, &timeout))
     return NULL;
 
-  /* make sure total frames is larger than 0 */
-  if (total_frames < 0) {
-    PyErr_SetString(PyExc_ValueError,
-		    "Invalid number of frames");
+  streamObject = (_pyAudio_Stream *) stream_arg;
+  mixer = _get_stream_mixer(streamObject);
+  if (mixer == NULL) {
+    PyBuffer_Release(&view);
     return NULL;
   }
 
-  streamObject = (_pyAudio_Stream *) stream_arg;
+  context = streamObject->callbackContext;
 
-  if (!_is_open(streamObject)) {
-    PyErr_SetObject(PyExc_IOError,
-		    Py_BuildValue("(s,i)",
-				  "Stream closed",
-				  paBadStreamPtr));
+  if (_mixer_voice_state(mixer, slot, generation) != MIXER_VOICE_PLAYING) {
+    PyBuffer_Release(&view);
+    PyErr_SetString(PyExc_ValueError, "Voice is closed");
     return NULL;
   }
 
-  PaStream *stream = streamObject->stream;
+  if (view.len % mixer->frameSize != 0) {
+    PyBuffer_Release(&view);
+    PyErr_SetString(PyExc_ValueError,
+		    "Buffer size is not a multiple of the frame size");
+    return NULL;
+  }
 
-  Py_BEGIN_ALLOW_THREADS
-  err = Pa_WriteStream(stream, data, total_frames);
-  Py_END_ALLOW_THREADS
+  frames = view.len / mixer->frameSize;
+  deadline = _io_deadline(timeout);
 
-  if (err != paNoError) {
-    if (err == paOutputUnderflowed) {
-      if (should_throw_exception)
-	goto error;
-    } else
-      goto error;
-  }
+  while (1) {
+    written += _mixer_write_voice(mixer, slot,
+                                  (const char *) view.buf +
+                                  (size_t) written * mixer->frameSize,
+                                  _ulong_frames(frames - written));
+    if (written == frames)
+      break;
 
-  Py_INCREF(Py_None);
-  return Py_None;
+    interval = _io_wait_interval(deadline, RING_WAIT_INTERVAL);
+    if (interval == 0)
+      break;
 
- error:
-  /* cleanup */
-  _cleanup_Stream_object(streamObject);
+    if (_wait_ring_stream(streamObject, context, &context->outputSignal,
+                          interval) < 0) {
+      PyBuffer_Release(&view);
+      return NULL;
+    }
 
-#ifdef VERBOSE
-  fprintf(stderr, "An error occured while using the portaudio stream\n");
-  fprintf(stderr, "Error number: %d\n", err);
-  fprintf(stderr, "Error message: %s\n", Pa_GetErrorText(err));
-#endif
+    if (_mixer_voice_state(mixer, slot, generation) != MIXER_VOICE_PLAYING)
+      break;
+  }
 
-  PyErr_SetObject(PyExc_IOError,
-		  Py_BuildValue("(s,i)",
-				Pa_GetErrorText(err),
-				err));
-  return NULL;
+  PyBuffer_Release(&view);
+  return PyLong_FromSsize_t(written);
 }
 
 static PyObject *
-pa_read_stream(PyObject *self, PyObject *args)
+pa_set_stream_voice_gain(PyObject *self, PyObject *args)
 {
-  int err;
-  int total_frames;
-  short *sampleBlock;
-  int num_bytes;
-  PyObject *rv;
-
   PyObject *stream_arg;
-  _pyAudio_Stream *streamObject;
+  _pyAudio_Mixer *mixer;
+  int slot;
+  unsigned long generation;
+  float gain;
 
-  if (!PyArg_ParseTuple(args, "O!i",
-			&_pyAudio_StreamType,
-			&stream_arg,
-			&total_frames))
+  if (!PyArg_ParseTuple(args, "O!ikf", _get_state(self)->streamType,
+			&stream_arg, &slot, &generation, &gain))
     return NULL;
 
-  /* make sure value is positive! */
-  if (total_frames < 0) {
-    PyErr_SetString(PyExc_ValueError, "Invalid number of frames");
+  mixer = _get_stream_mixer((_pyAudio_Stream *) stream_arg);
+  if (mixer == NULL)
     return NULL;
-  }
 
-  streamObject = (_pyAudio_Stream *) stream_arg;
+  if (_mixer_voice_state(mixer, slot, generation) != MIXER_VOICE_FREE)
+    _mixer_set_gain(mixer, slot, gain);
 
-  if (!_is_open(streamObject)) {
-    PyErr_SetObject(PyExc_IOError,
-		    Py_BuildValue("(s,i)",
-				  "Stream closed",
-				  paBadStreamPtr));
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+pa_remove_stream_voice(PyObject *self, PyObject *args)
+{
+  PyObject *stream_arg;
+  _pyAudio_Mixer *mixer;
+  int slot;
+  unsigned long generation;
+  int drain = 0;
+
+  if (!PyArg_ParseTuple(args, "O!ik|i", _get_state(self)->streamType,
+			&stream_arg, &slot, &generation, &drain))
     return NULL;
-  }
 
-  PaStream *stream = streamObject->stream;
-  PaStreamParameters *inputParameters = streamObject->inputParameters;
-  num_bytes = (total_frames) * (inputParameters->channelCount) *
-    (Pa_GetSampleSize(inputParameters->sampleFormat));
+  mixer = _get_stream_mixer((_pyAudio_Stream *) stream_arg);
+  if (mixer == NULL)
+    return NULL;
 
-#ifdef VERBOSE
-  fprintf(stderr, "Allocating %d bytes\n", num_bytes);
-#endif
+  if (_mixer_voice_state(mixer, slot, generation) != MIXER_VOICE_FREE)
+    _mixer_remove_voice(mixer, slot, drain);
 
-  rv = PyBytes_FromStringAndSize(NULL, num_bytes);
-  sampleBlock = (short *) PyBytes_AsString(rv);
+  Py_RETURN_NONE;
+}
 
-  if (sampleBlock == NULL) {
-    PyErr_SetObject(PyExc_IOError,
-		    Py_BuildValue("(s,i)",
-				  "Out of memory",
-				  paInsufficientMemory));
+static PyObject *
+pa_get_stream_voice_info(PyObject *self, PyObject *args)
+{
+  PyObject *stream_arg;
+  _pyAudio_Mixer *mixer;
+  int slot;
+  unsigned long generation;
+  unsigned long state;
+  unsigned long queued = 0;
+  int active;
+
+  if (!PyArg_ParseTuple(args, "O!ik", _get_state(self)->streamType,
+			&stream_arg, &slot, &generation))
     return NULL;
-  }
 
-  Py_BEGIN_ALLOW_THREADS
-  err = Pa_ReadStream(stream, sampleBlock, total_frames);
-  Py_END_ALLOW_THREADS
+  mixer = _get_stream_mixer((_pyAudio_Stream *) stream_arg);
+  if (mixer == NULL)
+    return NULL;
 
-  if (err != paNoError) {
+  state = _mixer_voice_state(mixer, slot, generation);
+  active = (state == MIXER_VOICE_PLAYING || state == MIXER_VOICE_DRAINING);
+  if (active)
+    queued = _mixer_voice_queued(mixer, slot);
 
-    /* ignore input overflow and output underflow */
-    if (err & paInputOverflowed) {
+  return Py_BuildValue("{s:O,s:k}",
+		       "active", active ? Py_True : Py_False,
+		       "queued_frames", queued);
+}
 
-#ifdef VERBOSE
-      fprintf(stderr, "Input Overflow.\n");
-#endif
 
-    } else if (err & paOutputUnderflowed) {
+/*************************************************************
+ * Sample Format Conversion
+ *************************************************************/
 
-#ifdef VERBOSE
-      fprintf(stderr, "Output Underflow.\n");
-#endif
+static PyObject *
+pa_convert(PyObject *self, PyObject *args)
+{
+  Py_buffer view;
+  unsigned long src_format, dst_format;
+  unsigned long srcSize, dstSize;
+  Py_ssize_t samples;
+  PyObject *rv;
+  const char *src;
+  char *dst;
 
-    } else {
-      /* clean up */
-      _cleanup_Stream_object(streamObject);
-    }
+  if (!PyArg_ParseTuple(args, "y*kk", &view, &src_format, &dst_format))
+    return NULL;
 
-    /* free the string buffer */
-    Py_XDECREF(rv);
+  srcSize = _dsp_sample_size((PaSampleFormat) src_format);
+  dstSize = _dsp_sample_size((PaSampleFormat) dst_format);
+  if (srcSize == 0 || dstSize == 0) {
+    PyBuffer_Release(&view);
+    PyErr_SetString(PyExc_ValueError, "Invalid sample format");
+    return NULL;
+  }
 
-    PyErr_SetObject(PyExc_IOError,
-		    Py_BuildValue("(s,i)",
-				  Pa_GetErrorText(err), err));
+  if (view.len % srcSize != 0) {
+    PyBuffer_Release(&view);
+    PyErr_SetString(PyExc_ValueError,
+		    "Buffer size is not a multiple of the sample size");
+    return NULL;
+  }
+
+  samples = view.len / srcSize;
+  if (samples > PY_SSIZE_T_MAX / (Py_ssize_t) dstSize) {
+    PyBuffer_Release(&view);
+    return PyErr_NoMemory();
+  }
+
+  rv = PyBytes_FromStringAndSize(NULL, samples * dstSize);
+  if (rv == NULL) {
+    PyBuffer_Release(&view);
     return NULL;
   }
+  src = (const char *) view.buf;
+  dst = PyBytes_AS_STRING(rv);
 
+  /* rv is not visible to anyone else yet, and view stays exported */
+  Py_BEGIN_ALLOW_THREADS
+  while (samples > 0) {
+    unsigned long n = _ulong_frames(samples);
+
+    _dsp_convert(dst, (PaSampleFormat) dst_format, src,
+		 (PaSampleFormat) src_format, n);
+    src += n * srcSize;
+    dst += n * dstSize;
+    samples -= n;
+  }
+  Py_END_ALLOW_THREADS
+
+  PyBuffer_Release(&view);
   return rv;
 }
 
+
+/*************************************************************
+ * Stream Callback Worker
+ *************************************************************/
+
 static PyObject *
-pa_get_stream_write_available(PyObject *self, PyObject *args)
+pa_run_stream_callback_worker(PyObject *self, PyObject *args)
 {
-  signed long frames;
   PyObject *stream_arg;
   _pyAudio_Stream *streamObject;
-
-  if (!PyArg_ParseTuple(args, "O!", &_pyAudio_StreamType, &stream_arg))
+  _pyAudio_StreamCallbackContext *context;
+  PaStreamCallbackTimeInfo timeInfo;
+  unsigned long flags, state;
+  unsigned long long entered, called;
+  int result = paContinue;
+
+  if (!PyArg_ParseTuple(args, "O!", _get_state(self)->streamType,
+			&stream_arg))
     return NULL;
 
   streamObject = (_pyAudio_Stream *) stream_arg;
@@ -2440,34 +6736,78 @@ pa_get_stream_write_available(PyObject *self, PyObject *args)
     return NULL;
   }
 
-  PaStream *stream = streamObject->stream;
-  frames = Pa_GetStreamWriteAvailable(stream);
-  return PyLong_FromLong(frames);
-}
-
-static PyObject *
-pa_get_stream_read_available(PyObject *self, PyObject *args)
-{
-  signed long frames;
-  PyObject *stream_arg;
-  _pyAudio_Stream *streamObject;
+  context = streamObject->callbackContext;
+  if (context->callback == NULL || !context->ringBuffered) {
+    PyErr_SetString(PyExc_ValueError,
+		    "Stream was not opened with callback_thread");
+    return NULL;
+  }
 
-  if (!PyArg_ParseTuple(args, "O!", &_pyAudio_StreamType, &stream_arg))
+  if (PA_ATOMIC_LOAD(&context->workerState) != WORKER_IDLE) {
+    PyErr_SetString(PyExc_RuntimeError,
+		    "Stream callback worker already running");
     return NULL;
+  }
 
-  streamObject = (_pyAudio_Stream *) stream_arg;
+  context->workerThread = (long) PyThread_get_thread_ident();
+  PA_ATOMIC_STORE(&context->workerState, WORKER_RUNNING);
+
+  while (result == paContinue) {
+    Py_BEGIN_ALLOW_THREADS
+    while ((state = PA_ATOMIC_LOAD(&context->workerState)) ==
+           WORKER_RUNNING && !_callback_worker_ready(context))
+      _semaphore_wait(context->inputRing.buffer ? &context->inputSignal :
+                      &context->outputSignal, -1);
+    Py_END_ALLOW_THREADS
+
+    if (state != WORKER_RUNNING)
+      break;
+
+    if (context->workerInput)
+      _ringbuffer_read(&context->inputRing, context->workerInput,
+                       context->framesPerBuffer);
+
+    flags = PA_ATOMIC_EXCHANGE(&context->pendingFlags, 0);
+    _callback_worker_time_info(context, &timeInfo);
+
+    /* the worker already holds the GIL, so its wait phase is 0 */
+    entered = _monotonic_ns();
+    result = _invoke_stream_callback(context,
+                                     context->workerInput,
+                                     context->workerOutput,
+                                     context->framesPerBuffer,
+                                     &timeInfo, flags);
+    called = _monotonic_ns();
+
+    if (context->workerOutput)
+      _ringbuffer_write(&context->outputRing, context->workerOutput,
+                        context->framesPerBuffer);
+
+    _record_callback_timing(context, context->framesPerBuffer,
+                            entered, entered, called, _monotonic_ns());
+
+    if (result != paContinue)
+      PA_ATOMIC_STORE(&context->callbackResult, result);
+  }
 
-  if (!_is_open(streamObject)) {
-    PyErr_SetObject(PyExc_IOError,
-		    Py_BuildValue("(s,i)",
-				  "Stream closed",
-				  paBadStreamPtr));
-    return NULL;
+  /* We hold the GIL here, as does _stop_callback_worker when it
+     changes workerState, so the two cannot race. */
+  switch (PA_ATOMIC_LOAD(&context->workerState)) {
+  case WORKER_ORPHANED:
+    /* the stream was closed from within the callback */
+    _destroy_callback_context(context);
+    break;
+  case WORKER_STOP:
+    /* must be the last access to context: the closing thread frees
+       it as soon as the semaphore is posted */
+    _semaphore_post(&context->workerExited);
+    break;
+  default:
+    PA_ATOMIC_STORE(&context->workerState, WORKER_IDLE);
+    break;
   }
 
-  PaStream *stream = streamObject->stream;
-  frames = Pa_GetStreamReadAvailable(stream);
-  return PyLong_FromLong(frames);
+  Py_RETURN_NONE;
 }
 
 
@@ -2477,84 +6817,96 @@ pa_get_stream_read_available(PyObject *self, PyObject *args)
  *
  ************************************************************/
 
-#if PY_MAJOR_VERSION >= 3
-#define ERROR_INIT NULL
-#else
-#define ERROR_INIT /**/
-#endif
+static int
+paTraverse(PyObject *m, visitproc visit, void *arg)
+{
+  _pyAudio_ModuleState *state = _get_state(m);
 
-#if PY_MAJOR_VERSION >= 3
+  Py_VISIT(state->deviceInfoType);
+  Py_VISIT(state->hostApiInfoType);
+  Py_VISIT(state->streamType);
+  Py_VISIT(state->sampleBufferType);
+#ifdef MACOSX
+  Py_VISIT(state->macCoreStreamInfoType);
+#endif
+  return 0;
+}
 
-struct module_state {
-	PyObject *error;
-};
+static int
+paClear(PyObject *m)
+{
+  _pyAudio_ModuleState *state = _get_state(m);
 
-static int paTraverse(PyObject *m, visitproc visit, void *arg) {
-	Py_VISIT(((struct module_state*)PyModule_GetState(m))->error);
-	return 0;
+  Py_CLEAR(state->deviceInfoType);
+  Py_CLEAR(state->hostApiInfoType);
+  Py_CLEAR(state->streamType);
+  Py_CLEAR(state->sampleBufferType);
+#ifdef MACOSX
+  Py_CLEAR(state->macCoreStreamInfoType);
+#endif
+  return 0;
 }
 
-static int paClear(PyObject *m) {
-	Py_CLEAR(((struct module_state*)PyModule_GetState(m))->error);
-	return 0;
+static void
+paFree(void *m)
+{
+  paClear((PyObject *) m);
 }
 
-static struct PyModuleDef moduledef = {
-	PyModuleDef_HEAD_INIT,
-	"_portaudio",
-	NULL,
-	sizeof(struct module_state),
-	paMethods,
-	NULL,
-	paTraverse,
-	paClear,
-	NULL
-};
-
-PyObject *
-PyInit__portaudio(void)
-#else
-PyMODINIT_FUNC
-init_portaudio(void)
-#endif
+/* runs once for every interpreter that imports the module */
+static int
+paExec(PyObject *m)
 {
-  PyObject* m;
-
-  _pyAudio_StreamType.tp_new = PyType_GenericNew;
-  if (PyType_Ready(&_pyAudio_StreamType) < 0)
-    return ERROR_INIT;
+  _pyAudio_ModuleState *state = _get_state(m);
+
+  state->deviceInfoType = (PyTypeObject *)
+    PyType_FromModuleAndSpec(m, &_pyAudio_paDeviceInfoSpec, NULL);
+  state->hostApiInfoType = (PyTypeObject *)
+    PyType_FromModuleAndSpec(m, &_pyAudio_paHostApiInfoSpec, NULL);
+  state->streamType = (PyTypeObject *)
+    PyType_FromModuleAndSpec(m, &_pyAudio_StreamSpec, NULL);
+  state->sampleBufferType = (PyTypeObject *)
+    PyType_FromModuleAndSpec(m, &_pyAudio_SampleBufferSpec, NULL);
+
+  if (!state->deviceInfoType || !state->hostApiInfoType ||
+      !state->streamType || !state->sampleBufferType)
+    return -1;
 
-  _pyAudio_paDeviceInfoType.tp_new = PyType_GenericNew;
-  if (PyType_Ready(&_pyAudio_paDeviceInfoType) < 0)
-    return ERROR_INIT;
+#if PY_VERSION_HEX < 0x030A0000
+  state->deviceInfoType->tp_new = NULL;
+  state->hostApiInfoType->tp_new = NULL;
+  state->streamType->tp_new = NULL;
+  state->sampleBufferType->tp_new = NULL;
+#endif
 
-  _pyAudio_paHostApiInfoType.tp_new = PyType_GenericNew;
-  if (PyType_Ready(&_pyAudio_paHostApiInfoType) < 0)
-    return ERROR_INIT;
+  Py_INCREF(state->sampleBufferType);
+  if (PyModule_AddObject(m, "SampleBuffer",
+			 (PyObject *) state->sampleBufferType) < 0) {
+    Py_DECREF(state->sampleBufferType);
+    return -1;
+  }
 
 #ifdef MACOSX
-  _pyAudio_MacOSX_hostApiSpecificStreamInfoType.tp_new = PyType_GenericNew;
-  if (PyType_Ready(&_pyAudio_MacOSX_hostApiSpecificStreamInfoType) < 0)
-    return ERROR_INIT;
-#endif
+  state->macCoreStreamInfoType = (PyTypeObject *)
+    PyType_FromModuleAndSpec(m,
+			     &_pyAudio_MacOSX_hostApiSpecificStreamInfoSpec,
+			     NULL);
+  if (!state->macCoreStreamInfoType)
+    return -1;
 
-#if PY_MAJOR_VERSION >= 3
-  m = PyModule_Create(&moduledef);
-#else
-  m = Py_InitModule("_portaudio", paMethods);
+  Py_INCREF(state->macCoreStreamInfoType);
+  if (PyModule_AddObject(m, "paMacCoreStreamInfo",
+			 (PyObject *) state->macCoreStreamInfoType) < 0) {
+    Py_DECREF(state->macCoreStreamInfoType);
+    return -1;
+  }
 #endif
-  PyEval_InitThreads();
-
-  Py_INCREF(&_pyAudio_StreamType);
-  Py_INCREF(&_pyAudio_paDeviceInfoType);
-  Py_INCREF(&_pyAudio_paHostApiInfoType);
 
-#ifdef MACOSX
-  Py_INCREF(&_pyAudio_MacOSX_hostApiSpecificStreamInfoType);
-  PyModule_AddObject(m, "paMacCoreStreamInfo",
-		     (PyObject *)
-		     &_pyAudio_MacOSX_hostApiSpecificStreamInfoType);
-#endif
+  Py_BEGIN_ALLOW_THREADS
+  _lock_portaudio();
+  _init_callback_thread_key();
+  _unlock_portaudio();
+  Py_END_ALLOW_THREADS
 
   /* Add PortAudio constants */
 
@@ -2636,6 +6988,16 @@ init_portaudio(void)
   PyModule_AddIntConstant(m, "paOutputUnderflow", paOutputUnderflow);
   PyModule_AddIntConstant(m, "paPrimingOutput", paPrimingOutput);
 
+  /* stream flags */
+  PyModule_AddIntConstant(m, "paNoFlag", paNoFlag);
+  PyModule_AddIntConstant(m, "paClipOff", paClipOff);
+  PyModule_AddIntConstant(m, "paDitherOff", paDitherOff);
+  PyModule_AddIntConstant(m, "paNeverDropInput", paNeverDropInput);
+  PyModule_AddIntConstant(m, "paPrimeOutputBuffersUsingStreamCallback",
+			  paPrimeOutputBuffersUsingStreamCallback);
+  PyModule_AddIntConstant(m, "paPlatformSpecificFlags",
+			  paPlatformSpecificFlags);
+
 #ifdef MACOSX
   PyModule_AddIntConstant(m, "paMacCoreChangeDeviceParameters",
 			  paMacCoreChangeDeviceParameters);
@@ -2661,7 +7023,31 @@ init_portaudio(void)
 			  paMacCoreMinimizeCPU);
 #endif
 
-#if PY_MAJOR_VERSION >= 3
-  return m;
+  return 0;
+}
+
+static PyModuleDef_Slot paSlots[] = {
+  {Py_mod_exec, (void *) paExec},
+#if PY_VERSION_HEX >= 0x030C0000
+  {Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED},
 #endif
+  {0, NULL}
+};
+
+static struct PyModuleDef moduledef = {
+  PyModuleDef_HEAD_INIT,
+  "_portaudio",
+  NULL,
+  sizeof(_pyAudio_ModuleState),
+  paMethods,
+  paSlots,
+  paTraverse,
+  paClear,
+  paFree
+};
+
+PyMODINIT_FUNC
+PyInit__portaudio(void)
+{
+  return PyModuleDef_Init(&moduledef);
 }
@@ -87,6 +87,9 @@ static PyObject *
 pa_is_format_supported(PyObject *self, PyObject *args,
 		       PyObject *kwargs);
 
+static PyObject *
+pa_convert(PyObject *self, PyObject *args);
+
 /* stream start/stop/info */
 
 static PyObject *
@@ -110,18 +113,82 @@ pa_get_stream_time(PyObject *self, PyObject *args);
 static PyObject *
 pa_get_stream_cpu_load(PyObject *self, PyObject *args);
 
+static PyObject *
+pa_get_stream_callback_stats(PyObject *self, PyObject *args);
+
+static PyObject *
+pa_reset_stream_callback_stats(PyObject *self, PyObject *args);
+
+static PyObject *
+pa_get_stream_xrun_counts(PyObject *self, PyObject *args);
+
+static PyObject *
+pa_seek_stream_playback(PyObject *self, PyObject *args);
+
+static PyObject *
+pa_get_stream_playback_position(PyObject *self, PyObject *args);
+
+static PyObject *
+pa_get_stream_recorder_stats(PyObject *self, PyObject *args);
+
 /* stream write/read */
 
 static PyObject *
 pa_write_stream(PyObject *self, PyObject *args);
 
+static PyObject *
+pa_write_stream_many(PyObject *self, PyObject *args);
+
 static PyObject *
 pa_read_stream(PyObject *self, PyObject *args);
 
+static PyObject *
+pa_read_stream_into(PyObject *self, PyObject *args);
+
+static PyObject *
+pa_read_stream_array(PyObject *self, PyObject *args);
+
 static PyObject *
 pa_get_stream_write_available(PyObject *self, PyObject *args);
 
 static PyObject *
 pa_get_stream_read_available(PyObject *self, PyObject *args);
 
+static PyObject *
+pa_get_stream_ring_buffer_stats(PyObject *self, PyObject *args);
+
+static PyObject *
+pa_get_stream_levels(PyObject *self, PyObject *args);
+
+static PyObject *
+pa_get_stream_notify_fd(PyObject *self, PyObject *args);
+
+static PyObject *
+pa_clear_stream_notify(PyObject *self, PyObject *args);
+
+static PyObject *
+pa_set_stream_notify_watermarks(PyObject *self, PyObject *args);
+
+/* mixer voices */
+
+static PyObject *
+pa_add_stream_voice(PyObject *self, PyObject *args);
+
+static PyObject *
+pa_write_stream_voice(PyObject *self, PyObject *args);
+
+static PyObject *
+pa_set_stream_voice_gain(PyObject *self, PyObject *args);
+
+static PyObject *
+pa_remove_stream_voice(PyObject *self, PyObject *args);
+
+static PyObject *
+pa_get_stream_voice_info(PyObject *self, PyObject *args);
+
+/* callback worker */
+
+static PyObject *
+pa_run_stream_callback_worker(PyObject *self, PyObject *args);
+
 #endif
@@ -0,0 +1,637 @@
+/**
+ * PyAudio : Python Bindings for PortAudio.
+ *
+ * PyAudio : Real-time support utilities
+ *
+ * Copyright (c) 2006-2008 Hubert Pham
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+
+#if defined(__APPLE__)
+#include <mach/mach_time.h>
+#elif !defined(_WIN32)
+#include <time.h>
+#endif
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#include <stdint.h>
+#endif
+
+#include "_portaudioutil.h"
+
+
+/*************************************************************
+ * Ring Buffer
+ *************************************************************/
+
+int
+_ringbuffer_init(_pyAudio_RingBuffer *rb, unsigned long frameSize,
+		 unsigned long frames)
+{
+  unsigned long size = 1;
+
+  while (size < frames)
+    size <<= 1;
+
+  rb->buffer = (char *) calloc(size, frameSize);
+  if (rb->buffer == NULL)
+    return -1;
+
+  rb->frameSize = frameSize;
+  rb->size = size;
+  rb->mask = size - 1;
+  rb->writeIndex = 0;
+  rb->readIndex = 0;
+  return 0;
+}
+
+void
+_ringbuffer_free(_pyAudio_RingBuffer *rb)
+{
+  free(rb->buffer);
+  rb->buffer = NULL;
+}
+
+unsigned long
+_ringbuffer_read_available(_pyAudio_RingBuffer *rb)
+{
+  return PA_ATOMIC_LOAD(&rb->writeIndex) - PA_ATOMIC_LOAD(&rb->readIndex);
+}
+
+unsigned long
+_ringbuffer_write_available(_pyAudio_RingBuffer *rb)
+{
+  return rb->size - _ringbuffer_read_available(rb);
+}
+
+unsigned long
+_ringbuffer_write(_pyAudio_RingBuffer *rb, const void *data,
+		  unsigned long frames)
+{
+  unsigned long w = rb->writeIndex;
+  unsigned long available = rb->size - (w - PA_ATOMIC_LOAD(&rb->readIndex));
+  unsigned long offset, first;
+
+  if (frames > available)
+    frames = available;
+  if (frames == 0)
+    return 0;
+
+  /* the region may wrap around the end of the buffer */
+  offset = w & rb->mask;
+  first = rb->size - offset;
+  if (first > frames)
+    first = frames;
+
+  if (data) {
+    memcpy(rb->buffer + offset * rb->frameSize, data,
+	   first * rb->frameSize);
+    memcpy(rb->buffer, (const char *) data + first * rb->frameSize,
+	   (frames - first) * rb->frameSize);
+  } else {
+    memset(rb->buffer + offset * rb->frameSize, 0, first * rb->frameSize);
+    memset(rb->buffer, 0, (frames - first) * rb->frameSize);
+  }
+
+  PA_ATOMIC_STORE(&rb->writeIndex, w + frames);
+  return frames;
+}
+
+unsigned long
+_ringbuffer_read(_pyAudio_RingBuffer *rb, void *data,
+		 unsigned long frames)
+{
+  unsigned long r = rb->readIndex;
+  unsigned long available = PA_ATOMIC_LOAD(&rb->writeIndex) - r;
+  unsigned long offset, first;
+
+  if (frames > available)
+    frames = available;
+  if (frames == 0)
+    return 0;
+
+  offset = r & rb->mask;
+  first = rb->size - offset;
+  if (first > frames)
+    first = frames;
+
+  if (data) {
+    memcpy(data, rb->buffer + offset * rb->frameSize,
+	   first * rb->frameSize);
+    memcpy((char *) data + first * rb->frameSize, rb->buffer,
+	   (frames - first) * rb->frameSize);
+  }
+
+  PA_ATOMIC_STORE(&rb->readIndex, r + frames);
+  return frames;
+}
+
+
+/*************************************************************
+ * Semaphore
+ *************************************************************/
+
+#if defined(_WIN32)
+
+int
+_semaphore_init(_pyAudio_Semaphore *s)
+{
+  s->handle = CreateSemaphore(NULL, 0, LONG_MAX, NULL);
+  return (s->handle == NULL) ? -1 : 0;
+}
+
+void
+_semaphore_destroy(_pyAudio_Semaphore *s)
+{
+  CloseHandle(s->handle);
+}
+
+void
+_semaphore_post(_pyAudio_Semaphore *s)
+{
+  ReleaseSemaphore(s->handle, 1, NULL);
+}
+
+int
+_semaphore_wait(_pyAudio_Semaphore *s, double timeout)
+{
+  DWORD ms = (timeout < 0) ? INFINITE : (DWORD) ceil(timeout * 1000.0);
+  return (WaitForSingleObject(s->handle, ms) == WAIT_OBJECT_0) ? 0 : 1;
+}
+
+#elif defined(__APPLE__)
+
+int
+_semaphore_init(_pyAudio_Semaphore *s)
+{
+  s->sem = dispatch_semaphore_create(0);
+  return (s->sem == NULL) ? -1 : 0;
+}
+
+void
+_semaphore_destroy(_pyAudio_Semaphore *s)
+{
+  dispatch_release(s->sem);
+}
+
+void
+_semaphore_post(_pyAudio_Semaphore *s)
+{
+  dispatch_semaphore_signal(s->sem);
+}
+
+int
+_semaphore_wait(_pyAudio_Semaphore *s, double timeout)
+{
+  dispatch_time_t when = (timeout < 0) ? DISPATCH_TIME_FOREVER :
+    dispatch_time(DISPATCH_TIME_NOW, (int64_t) (timeout * 1e9));
+  return dispatch_semaphore_wait(s->sem, when) ? 1 : 0;
+}
+
+#else
+
+int
+_semaphore_init(_pyAudio_Semaphore *s)
+{
+  return sem_init(&s->sem, 0, 0);
+}
+
+void
+_semaphore_destroy(_pyAudio_Semaphore *s)
+{
+  sem_destroy(&s->sem);
+}
+
+void
+_semaphore_post(_pyAudio_Semaphore *s)
+{
+  sem_post(&s->sem);
+}
+
+int
+_semaphore_wait(_pyAudio_Semaphore *s, double timeout)
+{
+  struct timespec deadline;
+  int err;
+
+  if (timeout < 0) {
+    while ((err = sem_wait(&s->sem)) != 0 && errno == EINTR)
+      ;
+    return err ? 1 : 0;
+  }
+
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += (time_t) timeout;
+  deadline.tv_nsec += (long) ((timeout - floor(timeout)) * 1e9);
+  if (deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec += 1;
+    deadline.tv_nsec -= 1000000000L;
+  }
+
+  while ((err = sem_timedwait(&s->sem, &deadline)) != 0 && errno == EINTR)
+    ;
+  return err ? 1 : 0;
+}
+
+#endif
+
+
+/*************************************************************
+ * Readiness Notifier
+ *************************************************************/
+
+#if defined(_WIN32)
+
+int
+_notifier_init(_pyAudio_Notifier *n)
+{
+  n->readFd = n->writeFd = -1;
+  n->pending = 0;
+  errno = ENOSYS;
+  return -1;
+}
+
+void
+_notifier_close(_pyAudio_Notifier *n)
+{
+}
+
+void
+_notifier_signal(_pyAudio_Notifier *n)
+{
+}
+
+void
+_notifier_clear(_pyAudio_Notifier *n)
+{
+}
+
+#else
+
+int
+_notifier_init(_pyAudio_Notifier *n)
+{
+#if defined(__linux__)
+  n->readFd = n->writeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (n->readFd < 0)
+    return -1;
+#else
+  int fds[2];
+  int i;
+
+  if (pipe(fds) < 0)
+    return -1;
+
+  for (i = 0; i < 2; i++) {
+    if (fcntl(fds[i], F_SETFL, O_NONBLOCK) < 0 ||
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC) < 0) {
+      int err = errno;
+      close(fds[0]);
+      close(fds[1]);
+      errno = err;
+      return -1;
+    }
+  }
+
+  n->readFd = fds[0];
+  n->writeFd = fds[1];
+#endif
+
+  n->pending = 0;
+  return 0;
+}
+
+void
+_notifier_close(_pyAudio_Notifier *n)
+{
+  if (n->writeFd != n->readFd)
+    close(n->writeFd);
+  close(n->readFd);
+  n->readFd = n->writeFd = -1;
+}
+
+void
+_notifier_signal(_pyAudio_Notifier *n)
+{
+#if defined(__linux__)
+  uint64_t value = 1;
+#else
+  char value = 0;
+#endif
+  ssize_t rv;
+
+  if (PA_ATOMIC_EXCHANGE(&n->pending, 1) != 0)
+    return;
+
+  /* the descriptor is non-blocking, and if it is somehow full, it is
+     readable anyway */
+  rv = write(n->writeFd, &value, sizeof(value));
+  (void) rv;
+}
+
+void
+_notifier_clear(_pyAudio_Notifier *n)
+{
+  /* an eventfd needs 8 bytes to read its counter */
+  char buffer[64];
+
+  while (read(n->readFd, buffer, sizeof(buffer)) > 0)
+    ;
+
+  /* only now, so that a signal in the meantime is not drained without
+     a byte written after it */
+  PA_ATOMIC_STORE(&n->pending, 0);
+}
+
+#endif
+
+
+/*************************************************************
+ * Monotonic Clock
+ *************************************************************/
+
+#if defined(_WIN32)
+
+unsigned long long
+_monotonic_ns(void)
+{
+  static LARGE_INTEGER frequency;
+  LARGE_INTEGER counter;
+
+  if (frequency.QuadPart == 0)
+    QueryPerformanceFrequency(&frequency);
+
+  QueryPerformanceCounter(&counter);
+  return (unsigned long long)
+    ((double) counter.QuadPart * 1e9 / (double) frequency.QuadPart);
+}
+
+#elif defined(__APPLE__)
+
+unsigned long long
+_monotonic_ns(void)
+{
+  static mach_timebase_info_data_t timebase;
+
+  if (timebase.denom == 0)
+    mach_timebase_info(&timebase);
+
+  return mach_absolute_time() * timebase.numer / timebase.denom;
+}
+
+#else
+
+unsigned long long
+_monotonic_ns(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (unsigned long long) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+#endif
+
+
+/*************************************************************
+ * Mutex
+ *************************************************************/
+
+void
+_mutex_lock(_pyAudio_Mutex *m)
+{
+#if defined(_WIN32)
+  AcquireSRWLockExclusive(m);
+#else
+  pthread_mutex_lock(m);
+#endif
+}
+
+void
+_mutex_unlock(_pyAudio_Mutex *m)
+{
+#if defined(_WIN32)
+  ReleaseSRWLockExclusive(m);
+#else
+  pthread_mutex_unlock(m);
+#endif
+}
+
+
+/*************************************************************
+ * Native Thread
+ *************************************************************/
+
+typedef struct {
+  void (*func)(void *);
+  void *arg;
+} _pyAudio_ThreadStart;
+
+#if defined(_WIN32)
+
+static DWORD WINAPI
+_thread_main(LPVOID param)
+{
+  _pyAudio_ThreadStart start = *(_pyAudio_ThreadStart *) param;
+
+  free(param);
+  start.func(start.arg);
+  return 0;
+}
+
+#else
+
+static void *
+_thread_main(void *param)
+{
+  _pyAudio_ThreadStart start = *(_pyAudio_ThreadStart *) param;
+
+  free(param);
+  start.func(start.arg);
+  return NULL;
+}
+
+#endif
+
+int
+_thread_start(_pyAudio_Thread *t, void (*func)(void *), void *arg)
+{
+  _pyAudio_ThreadStart *start;
+
+  start = (_pyAudio_ThreadStart *) malloc(sizeof(_pyAudio_ThreadStart));
+  if (start == NULL)
+    return -1;
+
+  start->func = func;
+  start->arg = arg;
+
+#if defined(_WIN32)
+  t->handle = CreateThread(NULL, 0, _thread_main, start, 0, NULL);
+  if (t->handle == NULL) {
+    free(start);
+    return -1;
+  }
+#else
+  if (pthread_create(&t->thread, NULL, _thread_main, start) != 0) {
+    free(start);
+    return -1;
+  }
+#endif
+
+  return 0;
+}
+
+void
+_thread_join(_pyAudio_Thread *t)
+{
+#if defined(_WIN32)
+  WaitForSingleObject(t->handle, INFINITE);
+  CloseHandle(t->handle);
+#else
+  pthread_join(t->thread, NULL);
+#endif
+}
+
+
+/*************************************************************
+ * Memory-Mapped File
+ *************************************************************/
+
+#if defined(_WIN32)
+
+int
+_mappedfile_open(_pyAudio_MappedFile *mf, int fd)
+{
+  HANDLE file = (HANDLE) _get_osfhandle(fd);
+  LARGE_INTEGER size;
+
+  if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &size) ||
+      size.QuadPart == 0)
+    return -1;
+
+  mf->mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (mf->mapping == NULL)
+    return -1;
+
+  mf->data = (const char *) MapViewOfFile(mf->mapping, FILE_MAP_READ,
+					  0, 0, 0);
+  if (mf->data == NULL) {
+    CloseHandle(mf->mapping);
+    return -1;
+  }
+
+  mf->size = (unsigned long long) size.QuadPart;
+  return 0;
+}
+
+void
+_mappedfile_close(_pyAudio_MappedFile *mf)
+{
+  UnmapViewOfFile(mf->data);
+  CloseHandle(mf->mapping);
+  mf->data = NULL;
+}
+
+void
+_mappedfile_prefetch(_pyAudio_MappedFile *mf, unsigned long long offset,
+		     unsigned long long length)
+{
+  /* PrefetchVirtualMemory needs Windows 8; the first touch of each
+     page reads it in otherwise */
+}
+
+#else
+
+int
+_mappedfile_open(_pyAudio_MappedFile *mf, int fd)
+{
+  struct stat st;
+  void *data;
+
+  if (fstat(fd, &st) != 0)
+    return -1;
+
+  if (st.st_size == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  data = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED)
+    return -1;
+
+  mf->data = (const char *) data;
+  mf->size = (unsigned long long) st.st_size;
+
+#if defined(MADV_SEQUENTIAL)
+  madvise(data, (size_t) st.st_size, MADV_SEQUENTIAL);
+#endif
+  return 0;
+}
+
+void
+_mappedfile_close(_pyAudio_MappedFile *mf)
+{
+  munmap((void *) mf->data, (size_t) mf->size);
+  mf->data = NULL;
+}
+
+void
+_mappedfile_prefetch(_pyAudio_MappedFile *mf, unsigned long long offset,
+		     unsigned long long length)
+{
+#if defined(MADV_WILLNEED)
+  static long pageSize;
+  unsigned long long start;
+
+  if (pageSize == 0)
+    pageSize = sysconf(_SC_PAGESIZE);
+
+  if (offset >= mf->size)
+    return;
+  if (length > mf->size - offset)
+    length = mf->size - offset;
+
+  /* madvise wants a page-aligned address */
+  start = offset - offset % (unsigned long long) pageSize;
+  madvise((void *) (mf->data + start), (size_t) (offset + length - start),
+	  MADV_WILLNEED);
+#endif
+}
+
+#endif
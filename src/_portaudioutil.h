@@ -0,0 +1,261 @@
+/**
+ * PyAudio : Python Bindings for PortAudio.
+ *
+ * PyAudio : Real-time support utilities
+ *
+ * Primitives that are safe to use from the PortAudio callback thread,
+ * i.e. that never take a lock, allocate memory or touch the Python
+ * interpreter: atomic counters, a single-producer/single-consumer ring
+ * buffer, a counting semaphore that a callback can post to, a
+ * pollable readiness notifier, a monotonic clock, mutexes, native
+ * threads and read-only memory-mapped files.
+ *
+ * Copyright (c) 2006-2008 Hubert Pham
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __PAUTIL_H__
+#define __PAUTIL_H__
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__APPLE__)
+#include <dispatch/dispatch.h>
+#include <pthread.h>
+#else
+#include <semaphore.h>
+#include <pthread.h>
+#endif
+
+/* atomics
+ *
+ * Loads acquire and stores release, so that a ring buffer index
+ * published by one thread also publishes the data written before it.
+ * Read-modify-write operations are sequentially consistent. */
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+
+static __inline long
+_atomic_load(volatile long *p)
+{
+  long v = *p;
+  _ReadWriteBarrier();
+  return v;
+}
+
+static __inline void
+_atomic_store(volatile long *p, long v)
+{
+  _ReadWriteBarrier();
+  *p = v;
+}
+
+#define PA_ATOMIC_LOAD(p) \
+  ((unsigned long) _atomic_load((volatile long *) (p)))
+#define PA_ATOMIC_STORE(p, v) \
+  _atomic_store((volatile long *) (p), (long) (v))
+#define PA_ATOMIC_ADD(p, v) \
+  ((unsigned long) InterlockedExchangeAdd((volatile long *) (p), \
+					  (long) (v)) + (v))
+#define PA_ATOMIC_OR(p, v) \
+  ((unsigned long) InterlockedOr((volatile long *) (p), (long) (v)))
+#define PA_ATOMIC_EXCHANGE(p, v) \
+  ((unsigned long) InterlockedExchange((volatile long *) (p), (long) (v)))
+#define PA_ATOMIC_CAS(p, expected, v) \
+  (InterlockedCompareExchange((volatile long *) (p), (long) (v), \
+			      (long) (expected)) == (long) (expected))
+#else
+#define PA_ATOMIC_LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define PA_ATOMIC_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define PA_ATOMIC_ADD(p, v) __atomic_add_fetch((p), (v), __ATOMIC_SEQ_CST)
+#define PA_ATOMIC_OR(p, v) __atomic_fetch_or((p), (v), __ATOMIC_SEQ_CST)
+#define PA_ATOMIC_EXCHANGE(p, v) \
+  __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+/* stores v if *p == expected; returns whether it did */
+#define PA_ATOMIC_CAS(p, expected, v) \
+  __sync_bool_compare_and_swap((p), (expected), (v))
+#endif
+
+/* lock-free single-producer/single-consumer ring buffer
+ *
+ * Holds a power-of-two number of fixed-size frames. Exactly one thread
+ * may write and exactly one (other) thread may read at any time. */
+
+typedef struct {
+  char *buffer;
+  unsigned long frameSize;
+  unsigned long size;
+  unsigned long mask;
+  volatile unsigned long writeIndex;
+  volatile unsigned long readIndex;
+} _pyAudio_RingBuffer;
+
+/* frames is rounded up to the next power of two; returns -1 on
+   failure to allocate */
+int
+_ringbuffer_init(_pyAudio_RingBuffer *rb, unsigned long frameSize,
+		 unsigned long frames);
+
+void
+_ringbuffer_free(_pyAudio_RingBuffer *rb);
+
+unsigned long
+_ringbuffer_read_available(_pyAudio_RingBuffer *rb);
+
+unsigned long
+_ringbuffer_write_available(_pyAudio_RingBuffer *rb);
+
+/* writes up to frames frames (zeros if data is NULL); returns the
+   number of frames written */
+unsigned long
+_ringbuffer_write(_pyAudio_RingBuffer *rb, const void *data,
+		  unsigned long frames);
+
+/* reads up to frames frames (discards them if data is NULL); returns
+   the number of frames read */
+unsigned long
+_ringbuffer_read(_pyAudio_RingBuffer *rb, void *data,
+		 unsigned long frames);
+
+/* counting semaphore; posting never blocks */
+
+typedef struct {
+#if defined(_WIN32)
+  HANDLE handle;
+#elif defined(__APPLE__)
+  dispatch_semaphore_t sem;
+#else
+  sem_t sem;
+#endif
+} _pyAudio_Semaphore;
+
+int
+_semaphore_init(_pyAudio_Semaphore *s);
+
+void
+_semaphore_destroy(_pyAudio_Semaphore *s);
+
+void
+_semaphore_post(_pyAudio_Semaphore *s);
+
+/* waits at most timeout seconds (forever if negative); returns 0 if
+   the semaphore was acquired, 1 on timeout */
+int
+_semaphore_wait(_pyAudio_Semaphore *s, double timeout);
+
+/* readiness notifier
+ *
+ * A file descriptor that becomes readable when signalled, for
+ * select(), epoll and event loops: an eventfd on Linux, a non-blocking
+ * pipe on other POSIX systems. Not available on Windows. Signalling
+ * is one write() at most, however often it is repeated before the
+ * descriptor is cleared. */
+
+typedef struct {
+  int readFd;
+  int writeFd;
+  volatile unsigned long pending;
+} _pyAudio_Notifier;
+
+/* returns -1 on failure, with errno set (always, on Windows) */
+int
+_notifier_init(_pyAudio_Notifier *n);
+
+void
+_notifier_close(_pyAudio_Notifier *n);
+
+/* makes the descriptor readable, unless it already is */
+void
+_notifier_signal(_pyAudio_Notifier *n);
+
+/* makes the descriptor unreadable until the next signal; whatever it
+   signals must be checked after clearing, not before */
+void
+_notifier_clear(_pyAudio_Notifier *n);
+
+/* mutex that can be initialized statically, with
+   PA_MUTEX_INITIALIZER */
+
+#if defined(_WIN32)
+typedef SRWLOCK _pyAudio_Mutex;
+#define PA_MUTEX_INITIALIZER SRWLOCK_INIT
+#else
+typedef pthread_mutex_t _pyAudio_Mutex;
+#define PA_MUTEX_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+#endif
+
+void
+_mutex_lock(_pyAudio_Mutex *m);
+
+void
+_mutex_unlock(_pyAudio_Mutex *m);
+
+/* native thread, for work that never touches the interpreter */
+
+typedef struct {
+#if defined(_WIN32)
+  HANDLE handle;
+#else
+  pthread_t thread;
+#endif
+} _pyAudio_Thread;
+
+/* runs func(arg) on a new thread; returns -1 on failure */
+int
+_thread_start(_pyAudio_Thread *t, void (*func)(void *), void *arg);
+
+void
+_thread_join(_pyAudio_Thread *t);
+
+/* read-only memory-mapped file */
+
+typedef struct {
+  const char *data;
+  unsigned long long size;
+#if defined(_WIN32)
+  HANDLE mapping;
+#endif
+} _pyAudio_MappedFile;
+
+/* maps the whole of the open file fd; returns -1 on failure, with
+   errno set on POSIX */
+int
+_mappedfile_open(_pyAudio_MappedFile *mf, int fd);
+
+void
+_mappedfile_close(_pyAudio_MappedFile *mf);
+
+/* asks the OS to start reading the given range into memory, so that
+   touching it later does not block on disk I/O */
+void
+_mappedfile_prefetch(_pyAudio_MappedFile *mf, unsigned long long offset,
+		     unsigned long long length);
+
+/* monotonic clock */
+
+/* nanoseconds since an arbitrary epoch; cheap enough to call a few
+   times per callback */
+unsigned long long
+_monotonic_ns(void);
+
+#endif
@@ -0,0 +1,366 @@
+/**
+ * PyAudio : Python Bindings for PortAudio.
+ *
+ * PyAudio : Native recorder
+ *
+ * Copyright (c) 2006-2008 Hubert Pham
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "_recorder.h"
+
+/* frames moved from the ring to the file per fwrite */
+#define RECORDER_CHUNK_FRAMES 4096
+
+/* how often the writer wakes up without being signalled, and updates
+   the WAV header of the file being written */
+#define RECORDER_WAIT_INTERVAL 0.25
+#define RECORDER_FIXUP_INTERVAL_NS 1000000000ULL
+
+#define WAV_HEADER_SIZE 44
+#define WAV_FORMAT_PCM 1
+#define WAV_FORMAT_IEEE_FLOAT 3
+
+
+/*************************************************************
+ * WAV Header
+ *************************************************************/
+
+static void
+_put_le16(unsigned char *p, unsigned long v)
+{
+  p[0] = (unsigned char) v;
+  p[1] = (unsigned char) (v >> 8);
+}
+
+static void
+_put_le32(unsigned char *p, unsigned long v)
+{
+  p[0] = (unsigned char) v;
+  p[1] = (unsigned char) (v >> 8);
+  p[2] = (unsigned char) (v >> 16);
+  p[3] = (unsigned char) (v >> 24);
+}
+
+/* writes the header for the frames written so far at the start of
+   the file, and returns to its end; sizes past 4 GiB saturate */
+static int
+_write_wav_header(_pyAudio_Recorder *rec)
+{
+  unsigned char header[WAV_HEADER_SIZE];
+  unsigned long long dataSize =
+    (unsigned long long) rec->fileFrames * rec->frameSize;
+  unsigned long sampleSize = rec->frameSize / rec->channels;
+
+  if (dataSize > 0xffffffffUL - (WAV_HEADER_SIZE - 8))
+    dataSize = 0xffffffffUL - (WAV_HEADER_SIZE - 8);
+
+  memcpy(header, "RIFF", 4);
+  _put_le32(header + 4, (unsigned long) dataSize + WAV_HEADER_SIZE - 8);
+  memcpy(header + 8, "WAVEfmt ", 8);
+  _put_le32(header + 16, 16);
+  _put_le16(header + 20, (rec->format == paFloat32) ?
+	    WAV_FORMAT_IEEE_FLOAT : WAV_FORMAT_PCM);
+  _put_le16(header + 22, rec->channels);
+  _put_le32(header + 24, rec->rate);
+  _put_le32(header + 28, rec->rate * rec->frameSize);
+  _put_le16(header + 32, rec->frameSize);
+  _put_le16(header + 34, sampleSize * 8);
+  memcpy(header + 36, "data", 4);
+  _put_le32(header + 40, (unsigned long) dataSize);
+
+  if (fseek(rec->file, 0, SEEK_SET) != 0 ||
+      fwrite(header, 1, WAV_HEADER_SIZE, rec->file) != WAV_HEADER_SIZE ||
+      fseek(rec->file, 0, SEEK_END) != 0 ||
+      fflush(rec->file) != 0)
+    return -1;
+
+  return 0;
+}
+
+
+/*************************************************************
+ * Files
+ *************************************************************/
+
+/* opens the next file; returns -1 with errno set on failure */
+static int
+_recorder_open_file(_pyAudio_Recorder *rec)
+{
+  char *name = rec->stem;
+
+  if (rec->rotate) {
+    name = (char *) malloc(strlen(rec->stem) + strlen(rec->extension) + 24);
+    if (name == NULL) {
+      errno = ENOMEM;
+      return -1;
+    }
+    sprintf(name, "%s.%04lu%s", rec->stem, rec->files, rec->extension);
+  }
+
+  rec->file = fopen(name, "wb");
+  if (name != rec->stem)
+    free(name);
+  if (rec->file == NULL)
+    return -1;
+
+  rec->fileFrames = 0;
+  PA_ATOMIC_ADD(&rec->files, 1);
+
+  if (rec->wav && _write_wav_header(rec) < 0) {
+    int error = errno;
+    fclose(rec->file);
+    rec->file = NULL;
+    errno = error;
+    return -1;
+  }
+
+  rec->lastFixup = _monotonic_ns();
+  return 0;
+}
+
+/* finishes the current file; returns -1 with errno set on failure */
+static int
+_recorder_close_file(_pyAudio_Recorder *rec)
+{
+  int result = 0;
+
+  if (rec->wav && _write_wav_header(rec) < 0)
+    result = -1;
+
+  if (fclose(rec->file) != 0)
+    result = -1;
+
+  rec->file = NULL;
+  return result;
+}
+
+/* once a file fails, the rest of the recording is dropped */
+static void
+_recorder_fail(_pyAudio_Recorder *rec)
+{
+  PA_ATOMIC_STORE(&rec->error, errno ? errno : EIO);
+
+  if (rec->file != NULL) {
+    fclose(rec->file);
+    rec->file = NULL;
+  }
+}
+
+
+/*************************************************************
+ * Writer Thread
+ *************************************************************/
+
+static void
+_recorder_drain(_pyAudio_Recorder *rec)
+{
+  unsigned long frames, n;
+  const char *data;
+
+  while ((frames = _ringbuffer_read(&rec->ring, rec->chunk,
+				    rec->chunkFrames)) > 0) {
+    data = rec->chunk;
+
+    while (frames > 0) {
+      if (rec->file == NULL) {
+	PA_ATOMIC_ADD(&rec->framesDropped, frames);
+	break;
+      }
+
+      n = frames;
+      if (rec->rotate && n > rec->rotateFrames - rec->fileFrames)
+	n = rec->rotateFrames - rec->fileFrames;
+
+      if (fwrite(data, rec->frameSize, n, rec->file) != n) {
+	_recorder_fail(rec);
+	continue;
+      }
+
+      rec->fileFrames += n;
+      PA_ATOMIC_ADD(&rec->framesWritten, n);
+      data += n * rec->frameSize;
+      frames -= n;
+
+      if (rec->rotate && rec->fileFrames == rec->rotateFrames) {
+	if (_recorder_close_file(rec) < 0 || _recorder_open_file(rec) < 0)
+	  _recorder_fail(rec);
+      }
+    }
+  }
+}
+
+static void
+_recorder_main(void *arg)
+{
+  _pyAudio_Recorder *rec = (_pyAudio_Recorder *) arg;
+  unsigned long stop;
+
+  for (;;) {
+    /* everything queued before a stop request is still written */
+    stop = PA_ATOMIC_LOAD(&rec->stop);
+    _recorder_drain(rec);
+    if (stop)
+      break;
+
+    /* keep the file readable should the process die */
+    if (rec->wav && rec->file != NULL &&
+	_monotonic_ns() - rec->lastFixup >= RECORDER_FIXUP_INTERVAL_NS) {
+      if (_write_wav_header(rec) < 0)
+	_recorder_fail(rec);
+      rec->lastFixup = _monotonic_ns();
+    }
+
+    _semaphore_wait(&rec->signal, RECORDER_WAIT_INTERVAL);
+  }
+
+  if (rec->file != NULL && _recorder_close_file(rec) < 0)
+    _recorder_fail(rec);
+}
+
+
+/*************************************************************
+ * Recorder
+ *************************************************************/
+
+_pyAudio_Recorder *
+_recorder_new(const char *path, int wav, unsigned long rotateFrames,
+	      PaSampleFormat format, int channels, unsigned long rate,
+	      unsigned long ringFrames)
+{
+  _pyAudio_Recorder *rec;
+  const char *dot;
+  int error;
+
+  rec = (_pyAudio_Recorder *) calloc(1, sizeof(_pyAudio_Recorder));
+  if (rec == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  rec->wav = wav;
+  rec->rotate = (rotateFrames > 0);
+  rec->rotateFrames = rotateFrames;
+  rec->format = format;
+  rec->channels = channels;
+  rec->rate = rate;
+  rec->frameSize = Pa_GetSampleSize(format) * channels;
+  rec->chunkFrames = RECORDER_CHUNK_FRAMES;
+
+  /* the index goes before the extension, if the last path component
+     has one */
+  dot = strrchr(path, '.');
+  if (!rec->rotate || dot == NULL || dot == path ||
+      strpbrk(dot, "/\\") != NULL)
+    dot = path + strlen(path);
+
+  rec->stem = (char *) malloc(dot - path + 1);
+  rec->extension = strdup(dot);
+  rec->chunk = (char *) malloc(rec->chunkFrames * rec->frameSize);
+
+  if (rec->stem == NULL || rec->extension == NULL || rec->chunk == NULL) {
+    _recorder_free(rec);
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  memcpy(rec->stem, path, dot - path);
+  rec->stem[dot - path] = '\0';
+
+  if (_ringbuffer_init(&rec->ring, rec->frameSize, ringFrames) != 0) {
+    _recorder_free(rec);
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  if (_semaphore_init(&rec->signal) != 0) {
+    _recorder_free(rec);
+    errno = ENOMEM;
+    return NULL;
+  }
+  rec->signalValid = 1;
+
+  if (_recorder_open_file(rec) < 0) {
+    error = errno;
+    _recorder_free(rec);
+    errno = error;
+    return NULL;
+  }
+
+  return rec;
+}
+
+int
+_recorder_start(_pyAudio_Recorder *rec)
+{
+  if (_thread_start(&rec->thread, _recorder_main, rec) != 0)
+    return -1;
+
+  rec->running = 1;
+  return 0;
+}
+
+void
+_recorder_write(_pyAudio_Recorder *rec, const void *input,
+		unsigned long frames)
+{
+  unsigned long written = _ringbuffer_write(&rec->ring, input, frames);
+
+  if (written < frames)
+    PA_ATOMIC_ADD(&rec->framesDropped, frames - written);
+
+  _semaphore_post(&rec->signal);
+}
+
+void
+_recorder_stop(_pyAudio_Recorder *rec)
+{
+  if (!rec->running)
+    return;
+
+  PA_ATOMIC_STORE(&rec->stop, 1);
+  _semaphore_post(&rec->signal);
+  _thread_join(&rec->thread);
+  rec->running = 0;
+}
+
+void
+_recorder_free(_pyAudio_Recorder *rec)
+{
+  _recorder_stop(rec);
+
+  if (rec->file != NULL)
+    _recorder_close_file(rec);
+
+  _ringbuffer_free(&rec->ring);
+  if (rec->signalValid)
+    _semaphore_destroy(&rec->signal);
+
+  free(rec->stem);
+  free(rec->extension);
+  free(rec->chunk);
+  free(rec);
+}
@@ -0,0 +1,103 @@
+/**
+ * PyAudio : Python Bindings for PortAudio.
+ *
+ * PyAudio : Native recorder
+ *
+ * Appends a stream's input to WAV or raw files from a native writer
+ * thread. The PortAudio callback only copies input into a ring
+ * buffer; the writer drains it to disk, keeps the WAV header up to
+ * date and starts a new file every so many frames. Nothing here
+ * touches the Python interpreter.
+ *
+ * Copyright (c) 2006-2008 Hubert Pham
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __PARECORDER_H__
+#define __PARECORDER_H__
+
+#include <stdio.h>
+
+#include "portaudio.h"
+#include "_portaudioutil.h"
+
+typedef struct {
+  _pyAudio_RingBuffer ring;
+  _pyAudio_Semaphore signal;
+  int signalValid;
+  _pyAudio_Thread thread;
+  int running;
+  volatile unsigned long stop;
+
+  /* path, or path split around the file index when rotating */
+  char *stem;
+  char *extension;
+  int rotate;
+  int wav;
+  unsigned long rotateFrames;
+
+  PaSampleFormat format;
+  int channels;
+  unsigned long rate;
+  unsigned long frameSize;
+
+  FILE *file;
+  unsigned long fileFrames;
+  unsigned long long lastFixup;
+  char *chunk;
+  unsigned long chunkFrames;
+
+  /* read from any thread */
+  volatile unsigned long framesWritten;
+  volatile unsigned long framesDropped;
+  volatile unsigned long files;
+  volatile unsigned long error;
+} _pyAudio_Recorder;
+
+/* Creates the first file, named path unless rotateFrames is nonzero,
+   in which case files are named <stem>.<index><extension>, with index
+   counting from 0000. Returns NULL with errno set on failure. */
+_pyAudio_Recorder *
+_recorder_new(const char *path, int wav, unsigned long rotateFrames,
+	      PaSampleFormat format, int channels, unsigned long rate,
+	      unsigned long ringFrames);
+
+/* starts the writer thread; returns -1 on failure */
+int
+_recorder_start(_pyAudio_Recorder *rec);
+
+/* Queues frames of input for the writer; called from the PortAudio
+   callback. Frames that do not fit are dropped and counted. */
+void
+_recorder_write(_pyAudio_Recorder *rec, const void *input,
+		unsigned long frames);
+
+/* Stops the writer after it has written everything queued and
+   finished the current file. Blocks on disk I/O. */
+void
+_recorder_stop(_pyAudio_Recorder *rec);
+
+/* stops the recorder if needed */
+void
+_recorder_free(_pyAudio_Recorder *rec);
+
+#endif
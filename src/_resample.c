@@ -0,0 +1,361 @@
+/**
+ * PyAudio : Python Bindings for PortAudio.
+ *
+ * PyAudio : Sample rate conversion
+ *
+ * Each output frame is the dot product of the newest taps input
+ * frames of each channel with one phase of the filter. The input is
+ * kept deinterleaved, so that the dot products run over contiguous
+ * memory, with SSE2 or AVX2 where available (see _dsp_dot).
+ *
+ * Copyright (c) 2006-2008 Hubert Pham
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "_resample.h"
+#include "_dsp.h"
+
+/* frames converted to and from float at a time */
+#define RESAMPLE_CHUNK_FRAMES 256
+
+/* bounds the size of the filter: ratios of the common rates need
+   at most 640 phases (e.g. 11025 to 48000 Hz) */
+#define RESAMPLE_MAX_PHASES 1024
+
+/* bounds the filter's length when downsampling, which widens it by
+   the ratio of the rates: 64 taps from 192000 to 8000 Hz is 1536 */
+#define RESAMPLE_MAX_TAPS 4096
+
+static const struct {
+  /* taps when upsampling, per frame of output when downsampling */
+  int taps;
+  /* cutoff, as a fraction of the lower Nyquist frequency */
+  double rolloff;
+  /* Kaiser window shape */
+  double beta;
+} _qualities[] = {
+  {16, 0.80, 6.0},
+  {32, 0.90, 8.0},
+  {64, 0.95, 10.0},
+};
+
+
+/*************************************************************
+ * Filter Design
+ *************************************************************/
+
+static unsigned long
+_gcd(unsigned long a, unsigned long b)
+{
+  while (b) {
+    unsigned long t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+/* zeroth order modified Bessel function of the first kind */
+static double
+_bessel_i0(double x)
+{
+  double sum = 1.0;
+  double term = 1.0;
+  int k;
+
+  for (k = 1; k < 50; k++) {
+    term *= (x / (2 * k)) * (x / (2 * k));
+    sum += term;
+    if (term < sum * 1e-12)
+      break;
+  }
+  return sum;
+}
+
+/* Fills in the phases: phase p weighs input frame next - k (counting
+ * k from taps - 1 down to 0) for an output at next + p / up, minus the
+ * filter's delay of (taps - 1) / 2 frames. Each phase is normalized
+ * to unity gain at DC. When downsampling, the cutoff drops by
+ * up / down and taps has grown by at least down / up, so that the
+ * transition band stays as narrow, relative to the output's Nyquist
+ * frequency, as the quality's. */
+static void
+_resampler_design(_pyAudio_Resampler *rs, double rolloff, double beta)
+{
+  double halfWidth = rs->taps / 2.0;
+  double cutoff = 0.5 * rolloff;
+  double i0Beta = _bessel_i0(beta);
+  unsigned long p;
+  int k;
+
+  /* below the lower of the two Nyquist frequencies */
+  if (rs->down > rs->up)
+    cutoff *= (double) rs->up / rs->down;
+
+  for (p = 0; p < rs->up; p++) {
+    float *row = rs->filter + p * rs->taps;
+    double sum = 0.0;
+
+    for (k = 0; k < rs->taps; k++) {
+      double t = (double) p / rs->up + (rs->taps - 1) / 2.0 - k;
+      double x = t / halfWidth;
+      double sinc = (t == 0.0) ? 1.0 :
+	sin(2 * M_PI * cutoff * t) / (2 * M_PI * cutoff * t);
+      double window = (x * x >= 1.0) ? 0.0 :
+	_bessel_i0(beta * sqrt(1.0 - x * x)) / i0Beta;
+
+      row[k] = (float) (sinc * window);
+      sum += row[k];
+    }
+
+    for (k = 0; k < rs->taps; k++)
+      row[k] = (float) (row[k] / sum);
+  }
+}
+
+
+/*************************************************************
+ * Resampler
+ *************************************************************/
+
+_pyAudio_Resampler *
+_resampler_new(int channels, PaSampleFormat format, unsigned long inRate,
+	       unsigned long outRate, int quality)
+{
+  _pyAudio_Resampler *rs;
+  unsigned long g, widen;
+  size_t chunk = (size_t) RESAMPLE_CHUNK_FRAMES * channels;
+
+  if (inRate == 0 || outRate == 0) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  g = _gcd(inRate, outRate);
+  if (outRate / g > RESAMPLE_MAX_PHASES) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  if (quality < RESAMPLE_QUALITY_LOW || quality > RESAMPLE_QUALITY_HIGH)
+    quality = RESAMPLE_QUALITY_MEDIUM;
+
+  widen = (inRate + outRate - 1) / outRate;
+  if (widen > RESAMPLE_MAX_TAPS / _qualities[quality].taps) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  rs = (_pyAudio_Resampler *) calloc(1, sizeof(_pyAudio_Resampler));
+  if (rs == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  rs->channels = channels;
+  rs->format = format;
+  rs->frameSize = _dsp_sample_size(format) * channels;
+  rs->inRate = inRate;
+  rs->up = outRate / g;
+  rs->down = inRate / g;
+  rs->taps = _qualities[quality].taps * (int) widen;
+
+  /* the filter's history, a chunk of input, and the input that a
+     capped output may leave unused */
+  rs->capacity = rs->taps + RESAMPLE_CHUNK_FRAMES + 1;
+  rs->held = rs->taps - 1;
+  rs->next = rs->taps - 1;
+
+  rs->filter = (float *) malloc(rs->up * rs->taps * sizeof(float));
+  rs->history = (float *) calloc(rs->capacity * channels, sizeof(float));
+  rs->inWork = (float *) malloc(chunk * sizeof(float));
+  rs->outWork = (float *) malloc(chunk * sizeof(float));
+
+  if (rs->filter == NULL || rs->history == NULL || rs->inWork == NULL ||
+      rs->outWork == NULL) {
+    _resampler_free(rs);
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  _resampler_design(rs, _qualities[quality].rolloff,
+		    _qualities[quality].beta);
+  return rs;
+}
+
+void
+_resampler_free(_pyAudio_Resampler *rs)
+{
+  free(rs->filter);
+  free(rs->history);
+  free(rs->inWork);
+  free(rs->outWork);
+  free(rs);
+}
+
+/* computes up to maxOut frames of output from the input held, into
+   outWork */
+static unsigned long
+_resampler_run(_pyAudio_Resampler *rs, unsigned long maxOut)
+{
+  unsigned long done = 0;
+  int c;
+
+  while (done < maxOut && rs->next < rs->held) {
+    const float *phase = rs->filter + rs->phase * rs->taps;
+    const float *x = rs->history + rs->next - (rs->taps - 1);
+
+    for (c = 0; c < rs->channels; c++)
+      rs->outWork[done * rs->channels + c] =
+	_dsp_dot(phase, x + c * rs->capacity, rs->taps);
+
+    done++;
+    rs->phase += rs->down;
+    rs->next += rs->phase / rs->up;
+    rs->phase %= rs->up;
+  }
+
+  return done;
+}
+
+/* drops the input that no output depends on anymore */
+static void
+_resampler_compact(_pyAudio_Resampler *rs)
+{
+  unsigned long oldest =
+    (rs->next < rs->held ? rs->next : rs->held) - (rs->taps - 1);
+  int c;
+
+  if (oldest == 0)
+    return;
+
+  for (c = 0; c < rs->channels; c++) {
+    float *row = rs->history + c * rs->capacity;
+    memmove(row, row + oldest, (rs->held - oldest) * sizeof(float));
+  }
+
+  rs->held -= oldest;
+  rs->next -= oldest;
+}
+
+unsigned long
+_resampler_process(_pyAudio_Resampler *rs, const void *input,
+		   unsigned long frames, void *output, unsigned long maxOut)
+{
+  const char *in = (const char *) input;
+  char *out = (char *) output;
+  unsigned long produced = 0;
+  unsigned long n, i, m;
+  int c;
+
+  do {
+    n = rs->capacity - rs->held;
+    if (n > frames)
+      n = frames;
+    if (n > RESAMPLE_CHUNK_FRAMES)
+      n = RESAMPLE_CHUNK_FRAMES;
+
+    _dsp_to_float(rs->inWork, in, rs->format, n * rs->channels);
+    for (c = 0; c < rs->channels; c++) {
+      float *row = rs->history + c * rs->capacity + rs->held;
+      for (i = 0; i < n; i++)
+	row[i] = rs->inWork[i * rs->channels + c];
+    }
+    rs->held += n;
+    in += n * rs->frameSize;
+    frames -= n;
+
+    while (produced < maxOut) {
+      m = maxOut - produced;
+      if (m > RESAMPLE_CHUNK_FRAMES)
+	m = RESAMPLE_CHUNK_FRAMES;
+
+      m = _resampler_run(rs, m);
+      if (m == 0)
+	break;
+
+      _dsp_from_float(out + produced * rs->frameSize, rs->outWork,
+		      rs->format, m * rs->channels);
+      produced += m;
+    }
+
+    _resampler_compact(rs);
+  } while (frames > 0 && n > 0);
+
+  return produced;
+}
+
+unsigned long
+_resampler_output_frames(_pyAudio_Resampler *rs, unsigned long inFrames)
+{
+  unsigned long long ahead = (unsigned long long) rs->held + inFrames;
+
+  if (ahead <= rs->next)
+    return 0;
+
+  ahead -= rs->next;
+  return (unsigned long)
+    ((ahead * rs->up - rs->phase + rs->down - 1) / rs->down);
+}
+
+unsigned long
+_resampler_input_frames(_pyAudio_Resampler *rs, unsigned long outFrames)
+{
+  unsigned long long last;
+
+  if (outFrames == 0)
+    return 0;
+
+  last = rs->next + (rs->phase +
+		     (unsigned long long) (outFrames - 1) * rs->down) / rs->up;
+  return (last < rs->held) ? 0 : (unsigned long) (last + 1 - rs->held);
+}
+
+unsigned long
+_resampler_max_output_frames(_pyAudio_Resampler *rs,
+			     unsigned long inFrames)
+{
+  /* at most one unused frame of input is held between calls */
+  return (unsigned long)
+    (((unsigned long long) inFrames + 1) * rs->up / rs->down + 1);
+}
+
+unsigned long
+_resampler_max_input_frames(_pyAudio_Resampler *rs,
+			    unsigned long outFrames)
+{
+  /* the last output may have skipped past the input held */
+  return (unsigned long)
+    ((unsigned long long) outFrames * rs->down / rs->up +
+     rs->down / rs->up + 3);
+}
+
+double
+_resampler_latency(_pyAudio_Resampler *rs)
+{
+  return (rs->taps - 1) / 2.0 / rs->inRate;
+}
@@ -0,0 +1,115 @@
+/**
+ * PyAudio : Python Bindings for PortAudio.
+ *
+ * PyAudio : Sample rate conversion
+ *
+ * A streaming polyphase resampler between two integer sample rates,
+ * for exchanging audio at one rate with a device running at another.
+ * The filter is a Kaiser-windowed sinc, split into one phase per
+ * output position between two input frames, whose length and
+ * stopband depend on the quality. Input and output are interleaved
+ * frames of one of the formats that _dsp_sample_size knows.
+ *
+ * Copyright (c) 2006-2008 Hubert Pham
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __PARESAMPLE_H__
+#define __PARESAMPLE_H__
+
+#include "portaudio.h"
+
+/* qualities: taps when upsampling, times ceil(inRate / outRate) when
+   downsampling, which keeps the stopband */
+#define RESAMPLE_QUALITY_LOW 0      /* 16 taps, ~60 dB stopband */
+#define RESAMPLE_QUALITY_MEDIUM 1   /* 32 taps, ~80 dB stopband */
+#define RESAMPLE_QUALITY_HIGH 2     /* 64 taps, ~100 dB stopband */
+
+typedef struct {
+  int channels;
+  PaSampleFormat format;
+  unsigned long frameSize;
+  unsigned long inRate;
+
+  /* the rates' ratio, outRate / inRate, in lowest terms */
+  unsigned long up;
+  unsigned long down;
+
+  /* up phases of taps coefficients each */
+  int taps;
+  float *filter;
+
+  /* the input not yet done with, one row of capacity frames per
+     channel */
+  float *history;
+  unsigned long capacity;
+  unsigned long held;
+  /* the newest input frame that the next output depends on, and the
+     output's position after it, in 1/up frames */
+  unsigned long next;
+  unsigned long phase;
+
+  float *inWork;
+  float *outWork;
+} _pyAudio_Resampler;
+
+/* Returns NULL with errno set to EINVAL if the rates' ratio needs too
+   many phases or taps (or a rate is 0), or to ENOMEM. */
+_pyAudio_Resampler *
+_resampler_new(int channels, PaSampleFormat format, unsigned long inRate,
+	       unsigned long outRate, int quality);
+
+void
+_resampler_free(_pyAudio_Resampler *rs);
+
+/* Resamples frames frames of input, writing at most maxOut frames of
+   output; returns the number written. All input is consumed if
+   maxOut is at least _resampler_output_frames(rs, frames), or if
+   frames is at most _resampler_input_frames(rs, maxOut). */
+unsigned long
+_resampler_process(_pyAudio_Resampler *rs, const void *input,
+		   unsigned long frames, void *output, unsigned long maxOut);
+
+/* the number of frames that inFrames more frames of input yield */
+unsigned long
+_resampler_output_frames(_pyAudio_Resampler *rs, unsigned long inFrames);
+
+/* the number of frames of input needed for outFrames more frames of
+   output */
+unsigned long
+_resampler_input_frames(_pyAudio_Resampler *rs, unsigned long outFrames);
+
+/* upper bounds of the two above, whatever the resampler's state, for
+   sizing buffers */
+unsigned long
+_resampler_max_output_frames(_pyAudio_Resampler *rs,
+			     unsigned long inFrames);
+
+unsigned long
+_resampler_max_input_frames(_pyAudio_Resampler *rs,
+			    unsigned long outFrames);
+
+/* how far the output lags behind the input, in seconds */
+double
+_resampler_latency(_pyAudio_Resampler *rs);
+
+#endif
@@ -54,9 +54,15 @@
     See: `paInputOverflow`, `paInputUnderflow`, `paOutputOverflow`,
     `paOutputUnderflow`, `paPrimingOutput`
 
+:var PaStreamFlags:
+    A list of all PortAudio stream flags.
+
+    See: `paNoFlag`, `paClipOff`, `paDitherOff`, `paNeverDropInput`,
+    `paPrimeOutputBuffersUsingStreamCallback`, `paPlatformSpecificFlags`
+
 :group PortAudio Constants:
   PaSampleFormat, PaHostApiTypeId, PaErrorCode, PaCallbackReturnCode,
-  PaStreamCallbackFlags
+  PaStreamCallbackFlags, PaStreamFlags
 
 :group PaSampleFormat Values:
   paFloat32, paInt32, paInt24, paInt16,
@@ -93,6 +99,10 @@
     paInputOverflow, paInputUnderflow, paOutputOverflow, paOutputUnderflow,
     paPrimingOutput
 
+:group PaStreamFlags Values:
+    paNoFlag, paClipOff, paDitherOff, paNeverDropInput,
+    paPrimeOutputBuffersUsingStreamCallback, paPlatformSpecificFlags
+
 :group Stream Conversion Convenience Functions:
   get_sample_size, get_format_from_width
 
@@ -100,7 +110,7 @@
   get_portaudio_version, get_portaudio_version_text
 
 :sort: PaSampleFormat, PaHostApiTypeId, PaErrorCode, PaCallbackReturnCode,
-       PaStreamCallbackFlags
+       PaStreamCallbackFlags, PaStreamFlags
 :sort: PortAudio Constants, PaSampleFormat Values,
        PaHostApiTypeId Values, PaErrorCode Values
 
@@ -110,7 +120,12 @@ __author__ = "Hubert Pham"
 __version__ = "0.2.7.1"
 __docformat__ = "restructuredtext en"
 
+import inspect
+import os
+import struct
 import sys
+import threading
+import time
 
 # attempt to import PortAudio
 try:
@@ -241,6 +256,33 @@ PaStreamCallbackFlags = ['paInputOverflow', 'paInputUnderflow',
                          'paOutputOverflow', 'paOutputUnderflow',
                          'paPrimingOutput']
 
+###### portaudio stream flags ######
+paNoFlag = pa.paNoFlag
+paClipOff = pa.paClipOff
+paDitherOff = pa.paDitherOff
+paNeverDropInput = pa.paNeverDropInput
+paPrimeOutputBuffersUsingStreamCallback = \
+    pa.paPrimeOutputBuffersUsingStreamCallback
+paPlatformSpecificFlags = pa.paPlatformSpecificFlags
+
+# group them together for epydoc
+PaStreamFlags = ['paNoFlag', 'paClipOff', 'paDitherOff',
+                 'paNeverDropInput',
+                 'paPrimeOutputBuffersUsingStreamCallback',
+                 'paPlatformSpecificFlags']
+
+###### frames_per_buffer tried by Stream(auto_tune=) ######
+
+_auto_tune_frames = (32, 64, 128, 256, 512, 1024, 2048, 4096)
+
+###### Stream resample_quality values ######
+
+_resample_qualities = {'low' : 0, 'medium' : 1, 'high' : 2}
+
+###### returned by Stream.read_array: (frames, channels), ######
+###### column-major for non_interleaved streams ######
+SampleBuffer = pa.SampleBuffer
+
 ############################################################
 # Convenience Functions
 ############################################################
@@ -290,6 +332,28 @@ def get_format_from_width(width, unsigned = True):
     else:
         raise ValueError("Invalid width: %d" % width)
 
+def convert(buf, src_format, dst_format):
+    """
+    Convert samples from one `PaSampleFormat` to another.
+
+    The conversion runs in C, using SSE2 or AVX2 instructions where
+    the CPU supports them (except for `paInt24`). Floating point
+    samples range from -1.0 to 1.0; integer results are clipped to
+    their range, and NaN converts as -1.0. Channels do not matter, as
+    every sample is converted on its own.
+
+    :param `buf`: The samples, in any contiguous object supporting
+      the buffer protocol, such as `bytes` or a numpy array.
+    :param `src_format`: The `PaSampleFormat` of `buf`.
+    :param `dst_format`: The `PaSampleFormat` to convert to.
+
+    :raises ValueError: for `paCustomFormat`, or if `buf` does not
+      hold a whole number of samples.
+    :rtype: bytes
+    """
+
+    return pa.convert(buf, src_format, dst_format)
+
 
 ############################################################
 # Versioning
@@ -311,6 +375,157 @@ def get_portaudio_version_text():
 
     return pa.get_version_text()
 
+############################################################
+# Processing Graph
+############################################################
+
+class ProcessingGraph:
+    """
+    A chain of simple processing steps that PyAudio runs on a stream's
+    input inside the PortAudio callback, without entering the Python
+    interpreter.
+
+    Pass it to `PyAudio.open` as `processing`. Steps are added in
+    order, and each returns the graph so that calls can be chained::
+
+      graph = ProcessingGraph().channel_map([1, 0]).gain(0.5)
+
+    Samples are processed as 32-bit floats; the stream's input is
+    converted from its format first, and the result is converted to
+    the stream's format (or the one set with `format`) at the end.
+    Integer results are clipped to their range.
+
+    A stream copies the graph when it is opened; later changes to
+    the graph do not affect it.
+    """
+
+    def __init__(self):
+        self._nodes = []
+
+    def gain(self, gain):
+        """
+        Multiply the samples by `gain`.
+
+        :param `gain`: A number, or a sequence of one gain per channel.
+        :rtype: `ProcessingGraph`
+        """
+
+        self._nodes.append(('gain', gain))
+        return self
+
+    def channel_map(self, channels):
+        """
+        Reorder, duplicate or drop channels.
+
+        :param `channels`: For each output channel, the index of the
+           input channel it is copied from, or -1 for silence. E.g.
+           ``[1, 0]`` swaps the channels of a stereo signal and ``[0,
+           0]`` turns its left channel into dual mono.
+        :rtype: `ProcessingGraph`
+        """
+
+        self._nodes.append(('channel_map', list(channels)))
+        return self
+
+    def mix(self, matrix):
+        """
+        Mix channels together.
+
+        :param `matrix`: One row per output channel, each with one
+           coefficient per input channel: output channel *i* is the
+           sum of input channel *j* times ``matrix[i][j]``. E.g.
+           ``[[0.5, 0.5]]`` downmixes stereo to mono.
+        :rtype: `ProcessingGraph`
+        """
+
+        self._nodes.append(('mix', list(matrix)))
+        return self
+
+    def format(self, format):
+        """
+        Set the sample format of the result. Must be the last step.
+
+        :param `format`: A `PaSampleFormat` constant, other than
+           `paCustomFormat`.
+        :rtype: `ProcessingGraph`
+        """
+
+        self._nodes.append(('format', format))
+        return self
+
+
+############################################################
+# WAV Files (Internal)
+############################################################
+
+_WAVE_FORMAT_PCM = 0x0001
+_WAVE_FORMAT_IEEE_FLOAT = 0x0003
+_WAVE_FORMAT_EXTENSIBLE = 0xFFFE
+
+def _parse_wave_header(f, file_size):
+    """
+    Parse the header of a RIFF WAVE file, for
+    `PyAudio.open_file_playback`.
+
+    :param `f`: The file, positioned at its start.
+    :param `file_size`: The size of the file in bytes.
+    :raises ValueError: if it is a WAV file, but not one that can be
+       played.
+    :returns: (format, channels, rate, data offset, frames), or None
+       if `f` is not a WAV file.
+    """
+
+    header = f.read(12)
+    if len(header) < 12 or header[0:4] != b'RIFF' or header[8:12] != b'WAVE':
+        return None
+
+    fmt = None
+    while True:
+        chunk = f.read(8)
+        if len(chunk) < 8:
+            raise ValueError("WAV file has no data chunk")
+
+        chunk_id, size = struct.unpack('<4sI', chunk)
+
+        if chunk_id == b'fmt ':
+            body = f.read(size)
+            if len(body) < 16:
+                raise ValueError("Invalid WAV fmt chunk")
+
+            (tag, channels, rate, byte_rate,
+             block_align, bits) = struct.unpack('<HHIIHH', body[:16])
+            if tag == _WAVE_FORMAT_EXTENSIBLE and len(body) >= 26:
+                tag = struct.unpack('<H', body[24:26])[0]
+
+            formats = {(_WAVE_FORMAT_PCM, 8): paUInt8,
+                       (_WAVE_FORMAT_PCM, 16): paInt16,
+                       (_WAVE_FORMAT_PCM, 24): paInt24,
+                       (_WAVE_FORMAT_PCM, 32): paInt32,
+                       (_WAVE_FORMAT_IEEE_FLOAT, 32): paFloat32}
+
+            if (tag, bits) not in formats or \
+                   block_align != channels * bits // 8 or channels == 0:
+                raise ValueError("Unsupported WAV sample format")
+
+            fmt = (formats[(tag, bits)], channels, rate)
+            f.seek(size & 1, 1)
+
+        elif chunk_id == b'data':
+            if fmt is None:
+                raise ValueError("WAV file has no fmt chunk")
+
+            offset = f.tell()
+            # streamed WAV files may not know their data size
+            available = max(file_size - offset, 0)
+            if size == 0xFFFFFFFF or size > available:
+                size = available
+
+            return fmt + (offset, size // block_align)
+
+        else:
+            f.seek(size + (size & 1), 1)
+
+
 ############################################################
 # Wrapper around _portaudio Stream (Internal)
 ############################################################
@@ -327,13 +542,24 @@ class Stream:
       __init__, close
 
     :group Stream Info:
-      get_input_latency, get_output_latency, get_time, get_cpu_load
+      get_input_latency, get_output_latency, get_resample_latency,
+      get_auto_tune_results, get_time, get_cpu_load
 
     :group Stream Management:
       start_stream, stop_stream, is_active, is_stopped
 
     :group Input Output:
-      write, read, get_read_available, get_write_available
+      write, write_many, read, read_into, read_array,
+      read_available_now, get_read_available, get_write_available
+
+    :group Readiness:
+      fileno, set_notify_watermarks
+
+    :group Metering:
+      get_levels
+
+    :group Mixing:
+      add_voice
 
     """
 
@@ -350,7 +576,26 @@ class Stream:
                  start = True,
                  input_host_api_specific_stream_info = None,
                  output_host_api_specific_stream_info = None,
-                 stream_callback = None):
+                 stream_callback = None,
+                 zero_copy_input = False,
+                 zero_copy_output = False,
+                 callback_thread = False,
+                 ring_buffer_frames = None,
+                 batch_periods = 1,
+                 processing = None,
+                 playback_file = None,
+                 record_file = None,
+                 non_interleaved = False,
+                 notify = False,
+                 metering = False,
+                 mixer_voices = 0,
+                 device_rate = None,
+                 resample_quality = 'medium',
+                 input_latency = 'low',
+                 output_latency = 'low',
+                 stream_flags = paClipOff,
+                 auto_tune = None,
+                 auto_tune_frames = None):
         """
         Initialize a stream; this should be called by
         `PyAudio.open`. A stream can either be input, output, or both.
@@ -413,6 +658,201 @@ class Stream:
             If the stream is not an output stream, the return must be just a
             flag (`paContinue`, `paComplete`, or `paAbort`) as described above for
             the return tuple.
+        :param `zero_copy_input`: Pass ``in_data`` to `stream_callback` as a
+            read-only ``memoryview`` directly over PortAudio's input buffer
+            instead of a copy. Defaults to False.
+
+            The memoryview is released when the callback returns, so it (and
+            anything viewing the same memory, such as an array created with
+            ``numpy.frombuffer``) must not be kept beyond the callback. Copy
+            the data (e.g. ``bytes(in_data)``) if it must outlive the call.
+            Using such a buffer after the callback returns is undefined
+            behavior: PortAudio reuses or frees the memory beneath it. If
+            one is still alive when the callback returns, the stream is
+            aborted and a `RuntimeError` is printed.
+        :param `zero_copy_output`: Let `stream_callback` write its output
+            directly into PortAudio's output buffer. Requires `output`.
+            Defaults to False.
+
+            The callback must then conform to the signature
+            ``callback(in_data, out_data, frame_count, time_info, flags)``,
+            where ``out_data`` is a writable ``memoryview`` of exactly
+            ``frame_count`` frames. Its initial contents are undefined, so
+            the callback must fill all of it (e.g. via
+            ``numpy.frombuffer(out_data, dtype)``). The return value is just
+            the flag (`paContinue`, `paComplete`, or `paAbort`). As with
+            `zero_copy_input`, ``out_data`` is released when the callback
+            returns, and writing through anything kept from it afterwards
+            is undefined behavior: it writes into memory that PortAudio
+            has taken back. The stream is aborted if such a buffer
+            outlives the callback.
+        :param `callback_thread`: Run `stream_callback` on a dedicated Python
+            worker thread instead of PortAudio's real-time thread. Defaults
+            to False.
+
+            PortAudio's thread then only moves audio through lock-free ring
+            buffers and never waits for the Python interpreter, so a busy
+            interpreter (garbage collection, a long computation in another
+            thread) no longer causes glitches as long as the worker keeps
+            up on average. The worker runs the callback ahead of time to keep
+            the output ring full; for duplex streams, the output ring starts
+            out filled with silence. Requires a fixed `frames_per_buffer`.
+
+            Underruns of the rings are reported to the callback as
+            ``paInputOverflow`` and ``paOutputUnderflow``. ``time_info`` is
+            estimated from the stream time and the ring fill levels.
+
+            This is also the cheaper choice in sub-interpreters, where
+            PortAudio's thread otherwise needs a fresh Python thread
+            state for every callback.
+        :param `ring_buffer_frames`: With `callback_thread`, the capacity of
+            each ring buffer in frames, rounded up to a power of two. Larger
+            rings tolerate longer stalls of the worker at the cost of latency
+            (up to one full ring). Defaults to four times
+            `frames_per_buffer` (times `batch_periods`).
+
+            Without a `stream_callback`, setting this opens the stream in
+            ring-buffered blocking mode: PortAudio runs an internal C
+            callback that moves audio between the device and rings of this
+            capacity, and `read` and `write` only copy to and from the
+            rings. They return without waiting whenever the ring has
+            enough data (read) or room (write), so a producer can queue
+            large bursts at once. Frames written before `start_stream` are
+            played first. Input that does not fit into a full ring is
+            dropped and missing output is replaced by silence; both are
+            counted, see `get_ring_buffer_stats`.
+        :param `batch_periods`: Call `stream_callback` only once every
+            this many periods of `frames_per_buffer` frames, with
+            ``frame_count`` equal to their sum. Defaults to 1. Requires a
+            fixed `frames_per_buffer`.
+
+            PortAudio keeps running at the small period, while PyAudio
+            collects input and plays output one period at a time, so the
+            per-callback overhead of entering Python is paid once per
+            batch. This adds `batch_periods` periods of latency: input is
+            only passed to the callback once the batch is complete, and
+            the output it returns is played during the following batch
+            (the first batch plays silence). The callback runs on
+            PortAudio's thread during the last period of each batch and
+            must finish within that one period, unless `callback_thread`
+            is set, in which case the worker runs the callback on whole
+            batches instead.
+        :param `processing`: A `ProcessingGraph` to run on the input,
+            inside the PortAudio callback. Requires `input` and a fixed
+            `frames_per_buffer`, and cannot be combined with
+            `callback_thread`, `ring_buffer_frames` or `batch_periods`.
+
+            Without a `stream_callback`, the graph's result is written
+            to the output, so it must have the stream's channels and
+            format, and the stream never enters the Python interpreter.
+            Otherwise, `stream_callback` becomes a tap that receives the
+            graph's result (in the graph's channels and format) as
+            ``in_data`` and returns the output as usual.
+        :param `non_interleaved`: Exchange audio as one buffer per
+            channel (planar) instead of interleaved frames, letting
+            PortAudio do the layout conversion. Defaults to False.
+
+            `read` then returns a list of one ``bytes`` object per
+            channel, and `write` and `read_into` take a sequence of
+            one buffer per channel. ``in_data`` for `stream_callback`
+            is a tuple of per-channel buffers (memoryviews with
+            `zero_copy_input`, as is ``out_data`` with
+            `zero_copy_output`), and an output callback returns a
+            sequence of per-channel buffers, optionally as
+            ``(channels, flag)``. Cannot be combined with
+            `callback_thread`, `ring_buffer_frames`, `batch_periods` or
+            `processing`.
+        :param `notify`: Make `fileno` available, a file descriptor
+            that select(), poll(), epoll or an event loop can wait on
+            to learn when `read` or `write` can go ahead without
+            blocking. Requires `ring_buffer_frames` and no
+            `stream_callback`, and a POSIX system. Defaults to False.
+            See also `PyAudio.open_async`.
+        :param `metering`: Keep track of the peak level, RMS level and
+            number of clipped samples of each input channel, inside
+            PortAudio's callback. Read them with `get_levels`.
+            Defaults to False.
+
+            Without a `stream_callback`, `processing` or
+            `ring_buffer_frames`, the callback does nothing else, so
+            a stream that only shows levels never enters the Python
+            interpreter; `read` is not available then. Requires
+            `input`, and on a duplex stream one of the options above.
+        :param `mixer_voices`: Mix the output from up to this many
+            voices inside PortAudio's callback, instead of taking it
+            from `write` or a `stream_callback`. See `add_voice`.
+            Requires an output-only stream in one of the formats
+            that `convert` takes, and cannot be combined with
+            `stream_callback`, `non_interleaved` or the other
+            callback options. Defaults to 0 (no mixer).
+        :param `device_rate`: Run the device at this sampling rate,
+            while `read`, `write` and `stream_callback` exchange audio
+            at `rate`. Defaults to None, the same as `rate`.
+
+            PortAudio's callback converts between the two rates in C
+            with a polyphase filter, on its way to and from the ring
+            buffers, so this requires ring-buffered blocking mode or
+            `callback_thread`. It is switched on by itself:
+            `ring_buffer_frames` defaults to eight times
+            `frames_per_buffer`, and `stream_callback` implies
+            `callback_thread`. `frames_per_buffer` is at `rate`, and
+            PortAudio's period is scaled to match. The filter delays
+            audio by half its length, at the rate it converts from:
+            15.5 samples with the ``'medium'`` filter, or about 0.3 ms
+            when converting from 48000 Hz up to a higher rate. When
+            converting down, the filter is longer by the ratio of the
+            rates, rounded up: from 48000 to 16000 Hz it delays audio
+            by 47.5 samples, or about 1 ms. `get_input_latency` and
+            `get_output_latency` include this delay, and
+            `get_resample_latency` reports it alone. Requires one of
+            the formats that `convert` takes.
+        :param `resample_quality`: With `device_rate`, the filter's
+            quality: ``'low'``, ``'medium'`` (the default) or
+            ``'high'``, which take 16, 32 and 64 multiply-adds per
+            sample of output (times the ratio of the rates, rounded
+            up, when converting down) and attenuate aliasing by about
+            60, 80 and 100 dB.
+        :param `input_latency`: The input latency to ask PortAudio
+            for: ``'low'`` (the default) or ``'high'`` for the input
+            device's ``defaultLowInputLatency`` or
+            ``defaultHighInputLatency``, or a number of seconds. The
+            host API rounds it to what the device can do; see
+            `get_input_latency` for the result. Ignored if `input` is
+            False.
+        :param `output_latency`: The same for output, with the output
+            device's ``defaultLowOutputLatency`` or
+            ``defaultHighOutputLatency``. Ignored if `output` is
+            False.
+        :param `stream_flags`: `PaStreamFlags` to open the stream
+            with, or-ed together. Defaults to `paClipOff`.
+        :param `auto_tune`: Find the smallest `frames_per_buffer`
+            that runs without glitches on this host, spending this
+            many seconds on each try. Requires `stream_callback`.
+            Defaults to None (no tuning).
+
+            The stream is opened and run with each of
+            `auto_tune_frames` in turn, from the smallest, and judged
+            by `get_xrun_counts`, `get_callback_stats` and, if
+            ring-buffered, `get_ring_buffer_stats`: a try fails as soon
+            as the device reports an xrun, a ring runs over or a
+            callback misses its deadline. If none of them run
+            glitch-free, the largest is tried once more with
+            ``'high'`` latencies. The stream is then reopened with
+            the first configuration that passed (or the last one
+            tried), so that its statistics start afresh, and started
+            if `start` is True. `stream_callback` runs, and plays or
+            records as usual, during the tries. See
+            `get_auto_tune_results`.
+        :param `auto_tune_frames`: The `frames_per_buffer` values that
+            `auto_tune` tries, in order. Defaults to the powers of two
+            from 32 below `frames_per_buffer`, then
+            `frames_per_buffer` itself; 0
+            (``paFramesPerBufferUnspecified``) is never tried. If
+            none of them can be opened, the stream is opened as
+            asked, without tuning.
+        :param `playback_file`: Internal; used by
+            `PyAudio.open_file_playback`.
+        :param `record_file`: Internal; used by `PyAudio.open_recorder`.
 
 
         :raise ValueError: Neither input nor output
@@ -438,6 +878,7 @@ class Stream:
         self._rate = rate
         self._channels = channels
         self._format = format
+        self._non_interleaved = non_interleaved
         self._frames_per_buffer = frames_per_buffer
 
         arguments = {
@@ -462,23 +903,210 @@ class Stream:
                 'output_host_api_specific_stream_info'
                 ] = _l._get_host_api_stream_object()
 
+        if device_rate is not None and device_rate != rate:
+            if resample_quality not in _resample_qualities:
+                raise ValueError("resample_quality must be 'low', "
+                                 "'medium' or 'high'")
+
+            arguments[ 'device_rate' ] = device_rate
+            arguments[ 'resample_quality' ] = \
+                _resample_qualities[resample_quality]
+
+            # resampling happens on the way through the rings
+            if stream_callback:
+                callback_thread = True
+            elif not ring_buffer_frames:
+                ring_buffer_frames = 8 * frames_per_buffer
+
         if stream_callback:
             arguments[ 'stream_callback' ] = stream_callback
 
-        # calling pa.open returns a stream object
-        self._stream = pa.open(**arguments)
+        if zero_copy_input:
+            arguments[ 'zero_copy_input' ] = True
+
+        if zero_copy_output:
+            arguments[ 'zero_copy_output' ] = True
+
+        if callback_thread:
+            arguments[ 'callback_thread' ] = True
+
+        if ring_buffer_frames:
+            arguments[ 'ring_buffer_frames' ] = ring_buffer_frames
+
+        if batch_periods != 1:
+            arguments[ 'batch_periods' ] = batch_periods
+
+        if processing is not None:
+            arguments[ 'processing' ] = processing._nodes
+
+        if playback_file is not None:
+            arguments[ 'playback_file' ] = playback_file
+
+        if record_file is not None:
+            arguments[ 'record_file' ] = record_file
+
+        if non_interleaved:
+            arguments[ 'non_interleaved' ] = True
+
+        if notify:
+            arguments[ 'notify' ] = True
+
+        if metering:
+            arguments[ 'metering' ] = True
 
-        self._input_latency = self._stream.inputLatency
-        self._output_latency = self._stream.outputLatency
+        if mixer_voices:
+            arguments[ 'mixer_voices' ] = mixer_voices
+
+        arguments[ 'input_latency' ] = input_latency
+        arguments[ 'output_latency' ] = output_latency
+        arguments[ 'stream_flags' ] = stream_flags
+
+        self._auto_tune_results = None
+        if auto_tune:
+            if not stream_callback:
+                raise ValueError("auto_tune requires a stream_callback")
+
+            self._auto_tune(arguments, callback_thread, auto_tune,
+                            auto_tune_frames)
+
+        self._open(arguments, callback_thread)
 
         if self._is_running:
             pa.start_stream(self._stream)
 
 
+    def _open(self, arguments, callback_thread):
+        # calling pa.open returns a stream object
+        self._stream = pa.open(**arguments)
+
+        self._input_latency = self._stream.inputLatency + \
+                              self._stream.inputResampleLatency
+        self._output_latency = self._stream.outputLatency + \
+                               self._stream.outputResampleLatency
+
+        # start the worker first so that it can fill the output ring
+        self._callback_worker = None
+        if callback_thread:
+            try:
+                self._callback_worker = self._start_worker(daemon = True)
+            except RuntimeError:
+                # isolated sub-interpreters do not allow daemon
+                # threads; close() stops and joins the worker either
+                # way
+                self._callback_worker = self._start_worker(daemon = False)
+
+    def _start_worker(self, daemon):
+        worker = threading.Thread(target = pa.run_stream_callback_worker,
+                                  args = (self._stream,),
+                                  name = "PyAudio callback worker",
+                                  daemon = daemon)
+        worker.start()
+        return worker
+
+    def _auto_tune(self, arguments, callback_thread, warm_up, frames):
+        if frames is None:
+            frames = [f for f in _auto_tune_frames
+                      if not self._frames_per_buffer or
+                      f < self._frames_per_buffer]
+            frames.append(self._frames_per_buffer)
+
+        requested = (arguments['frames_per_buffer'],
+                     arguments['input_latency'],
+                     arguments['output_latency'])
+
+        # paFramesPerBufferUnspecified is no size to try
+        tries = [(f, requested[1], requested[2]) for f in frames if f]
+        if tries and (tries[-1][1], tries[-1][2]) != ('high', 'high'):
+            tries.append((tries[-1][0], 'high', 'high'))
+
+        self._auto_tune_results = []
+        chosen = None
+        for frames_per_buffer, input_latency, output_latency in tries:
+            arguments[ 'frames_per_buffer' ] = frames_per_buffer
+            arguments[ 'input_latency' ] = input_latency
+            arguments[ 'output_latency' ] = output_latency
+
+            # the host may refuse some sizes outright
+            try:
+                self._open(arguments, callback_thread)
+            except IOError:
+                continue
+
+            try:
+                result = self._warm_up(warm_up)
+            finally:
+                self._close()
+
+            result['frames_per_buffer'] = frames_per_buffer
+            self._auto_tune_results.append(result)
+            chosen = (frames_per_buffer, input_latency, output_latency)
+            if result['glitch_free']:
+                break
+
+        # if nothing opened, open what the caller asked for
+        (arguments[ 'frames_per_buffer' ],
+         arguments[ 'input_latency' ],
+         arguments[ 'output_latency' ]) = chosen or requested
+
+        self._frames_per_buffer = arguments['frames_per_buffer']
+
+    def _warm_up(self, duration):
+        # runs the stream for duration seconds, or until it glitches
+        pa.start_stream(self._stream)
+
+        deadline = time.monotonic() + duration
+        while True:
+            time.sleep(min(0.01, duration))
+            xruns = self._count_glitches()
+            if sum(xruns.values()) or \
+               not pa.is_stream_active(self._stream) or \
+               time.monotonic() >= deadline:
+                break
+
+        pa.stop_stream(self._stream)
+
+        stats = pa.get_stream_callback_stats(self._stream)
+        xruns = self._count_glitches()
+
+        return {'input_latency' : self._input_latency,
+                'output_latency' : self._output_latency,
+                'xruns' : xruns['xruns'],
+                'ring_xruns' : xruns['ring_xruns'],
+                'deadline_misses' : xruns['deadline_misses'],
+                'callbacks' : stats['callbacks'],
+                'max_callback_time' : stats['total']['max'],
+                'glitch_free' : stats['callbacks'] > 0 and
+                                not sum(xruns.values())}
+
+    def _count_glitches(self):
+        counts = pa.get_stream_xrun_counts(self._stream)
+        xruns = sum(n for kind, n in counts.items()
+                    if kind != 'priming_output')
+
+        # with a stream_callback, only callback_thread uses rings
+        ring_xruns = 0
+        if self._callback_worker:
+            rings = pa.get_stream_ring_buffer_stats(self._stream)
+            ring_xruns = rings.get('input_overflows', 0) + \
+                         rings.get('output_underflows', 0)
+
+        stats = pa.get_stream_callback_stats(self._stream)
+        return {'xruns' : xruns,
+                'ring_xruns' : ring_xruns,
+                'deadline_misses' : stats['deadline_misses']}
+
+    def _close(self):
+        pa.close(self._stream)
+
+        # pa.close stops the worker; wait for its thread to finish
+        worker = self._callback_worker
+        if worker and worker is not threading.current_thread():
+            worker.join()
+
     def close(self):
         """ Close the stream """
 
-        pa.close(self._stream)
+        self._close()
 
         self._is_running = False
 
@@ -491,22 +1119,59 @@ class Stream:
 
     def get_input_latency(self):
         """
-        Return the input latency.
+        Return the input latency, including the delay of resampling
+        with `device_rate`.
 
         :rtype: float
         """
 
-        return self._stream.inputLatency
+        return self._stream.inputLatency + self._stream.inputResampleLatency
 
 
     def get_output_latency(self):
         """
-        Return the input latency.
+        Return the output latency, including the delay of resampling
+        with `device_rate`.
 
         :rtype: float
         """
 
-        return self._stream.outputLatency
+        return self._stream.outputLatency + \
+            self._stream.outputResampleLatency
+
+    def get_resample_latency(self):
+        """
+        Return the delay that resampling with `device_rate` adds to
+        the input and output latency, in seconds: half the filter's
+        length, at the rate it runs at.
+
+        :returns: A dictionary with the keys ``input`` and ``output``,
+           0.0 for a stream without `device_rate`.
+        :rtype: dict
+        """
+
+        return {'input' : self._stream.inputResampleLatency,
+                'output' : self._stream.outputResampleLatency}
+
+    def get_auto_tune_results(self):
+        """
+        Return what `auto_tune` found, one dictionary per try, in
+        the order tried; the last is the configuration the stream
+        runs with.
+
+        Each dictionary has the keys ``frames_per_buffer``,
+        ``input_latency`` and ``output_latency`` (as reported by
+        PortAudio, in seconds), ``callbacks`` and
+        ``max_callback_time`` (see `get_callback_stats`), the
+        ``xruns``, ``ring_xruns`` and ``deadline_misses`` seen, and
+        ``glitch_free``. Tries end early at the first glitch.
+
+        :returns: A list of dictionaries, or None for a stream
+           opened without `auto_tune`.
+        :rtype: list
+        """
+
+        return self._auto_tune_results
 
     def get_time(self):
         """
@@ -530,6 +1195,63 @@ class Stream:
 
         return pa.get_stream_cpu_load(self._stream)
 
+    def get_callback_stats(self):
+        """
+        Return timing statistics of the stream callback.
+
+        Each callback is timed from when PortAudio calls into PyAudio
+        until it returns, and split into ``gil_wait`` (waiting for the
+        Python interpreter lock), ``callback`` (running the Python
+        callback and copying its output) and ``total``. For every
+        phase, the dictionary holds a ``histogram`` of callback counts,
+        along with the ``sum`` and ``max`` of the durations in seconds.
+        The histogram buckets are bounded above by ``bucket_limits``
+        (in seconds, doubling from 1 microsecond); the last bucket is
+        open-ended. ``callbacks`` is the number of callbacks timed and
+        ``deadline_misses`` the number that took longer than the
+        duration of their buffer (``frame_count / rate``).
+
+        With `callback_thread`, the worker's calls are timed instead,
+        and ``gil_wait`` is always zero.
+
+        The statistics accumulate from when the stream was opened, or
+        from the last call to `reset_callback_stats`.
+
+        :raises ValueError: if the stream has no `stream_callback`.
+        :rtype: dict
+        """
+
+        return pa.get_stream_callback_stats(self._stream)
+
+    def reset_callback_stats(self):
+        """
+        Reset the statistics returned by `get_callback_stats`.
+
+        :raises ValueError: if the stream has no `stream_callback`.
+        """
+
+        pa.reset_stream_callback_stats(self._stream)
+
+    def get_xrun_counts(self):
+        """
+        Return how often PortAudio reported each kind of buffer
+        underflow or overflow since the stream was opened.
+
+        The dictionary has the keys ``input_underflow``,
+        ``input_overflow``, ``output_underflow``, ``output_overflow``
+        and ``priming_output``, named after the callback status flags
+        (`paInputUnderflow` etc.). For callback streams, these count
+        the callbacks that had the flag set; for blocking streams,
+        the `read` calls that overflowed and the `write` calls that
+        underflowed. In ring-buffered blocking mode they count what
+        the device reported; overruns of the rings themselves are
+        counted separately, see `get_ring_buffer_stats`.
+
+        :rtype: dict
+        """
+
+        return pa.get_stream_xrun_counts(self._stream)
+
 
     ############################################################
     # Stream Management
@@ -571,33 +1293,119 @@ class Stream:
         return pa.is_stream_stopped(self._stream)
 
 
+    ############################################################
+    # File Playback
+    ############################################################
+
+    def seek(self, frame):
+        """
+        Move the playback position of a stream opened with
+        `PyAudio.open_file_playback`. Playback continues from there
+        at the next buffer. Seeking past the end plays nothing more.
+
+        Once a non-looping stream has played to the end it becomes
+        inactive; stop and restart it after seeking to play again.
+
+        :param `frame`: The frame to play next, counted from the start
+           of the audio data.
+        :raises ValueError: if the stream is not playing a file.
+        """
+
+        pa.seek_stream_playback(self._stream, frame)
+
+    def tell(self):
+        """
+        Return the frame that a stream opened with
+        `PyAudio.open_file_playback` plays next.
+
+        :raises ValueError: if the stream is not playing a file.
+        :rtype: int
+        """
+
+        return pa.get_stream_playback_position(self._stream)
+
+
+    ############################################################
+    # Recording
+    ############################################################
+
+    def get_recorder_stats(self):
+        """
+        Return the progress of a stream opened with
+        `PyAudio.open_recorder`, as a dictionary with the keys:
+
+        ``frames_written``
+            Frames written to disk so far, over all files.
+        ``frames_dropped``
+            Frames lost because the writer fell a whole buffer behind,
+            or after a write error.
+        ``queued_frames``
+            Frames waiting to be written.
+        ``files``
+            Number of files created so far.
+        ``error``
+            The ``errno`` of the first failed write, or 0. Nothing more
+            is written after an error.
+
+        :raises ValueError: if the stream is not recording.
+        :rtype: dict
+        """
+
+        return pa.get_stream_recorder_stats(self._stream)
+
+
     ############################################################
     # Reading/Writing
     ############################################################
 
     def write(self, frames, num_frames = None,
-              exception_on_underflow = False):
+              exception_on_underflow = False, timeout = None,
+              as_format = None):
 
         """
         Write samples to the stream.
 
 
         :param `frames`:
-           The frames of data.
+           The frames of data: any object supporting the buffer
+           protocol, such as `bytes`, `bytearray`, `array.array`,
+           `memoryview` or a numpy array. Contiguous buffers are
+           written without copying; strided views, for example a
+           slice of a numpy array, are gathered first.
+           For a `non_interleaved` stream, a sequence of one such
+           buffer per channel.
         :param `num_frames`:
            The number of frames to write.
-           Defaults to None, in which this value will be
-           automatically computed.
+           Defaults to None, in which case all whole frames in
+           `frames` (in its shortest channel buffer, for a
+           `non_interleaved` stream) are written.
         :param `exception_on_underflow`:
            Specifies whether an exception should be thrown
            (or silently ignored) on buffer underflow. Defaults
            to False for improved performance, especially on
            slower platforms.
+           In ring-buffered blocking mode, the exception
+           reports underflows since the previous write and
+           does not close the stream.
+        :param `timeout`:
+           Give up after this many seconds, having written only
+           part of `frames`. 0 writes only what fits without
+           blocking. Defaults to None, which waits until all of
+           `frames` is written.
+        :param `as_format`:
+           The `PaSampleFormat` of `frames`, if it differs from the
+           stream's. `frames` is then converted (see `convert`)
+           before it is written, and must be contiguous.
 
         :raises IOError: if the stream is not an output stream
-         or if the write operation was unsuccessful.
+         or if the write operation was unsuccessful. The exception's
+         ``frames_written`` attribute then holds the number of
+         frames written, as for `write_many`.
+        :raises ValueError: if `frames` holds fewer than
+         `num_frames` frames.
 
-        :rtype: `None`
+        :returns: With a `timeout`, the number of frames written.
+        :rtype: `None` or int
 
         """
 
@@ -606,35 +1414,229 @@ class Stream:
                           paCanNotWriteToAnInputOnlyStream)
 
         if num_frames == None:
-            # determine how many frames to read
-            width = get_sample_size(self._format)
-            num_frames = int(len(frames) / (self._channels * width))
-            #print len(frames), self._channels, self._width, num_frames
+            num_frames = -1
+
+        if timeout is None:
+            timeout = -1.0
+        elif timeout < 0:
+            raise ValueError("timeout must not be negative")
+
+        if as_format is not None and as_format != self._format:
+            frames = self._convert(frames, as_format, self._format)
+
+        return pa.write_stream(self._stream, frames, num_frames,
+                               exception_on_underflow, timeout)
+
+
+    def write_many(self, buffers, exception_on_underflow = False):
+        """
+        Write a sequence of buffers to the stream, back to back.
+
+        Equivalent to calling `write` on each buffer in turn, but
+        the buffers are all handed to PortAudio in a single call,
+        without returning to Python in between. Useful for queuing
+        many small packets at once.
+
+        :param `buffers`:
+           An iterable of objects supporting the buffer protocol,
+           as for `write`. Each must hold a whole number of frames.
+        :param `exception_on_underflow`:
+           As for `write`.
+
+        :raises IOError: if the stream is not an output stream
+         or if a write was unsuccessful. The exception's
+         ``frames_written`` attribute then holds the number of
+         frames written, which for an underflow includes the
+         buffer being written: its data is played regardless.
+        :raises ValueError: if a buffer does not hold a whole
+         number of frames, or for a `non_interleaved` stream.
+
+        :returns: The number of frames written.
+        :rtype: int
 
-        pa.write_stream(self._stream, frames, num_frames,
-                        exception_on_underflow)
+        """
 
+        if not self._is_output:
+            raise IOError("Not output stream",
+                          paCanNotWriteToAnInputOnlyStream)
+
+        return pa.write_stream_many(self._stream, buffers,
+                                    exception_on_underflow)
 
-    def read(self, num_frames):
+    def read(self, num_frames, exception_on_overflow = True,
+             timeout = None, as_format = None):
         """
         Read samples from the stream.
 
 
         :param `num_frames`:
            The number of frames to read.
+        :param `exception_on_overflow`:
+           Specifies whether an exception should be thrown
+           (or silently ignored) on input buffer overflow.
+           Defaults to True. Either way, the overflow is
+           counted in `get_xrun_counts`, or for an overflow
+           of the input ring since the previous read, in
+           `get_ring_buffer_stats`.
+        :param `timeout`:
+           Give up after this many seconds and return the frames
+           read so far, possibly fewer than `num_frames`. 0 reads
+           only what is available without blocking (see
+           `read_available_now`). Defaults to None, which waits for
+           all `num_frames` frames.
+        :param `as_format`:
+           Return the frames converted to this `PaSampleFormat`
+           (see `convert`), for example `paFloat32` from a
+           `paInt16` stream. Defaults to None, the stream's format.
+
+        :raises IOError: if stream is not an input stream
+         or if the read operation was unsuccessful.
+
+        :returns: The frames read, or a list of one ``bytes`` object
+         per channel for a `non_interleaved` stream.
+        :rtype: str
+
+        """
+
+        if not self._is_input:
+            raise IOError("Not input stream",
+                          paCanNotReadFromAnOutputOnlyStream)
+
+        if timeout is None:
+            timeout = -1.0
+        elif timeout < 0:
+            raise ValueError("timeout must not be negative")
+
+        data = pa.read_stream(self._stream, num_frames,
+                              exception_on_overflow, timeout)
+
+        if as_format is not None and as_format != self._format:
+            data = self._convert(data, self._format, as_format)
+
+        return data
+
+    def _convert(self, data, src_format, dst_format):
+        """ Convert `data`, or each channel of a `non_interleaved`
+        stream's data. """
+
+        if self._non_interleaved:
+            return [pa.convert(channel, src_format, dst_format)
+                    for channel in data]
+
+        return pa.convert(data, src_format, dst_format)
+
+    def read_available_now(self, max_frames, exception_on_overflow = True):
+        """
+        Read whatever input is available, up to `max_frames` frames,
+        without blocking.
+
+        Saves polling `get_read_available` before calling `read`, and
+        the race between the two. Same as ``read(max_frames,
+        timeout=0)``.
+
+        :param `max_frames`:
+           The largest number of frames to read.
+        :param `exception_on_overflow`:
+           As for `read`.
 
         :raises IOError: if stream is not an input stream
          or if the read operation was unsuccessful.
 
+        :returns: The frames read, possibly none, as from `read`.
         :rtype: str
 
         """
 
+        return self.read(max_frames, exception_on_overflow, 0)
+
+    def read_array(self, num_frames, exception_on_overflow = True,
+                   timeout = None):
+        """
+        Read samples from the stream into a new `SampleBuffer`.
+
+        The `SampleBuffer` exports the samples through the buffer
+        protocol as a 2-D array of shape ``(frames, channels)`` with
+        the struct format of the stream's sample format (``h`` for
+        `paInt16`, ``i`` for `paInt32`, ``f`` for `paFloat32`, ``b``
+        for `paInt8` and ``B`` for `paUInt8`), so that
+        ``numpy.asarray(buffer)`` or ``memoryview(buffer)`` view it
+        with the right type and shape, without a copy. For a
+        `non_interleaved` stream, the samples are stored channel after
+        channel and exported with column-major (Fortran) strides.
+
+        :param `num_frames`:
+           The number of frames to read.
+        :param `exception_on_overflow`:
+           As for `read`.
+        :param `timeout`:
+           As for `read`; the buffer then holds only the frames read.
+
+        :raises IOError: if stream is not an input stream
+         or if the read operation was unsuccessful.
+        :raises ValueError: for `paInt24`, which has no struct format.
+
+        :rtype: `SampleBuffer`
+
+        """
+
+        if not self._is_input:
+            raise IOError("Not input stream",
+                          paCanNotReadFromAnOutputOnlyStream)
+
+        if timeout is None:
+            timeout = -1.0
+        elif timeout < 0:
+            raise ValueError("timeout must not be negative")
+
+        return pa.read_stream_array(self._stream, num_frames,
+                                    exception_on_overflow, timeout)
+
+    def read_into(self, buffer, num_frames = None,
+                  exception_on_overflow = True, timeout = None):
+        """
+        Read samples from the stream into `buffer`, without allocating.
+
+        Works like `read`, but writes to any contiguous, writable
+        object supporting the buffer protocol, such as a ``bytearray``,
+        a ``numpy`` array or a ``memoryview`` slice of an ``mmap``.
+
+        :param `buffer`:
+           Where to store the samples. For a `non_interleaved`
+           stream, a sequence of one buffer per channel.
+        :param `num_frames`:
+           The number of frames to read. Defaults to as many as
+           `buffer` holds, whose size must then be a multiple of the
+           frame size (or as many as the shortest channel buffer
+           holds, for a `non_interleaved` stream).
+        :param `exception_on_overflow`:
+           As for `read`.
+        :param `timeout`:
+           As for `read`; fewer frames than requested may then be
+           read.
+
+        :raises ValueError: if `buffer` is too small.
+        :raises IOError: if stream is not an input stream
+         or if the read operation was unsuccessful.
+
+        :returns: The number of frames read.
+        :rtype: int
+
+        """
+
         if not self._is_input:
             raise IOError("Not input stream",
                           paCanNotReadFromAnOutputOnlyStream)
 
-        return pa.read_stream(self._stream, num_frames)
+        if num_frames is None:
+            num_frames = -1
+
+        if timeout is None:
+            timeout = -1.0
+        elif timeout < 0:
+            raise ValueError("timeout must not be negative")
+
+        return pa.read_stream_into(self._stream, buffer, num_frames,
+                                   exception_on_overflow, timeout)
 
     def get_read_available(self):
         """
@@ -658,6 +1660,483 @@ class Stream:
 
         return pa.get_stream_write_available(self._stream)
 
+    def get_ring_buffer_stats(self):
+        """
+        Return the state of the ring buffers of a stream opened with
+        `callback_thread` or `ring_buffer_frames`.
+
+        The dictionary has the keys ``capacity`` (frames per ring),
+        ``input_frames`` and ``output_frames`` (frames currently queued
+        in each ring) and ``input_overflows`` and ``output_underflows``
+        (number of device periods in which the input ring was full or
+        the output ring ran dry since the stream was opened). Keys for
+        a direction the stream does not have are omitted.
+
+        :raises ValueError: if the stream is not ring-buffered.
+        :rtype: dict
+        """
+
+        return pa.get_stream_ring_buffer_stats(self._stream)
+
+
+    ############################################################
+    # Metering
+    ############################################################
+
+    def get_levels(self, reset = True):
+        """
+        Return the input levels of a stream opened with `metering`.
+
+        The dictionary has the keys ``frames`` (the number of frames
+        metered), and ``peak``, ``rms`` and ``clips``: lists with the
+        highest absolute sample value, the root mean square of the
+        samples (both from 0.0 to 1.0 of full scale) and the number
+        of samples at full scale, for each channel. The audio itself
+        is not transferred.
+
+        :param `reset`: Start over after returning the levels, so
+           that the next call covers only the input that arrives in
+           between. Defaults to True.
+
+        :raises ValueError: if the stream was not opened with
+           `metering`.
+        :rtype: dict
+        """
+
+        return pa.get_stream_levels(self._stream, reset)
+
+
+    ############################################################
+    # Readiness
+    ############################################################
+
+    def fileno(self):
+        """
+        Return a file descriptor that becomes readable when the stream
+        can be read from or written to, for select(), poll(), epoll and
+        event loops. Requires `notify`.
+
+        The descriptor stays readable exactly while a watermark is
+        reached (see `set_notify_watermarks`), so it needs no clearing:
+        by default, while a period of `frames_per_buffer` frames can be
+        read, or written, without blocking. Do not read from or close
+        the descriptor; it is closed with the stream.
+
+        :raises ValueError: if the stream was not opened with `notify`.
+        :rtype: int
+        """
+
+        return pa.get_stream_notify_fd(self._stream)
+
+    def set_notify_watermarks(self, read_frames = 0, write_frames = 0):
+        """
+        Signal `fileno` only while at least `read_frames` frames can
+        be read without blocking, or at least `write_frames` frames
+        can be written without blocking.
+
+        PortAudio's callback checks the watermarks after every period,
+        and `read` and `write` clear the descriptor again once neither
+        is reached, so waiting on it never wakes up for less. Both
+        start at one period, `frames_per_buffer` frames (or a quarter
+        of the ring buffer if it is unspecified), in the directions the
+        stream has; passing 0 for both returns to that.
+
+        :param `read_frames`: The input watermark, in frames, or 0 to
+           ignore input.
+        :param `write_frames`: The output watermark, in frames, or 0
+           to ignore output.
+
+        :raises ValueError: if the stream was not opened with `notify`,
+           or if a watermark is larger than the ring buffer (or given
+           for a direction the stream does not have).
+        """
+
+        pa.set_stream_notify_watermarks(self._stream, read_frames,
+                                        write_frames)
+
+
+    ############################################################
+    # Mixing
+    ############################################################
+
+    def add_voice(self, gain = 1.0, buffer_frames = None):
+        """
+        Start a new voice of a stream opened with `mixer_voices`.
+
+        Each voice has its own queue of audio, in the stream's
+        channels and format, which PortAudio's callback adds to the
+        output, times the voice's gain. A voice whose queue runs dry
+        is silent until more is written. Voices can be added, written
+        to and closed from any thread while the stream runs.
+
+        :param `gain`: The voice's initial gain. Defaults to 1.0.
+        :param `buffer_frames`: The capacity of the voice's queue in
+           frames, rounded up to a power of two. Defaults to half a
+           second.
+
+        :raises ValueError: if the stream was not opened with
+           `mixer_voices`.
+        :raises RuntimeError: if all voices are in use. A closed
+           voice is only reused once PortAudio's callback has let go
+           of it, so one closed while the stream is stopped stays in
+           use until the stream is started again.
+        :rtype: `Voice`
+        """
+
+        if buffer_frames is None:
+            buffer_frames = max(self._rate // 2, 1)
+
+        slot, generation = pa.add_stream_voice(self._stream, buffer_frames,
+                                               gain)
+        return Voice(self, slot, generation)
+
+
+############################################################
+# Mixer Voice
+############################################################
+
+class Voice:
+
+    """
+    One of the sources that a stream opened with `mixer_voices`
+    mixes. Use `Stream.add_voice` to make a new `Voice`.
+
+    A voice may be written to by one thread at a time, but any
+    thread may change its gain or close it, for example to cut off
+    a prompt while another thread is still writing it.
+
+    :group Input Output:
+      write, get_queued_frames
+
+    :group Voice Management:
+      set_gain, is_active, close
+
+    """
+
+    def __init__(self, stream, slot, generation):
+        """
+        Wrap a voice of `stream`; this should be called by
+        `Stream.add_voice`.
+        """
+
+        self._stream = stream
+        self._slot = slot
+        self._generation = generation
+
+    def write(self, frames, timeout = None, as_format = None):
+        """
+        Queue frames for playback.
+
+        :param `frames`: The frames of data, in the stream's channels
+           and format: any contiguous object supporting the buffer
+           protocol.
+        :param `timeout`: Give up after this many seconds, having
+           queued only part of `frames`. 0 queues only what fits
+           without blocking. Defaults to None, which waits until all
+           of `frames` is queued.
+        :param `as_format`: The `PaSampleFormat` of `frames`, if it
+           differs from the stream's. `frames` is then converted (see
+           `convert`) first.
+
+        :raises ValueError: if the voice is closed.
+        :raises IOError: if the voice's queue is full and the stream
+           is not running.
+        :returns: The number of frames queued, which is less than
+           given if the timeout expires or the voice is closed
+           meanwhile.
+        :rtype: int
+        """
+
+        if timeout is None:
+            timeout = -1.0
+        elif timeout < 0:
+            raise ValueError("timeout must not be negative")
+
+        stream = self._stream
+        if as_format is not None and as_format != stream._format:
+            frames = convert(frames, as_format, stream._format)
+
+        return pa.write_stream_voice(stream._stream, self._slot,
+                                     self._generation, frames, timeout)
+
+    def get_queued_frames(self):
+        """
+        Return the number of frames queued and not yet played, 0 once
+        the voice is closed.
+
+        :rtype: int
+        """
+
+        return self._info()['queued_frames']
+
+    def set_gain(self, gain):
+        """
+        Set the gain, which PortAudio's callback ramps to over its
+        next period, so that changes do not click.
+
+        :param `gain`: The factor the voice's samples are multiplied
+           by; 1.0 leaves them as they are.
+        """
+
+        pa.set_stream_voice_gain(self._stream._stream, self._slot,
+                                 self._generation, gain)
+
+    def is_active(self):
+        """
+        Return whether the voice is still mixed: until it is closed,
+        or with `drain`, until it has played what was queued.
+
+        :rtype: bool
+        """
+
+        return self._info()['active']
+
+    def close(self, drain = False):
+        """
+        Close the voice. Closing a voice twice does nothing.
+
+        :param `drain`: Play what is queued first. Defaults to False,
+           which drops it and silences the voice in PortAudio's next
+           period. A draining voice can still be closed without
+           `drain`.
+        """
+
+        pa.remove_stream_voice(self._stream._stream, self._slot,
+                               self._generation, drain)
+
+    def _info(self):
+        return pa.get_stream_voice_info(self._stream._stream, self._slot,
+                                        self._generation)
+
+
+############################################################
+# Asynchronous Stream
+############################################################
+
+class AsyncStream:
+
+    """
+    A ring-buffered `Stream` for use with ``asyncio``. Use
+    `PyAudio.open_async` to make a new `AsyncStream`.
+
+    PortAudio's callback moves audio between the device and the
+    stream's rings in C and signals a file descriptor that the event
+    loop watches once a period can be read or written (see
+    `Stream.set_notify_watermarks`). `read` and `write` copy
+    whatever the rings allow without blocking and otherwise wait
+    for that signal, so the event loop is never blocked on audio.
+    Iterating with ``async for`` yields blocks of
+    `frames_per_buffer` frames until the stream is stopped; input
+    overflows of the ring do not end it, but are counted in the
+    underlying stream's `Stream.get_ring_buffer_stats`.
+
+    Only one task should read and one task should write at a time.
+    Available on POSIX systems only.
+
+    :group Opening and Closing:
+      close
+
+    :group Stream Management:
+      start_stream, stop_stream, is_active, stream
+
+    :group Input Output:
+      read, write
+
+    """
+
+    def __init__(self, stream):
+        """
+        Wrap `stream`; this should be called by `PyAudio.open_async`.
+
+        :param `stream`: A `Stream` opened with `ring_buffer_frames`
+           and `notify`.
+        """
+
+        self._stream = stream
+        self._fd = stream.fileno()
+        self._frame_size = stream._channels * \
+                           get_sample_size(stream._format)
+        self._block_frames = stream._frames_per_buffer
+        self._loop = None
+        self._waiters = []
+        self._read_frames = 0
+        self._write_frames = 0
+
+    @property
+    def stream(self):
+        """ The underlying `Stream`. """
+
+        return self._stream
+
+    def close(self):
+        """ Close the stream, cancelling any pending `read` or
+        `write`. """
+
+        self._stop_waiting()
+        for waiter in self._waiters:
+            waiter.cancel()
+        self._waiters = []
+        self._stream.close()
+
+
+    ############################################################
+    # Stream Management
+    ############################################################
+
+    def start_stream(self):
+        """ Start the stream. """
+
+        self._stream.start_stream()
+
+    def stop_stream(self):
+        """ Stop the stream. Pending `read` and `write` calls raise
+        `IOError`, and ``async for`` loops end. """
+
+        self._stream.stop_stream()
+        self._wake()
+
+    def is_active(self):
+        """ Returns whether the stream is active.
+
+        :rtype: bool """
+
+        return self._stream.is_active()
+
+
+    ############################################################
+    # Input Output
+    ############################################################
+
+    async def read(self, num_frames, exception_on_overflow = True):
+        """
+        Read samples from the stream, waiting for the input to arrive.
+
+        :param `num_frames`: The number of frames to read.
+        :param `exception_on_overflow`: As for `Stream.read`.
+
+        :raises IOError: if the stream is stopped before `num_frames`
+         frames were read, or if the read operation was unsuccessful.
+        :rtype: bytes
+        """
+
+        chunks = []
+        remaining = num_frames
+        while True:
+            data = self._stream.read_available_now(remaining,
+                                                   exception_on_overflow)
+            chunks.append(data)
+            remaining -= len(data) // self._frame_size
+            if remaining <= 0:
+                return b"".join(chunks)
+            await self._wait(read_frames = remaining)
+
+    async def write(self, frames, exception_on_underflow = False):
+        """
+        Write samples to the stream, waiting for room in the output
+        ring as needed.
+
+        :param `frames`: The frames of data, as for `Stream.write`.
+        :param `exception_on_underflow`: As for `Stream.write`.
+
+        :raises IOError: if the stream is stopped before all of
+         `frames` was written, or if the write operation was
+         unsuccessful.
+        """
+
+        view = memoryview(frames)
+        if not view.c_contiguous:
+            view = memoryview(view.tobytes())
+        view = view.cast('B')
+
+        offset = 0
+        end = len(view) - len(view) % self._frame_size
+        while True:
+            written = self._stream.write(view[offset:end], None,
+                                         exception_on_underflow, 0)
+            offset += written * self._frame_size
+            if offset >= end:
+                return
+            await self._wait(
+                write_frames = (end - offset) // self._frame_size)
+
+    def __aiter__(self):
+        return self
+
+    async def __anext__(self):
+        if not self.is_active():
+            raise StopAsyncIteration
+
+        try:
+            return await self.read(self._block_frames, False)
+        except IOError as err:
+            if err.args[1:] == (paStreamIsStopped,):
+                raise StopAsyncIteration
+            raise
+
+
+    ############################################################
+    # Event Loop Integration
+    ############################################################
+
+    async def _wait(self, read_frames = 0, write_frames = 0):
+        """
+        Wait until `read_frames` frames can be read, or `write_frames`
+        frames written, or a period's worth if that is less, or until
+        another waiting task's condition is met.
+        """
+
+        if not self.is_active():
+            raise IOError("Stream is stopped", paStreamIsStopped)
+
+        import asyncio
+        loop = asyncio.get_running_loop()
+
+        # only the directions waited on, so that a reader is not
+        # woken by room to write, and vice versa
+        block = max(self._block_frames, 1)
+        if read_frames:
+            self._read_frames = min(read_frames, block)
+        if write_frames:
+            self._write_frames = min(write_frames, block)
+        self._stream.set_notify_watermarks(self._read_frames,
+                                           self._write_frames)
+
+        if not self._waiters:
+            loop.add_reader(self._fd, self._wake)
+            self._loop = loop
+
+        waiter = loop.create_future()
+        self._waiters.append(waiter)
+        try:
+            await waiter
+        except BaseException:
+            if waiter in self._waiters:
+                self._waiters.remove(waiter)
+            if not self._waiters:
+                self._stop_waiting()
+            raise
+
+        if not self.is_active():
+            raise IOError("Stream is stopped", paStreamIsStopped)
+
+    def _wake(self):
+        """ Clear the descriptor and resume all waiting tasks. """
+
+        self._stop_waiting()
+        pa.clear_stream_notify(self._stream._stream)
+
+        waiters, self._waiters = self._waiters, []
+        for waiter in waiters:
+            if not waiter.done():
+                waiter.set_result(None)
+
+    def _stop_waiting(self):
+        self._read_frames = 0
+        self._write_frames = 0
+        if self._loop is not None:
+            self._loop.remove_reader(self._fd)
+            self._loop = None
+
 
 
 ############################################################
@@ -677,7 +2156,7 @@ class PyAudio:
     Use this class to open and close streams.
 
     :group Stream Management:
-      open, close
+      open, open_async, close
 
     :group Host API:
       get_host_api_count, get_default_host_api_info,
@@ -789,6 +2268,173 @@ class PyAudio:
         return stream
 
 
+    def open_async(self, *args, **kwargs):
+        """
+        Open a new stream for use with ``asyncio``. Takes the same
+        arguments as `Stream.__init__`, except for `stream_callback`
+        and the other callback options.
+
+        The stream runs in ring-buffered blocking mode; see
+        `ring_buffer_frames`, which defaults to eight times
+        `frames_per_buffer` here.
+
+        :raises ValueError: if a `stream_callback` is given.
+        :raises TypeError: for arguments that `Stream.__init__` would
+           not take.
+        :raises OSError: if the platform does not support it
+           (it requires a POSIX system).
+        :returns: `AsyncStream`
+        """
+
+        # name the arguments as Stream.__init__ would, positional or not
+        signature = inspect.signature(Stream.__init__)
+        arguments = signature.bind(None, self, *args, **kwargs).arguments
+        del arguments['self'], arguments['PA_manager']
+
+        if arguments.get('stream_callback') is not None:
+            raise ValueError("AsyncStream does not take a stream_callback")
+
+        if not arguments.get('ring_buffer_frames'):
+            frames_per_buffer = arguments.get(
+                'frames_per_buffer',
+                signature.parameters['frames_per_buffer'].default)
+            arguments['ring_buffer_frames'] = 8 * frames_per_buffer
+        arguments['notify'] = True
+
+        return AsyncStream(self.open(**arguments))
+
+
+    def open_file_playback(self, path, format = None, channels = None,
+                           rate = None, offset = 0, loop = False,
+                           **kwargs):
+        """
+        Open an output stream that plays a WAV or raw PCM file.
+
+        The file is memory-mapped and PortAudio's callback copies from
+        it directly, without entering the Python interpreter. The OS is
+        asked to read the audio data ahead of time when the stream is
+        opened and after every `Stream.seek`. Use `Stream.seek` and
+        `Stream.tell` to move and query the playback position.
+
+        WAV files with integer PCM or 32-bit float samples are
+        recognized by their header. For anything else (raw PCM),
+        `format`, `channels` and `rate` are required.
+
+        :param `path`: The file to play.
+        :param `format`: Sample format of a raw PCM file.
+        :param `channels`: Number of channels of a raw PCM file.
+        :param `rate`: Sampling rate of a raw PCM file.
+        :param `offset`: Where the audio data of a raw PCM file starts,
+           in bytes.
+        :param `loop`: Whether to start over at the end of the file,
+           instead of completing the stream. Defaults to False.
+        :param `kwargs`: Other arguments to `Stream.__init__`, such as
+           `output_device_index`, `frames_per_buffer` and `start`.
+
+        :raises ValueError: if the file's format cannot be determined
+           or is not supported.
+        :returns: `Stream`
+        """
+
+        f = open(path, 'rb')
+        try:
+            file_size = os.fstat(f.fileno()).st_size
+            header = _parse_wave_header(f, file_size)
+
+            if header:
+                format, channels, rate, offset, frames = header
+            elif format is None or channels is None or rate is None:
+                raise ValueError("Not a WAV file; format, channels and rate "
+                                 "are required")
+            else:
+                frame_size = channels * get_sample_size(format)
+                frames = max(file_size - offset, 0) // frame_size
+
+            kwargs.update(format = format,
+                          channels = channels,
+                          rate = rate,
+                          output = True,
+                          playback_file = (f.fileno(), offset, frames,
+                                           bool(loop)))
+
+            # the stream keeps its own mapping of the file
+            return self.open(**kwargs)
+        finally:
+            f.close()
+
+
+    def open_recorder(self, path, format, channels, rate,
+                      file_type = 'wav', rotate_seconds = None,
+                      rotate_bytes = None, buffer_seconds = 2.0,
+                      **kwargs):
+        """
+        Open an input stream that records to disk.
+
+        PortAudio's callback copies the input into a ring buffer, and a
+        native writer thread appends it to the file, without entering
+        the Python interpreter. The WAV header is brought up to date
+        about once a second, so the file stays readable if the process
+        dies. Closing the stream writes whatever is still buffered and
+        finishes the file.
+
+        The recorder can be combined with `stream_callback` (or the
+        other callback options, such as `ring_buffer_frames` for
+        `Stream.read`), which then sees the same input.
+
+        With `rotate_seconds` or `rotate_bytes`, a new file is started
+        whenever the current one is full. The files are named after
+        `path` with a four digit index before the extension, starting
+        from 0000: ``capture.wav`` becomes ``capture.0000.wav``,
+        ``capture.0001.wav`` and so on.
+
+        :param `path`: The file to write; it is overwritten.
+        :param `format`: Sampling size and format. See `PaSampleFormat`.
+        :param `channels`: Number of channels.
+        :param `rate`: Sampling rate.
+        :param `file_type`: ``'wav'`` or ``'raw'`` (headerless PCM).
+           Defaults to ``'wav'``.
+        :param `rotate_seconds`: Maximum duration of each file.
+        :param `rotate_bytes`: Maximum size of each file's audio data.
+        :param `buffer_seconds`: How long the writer may stall (e.g. on
+           a slow disk) before input is dropped. Defaults to 2 seconds.
+        :param `kwargs`: Other arguments to `Stream.__init__`, such as
+           `input_device_index`, `frames_per_buffer` and `start`.
+
+        :raises ValueError: if `format` cannot be stored in a WAV file
+           (`paInt8`) or `file_type` is unknown.
+        :raises IOError: if the first file cannot be created.
+        :returns: `Stream`
+        """
+
+        if file_type not in ('wav', 'raw'):
+            raise ValueError("file_type must be 'wav' or 'raw'")
+
+        wav = (file_type == 'wav')
+        if wav and format not in (paFloat32, paInt32, paInt24, paInt16,
+                                  paUInt8):
+            raise ValueError("Sample format not supported in WAV files")
+
+        frame_size = channels * get_sample_size(format)
+
+        rotate_frames = 0
+        if rotate_seconds:
+            rotate_frames = int(rotate_seconds * rate)
+        if rotate_bytes:
+            frames = rotate_bytes // frame_size
+            rotate_frames = min(rotate_frames, frames) if rotate_frames \
+                            else frames
+        if (rotate_seconds or rotate_bytes) and rotate_frames < 1:
+            raise ValueError("Files must hold at least one frame")
+
+        kwargs.update(format = format,
+                      channels = channels,
+                      rate = rate,
+                      input = True,
+                      record_file = (path, wav, rotate_frames,
+                                     max(int(buffer_seconds * rate), 1)))
+        return self.open(**kwargs)
+
+
     def close(self, stream):
         """
         Close a stream. Typically use `Stream.close` instead.
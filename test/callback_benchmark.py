@@ -0,0 +1,68 @@
+"""
+PyAudio microbenchmark: measure the per-callback overhead of the
+stream callback trampoline.
+
+Opens a duplex stream with a tiny block size and a callback that does
+no work of its own, then reports the process CPU time spent per
+callback. Since the callback body is empty, this is (almost) entirely
+the cost of the C trampoline: acquiring the GIL and building/parsing
+the callback arguments.
+
+Usage: %s [seconds] [frames_per_buffer]
+"""
+
+from __future__ import division
+import pyaudio
+import sys
+import time
+
+SECONDS = 5
+FRAMES_PER_BUFFER = 16
+CHANNELS = 2
+RATE = 44100
+FORMAT = pyaudio.paInt16
+
+if len(sys.argv) > 1:
+    SECONDS = float(sys.argv[1])
+if len(sys.argv) > 2:
+    FRAMES_PER_BUFFER = int(sys.argv[2])
+
+silence = b'\x00' * (FRAMES_PER_BUFFER * CHANNELS *
+                     pyaudio.get_sample_size(FORMAT))
+
+def callback(in_data, frame_count, time_info, status):
+    callback.calls += 1
+    return (silence, pyaudio.paContinue)
+
+callback.calls = 0
+
+p = pyaudio.PyAudio()
+
+stream = p.open(format = FORMAT,
+                channels = CHANNELS,
+                rate = RATE,
+                input = True,
+                output = True,
+                frames_per_buffer = FRAMES_PER_BUFFER,
+                stream_callback = callback,
+                start = False)
+
+cpu_start = time.process_time()
+wall_start = time.time()
+stream.start_stream()
+
+while time.time() - wall_start < SECONDS and stream.is_active():
+    time.sleep(0.1)
+
+stream.stop_stream()
+cpu = time.process_time() - cpu_start
+wall = time.time() - wall_start
+
+stream.close()
+p.terminate()
+
+calls = max(callback.calls, 1)
+print("callbacks:          %d (%.0f per second)" % (callback.calls,
+                                                    callback.calls / wall))
+print("cpu time:           %.3f s" % cpu)
+print("cpu per callback:   %.2f us" % (cpu / calls * 1e6))
@@ -0,0 +1,52 @@
+"""
+PyAudio Example:
+
+Test pyaudio.convert from floating point to each integer format,
+including values out of range and NaN, which must convert the same
+whether a sample falls to the vectorized loops or to the plain C
+tail after them. """
+
+import array
+import math
+import struct
+import pyaudio
+
+def f32(x):
+    return struct.unpack('f', struct.pack('f', x))[0]
+
+def clip(v):
+    if not v >= -1.0:
+        return -1.0
+    return min(v, 1.0)
+
+def int24(b):
+    return [struct.unpack('<i', b[i:i + 3] +
+                          (b'\xff' if b[i + 2] & 0x80 else b'\0'))[0]
+            for i in range(0, len(b), 3)]
+
+FORMATS = {
+    pyaudio.paInt32: (lambda v: int(clip(v) * 2147483647.0),
+                      lambda b: array.array('i', b).tolist()),
+    pyaudio.paInt24: (lambda v: int(f32(clip(v) * 8388607.0)), int24),
+    pyaudio.paInt16: (lambda v: int(f32(clip(v) * 32767.0)),
+                      lambda b: array.array('h', b).tolist()),
+    pyaudio.paInt8: (lambda v: int(f32(clip(v) * 127.0)),
+                     lambda b: array.array('b', b).tolist()),
+    pyaudio.paUInt8: (lambda v: 128 + int(f32(clip(v) * 127.0)),
+                      lambda b: array.array('B', b).tolist()),
+}
+
+SPECIAL = [0.0, 0.5, -0.5, 1.0, -1.0, 2.0, -7.0,
+           math.inf, -math.inf, math.nan]
+
+for fmt, (expect, unpack) in FORMATS.items():
+    # every length up to past two AVX2 vectors, so that each special
+    # value lands in both the vectorized part and the tail
+    for n in range(1, 40):
+        for v in SPECIAL:
+            samples = [f32(v)] * n
+            got = unpack(pyaudio.convert(array.array('f', samples),
+                                         pyaudio.paFloat32, fmt))
+            assert got == [expect(v)] * n, (fmt, n, v, got)
+
+    print("OK: paFloat32 to format %d" % fmt)
@@ -0,0 +1,23 @@
+""" PyAudio Example: Play a wave file straight from disk (memory-mapped) """
+
+import pyaudio
+import sys
+import time
+
+if len(sys.argv) < 2:
+    print("Plays a wave file.\n\nUsage: %s filename.wav" % sys.argv[0])
+    sys.exit(-1)
+
+p = pyaudio.PyAudio()
+
+# PortAudio's callback reads from the mapped file; no Python in the loop
+stream = p.open_file_playback(sys.argv[1])
+
+# wait for stream to finish
+while stream.is_active():
+    time.sleep(0.1)
+
+stream.stop_stream()
+stream.close()
+
+p.terminate()
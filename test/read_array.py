@@ -0,0 +1,57 @@
+"""
+PyAudio Example:
+
+Test the layout of the SampleBuffer returned by Stream.read_array,
+including a timed read of a non_interleaved stream that comes up
+short. """
+
+import array
+import pyaudio
+
+CHANNELS = 2
+RATE = 44100
+
+p = pyaudio.PyAudio()
+
+def check_layout(buf, planar):
+    m = memoryview(buf)
+    assert m.shape == (buf.frames, buf.channels), m.shape
+    assert m.nbytes == buf.frames * buf.channels * m.itemsize
+
+    # the strides must describe the samples as they are stored, so
+    # that contiguous consumers see the same values as strided ones
+    if planar:
+        assert m.f_contiguous, m.strides
+        stored = array.array(m.format, m.tobytes(order = 'F'))
+        for c in range(buf.channels):
+            column = [row[c] for row in m.tolist()]
+            assert column == stored[c * buf.frames:
+                                    (c + 1) * buf.frames].tolist()
+    else:
+        assert m.c_contiguous, m.strides
+        stored = array.array(m.format, m.tobytes(order = 'C'))
+        assert sum(m.tolist(), []) == stored.tolist()
+
+for planar in (False, True):
+    stream = p.open(channels = CHANNELS,
+                    rate = RATE,
+                    format = pyaudio.paInt16,
+                    input = True,
+                    non_interleaved = planar)
+
+    buf = stream.read_array(1024, exception_on_overflow = False)
+    assert buf.frames == 1024
+    check_layout(buf, planar)
+
+    # ten seconds of audio cannot arrive within the timeout
+    buf = stream.read_array(10 * RATE,
+                            exception_on_overflow = False,
+                            timeout = 0.05)
+    assert buf.frames < 10 * RATE
+    check_layout(buf, planar)
+    print("OK: %s read of %d frames" %
+          ("non_interleaved" if planar else "interleaved", buf.frames))
+
+    stream.close()
+
+p.terminate()
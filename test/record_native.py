@@ -0,0 +1,33 @@
+"""
+PyAudio example:
+Record to a WAVE file from a native writer thread, starting a new file
+every minute.
+"""
+
+import pyaudio
+import sys
+import time
+
+FORMAT = pyaudio.paInt16
+CHANNELS = 2
+RATE = 44100
+RECORD_SECONDS = 5
+WAVE_OUTPUT_FILENAME = "output.wav"
+
+if sys.platform == 'darwin':
+    CHANNELS = 1
+
+p = pyaudio.PyAudio()
+
+# writes output.0000.wav, output.0001.wav, ...
+stream = p.open_recorder(WAVE_OUTPUT_FILENAME, FORMAT, CHANNELS, RATE,
+                         rotate_seconds = 60)
+
+print("* recording")
+time.sleep(RECORD_SECONDS)
+print("* done recording")
+
+stream.stop_stream()
+stream.close()
+
+p.terminate()